@@ -0,0 +1,368 @@
+#include "Analysis.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace
+{
+
+constexpr size_t memory_size = RomAnalysis::memory_size;
+
+bool is_skip(Op op) noexcept {
+    switch (op) {
+    case Op::SeByte:
+    case Op::Sne:
+    case Op::SeReg:
+    case Op::SneReg:
+    case Op::Skp:
+    case Op::Sknp: return true;
+    default: return false;
+    }
+}
+
+// instructions after which the next one is not simply the one at pc + 2
+bool ends_flow(Op op) noexcept {
+    switch (op) {
+    case Op::Invalid:
+    case Op::Ret:
+    case Op::Jp:
+    case Op::Call:
+    case Op::JpOffset: return true;
+    default: return is_skip(op);
+    }
+}
+
+// I where it is known. A block starts out Unset until a path into it has been seen.
+struct IndexState {
+    enum Kind : uint8_t {
+        Unset,
+        Known,
+        Unknown
+    };
+    Kind kind      = Unset;
+    uint16_t value = 0;
+
+    bool operator==(const IndexState& other) const noexcept { return kind == other.kind && value == other.value; }
+};
+
+IndexState meet(const IndexState& a, const IndexState& b) noexcept {
+    if (a.kind == IndexState::Unset)
+        return b;
+    if (b.kind == IndexState::Unset || a == b)
+        return a;
+    return { IndexState::Unknown, 0 };
+}
+
+class Analyzer {
+public:
+    Analyzer(const uint8_t* bytes, size_t size, const Quirks& profile_quirks)
+        : rom(bytes),
+          quirks(profile_quirks) {
+        analysis.rom_end = load_address + size;
+    }
+
+    RomAnalysis run() {
+        explore();
+        build_blocks();
+        link_returns();
+        find_loops();
+        find_code_writes();
+        return std::move(analysis);
+    }
+
+private:
+    const uint8_t* rom;
+    const Quirks& quirks;
+    RomAnalysis analysis{};
+    std::bitset<memory_size> leaders;
+    std::vector<uint16_t> block_at = std::vector<uint16_t>(memory_size); // index + 1 into blocks, 0 if none starts there
+
+    bool in_rom(size_t address) const noexcept { return address >= load_address && address + 1 < analysis.rom_end; }
+
+    const Instruction& instruction_at(size_t address) const noexcept {
+        const uint8_t* bytes = rom + (address - load_address);
+        return decoded(static_cast<uint16_t>(bytes[0] << 8 | bytes[1]));
+    }
+
+    const CfgBlock* block_starting_at(size_t address) const noexcept {
+        return address < memory_size && block_at[address] != 0 ? &analysis.blocks[block_at[address] - 1u] : nullptr;
+    }
+
+    // Visits every instruction that can be reached from the load address and marks where blocks have to start
+    void explore() {
+        std::vector<size_t> pending{ load_address };
+        const auto follow = [&](size_t target) {
+            if (target < memory_size)
+                leaders[target] = true;
+            pending.push_back(target);
+        };
+        leaders[load_address] = true;
+        while (!pending.empty()) {
+            const size_t pc = pending.back();
+            pending.pop_back();
+            if (!in_rom(pc)) {
+                analysis.external_targets.push_back(static_cast<uint16_t>(pc));
+                continue;
+            }
+            if (analysis.instructions[pc])
+                continue;
+            analysis.instructions[pc] = true;
+            analysis.code[pc]         = true;
+            analysis.code[pc + 1]     = true;
+
+            const Instruction& instruction = instruction_at(pc);
+            switch (instruction.op) {
+            case Op::Invalid:
+            case Op::Ret: break;
+            case Op::JpOffset: analysis.indirect_jumps.push_back(static_cast<uint16_t>(pc)); break;
+            case Op::Jp: follow(instruction.nnn); break;
+            case Op::Call:
+                if (in_rom(instruction.nnn))
+                    analysis.subroutines.push_back(instruction.nnn);
+                follow(instruction.nnn);
+                follow(pc + 2);
+                break;
+            default:
+                if (is_skip(instruction.op)) {
+                    follow(pc + 2);
+                    follow(pc + 4);
+                } else {
+                    pending.push_back(pc + 2);
+                }
+                break;
+            }
+        }
+
+        for (std::vector<uint16_t>* addresses : { &analysis.subroutines, &analysis.indirect_jumps, &analysis.external_targets }) {
+            std::sort(addresses->begin(), addresses->end());
+            addresses->erase(std::unique(addresses->begin(), addresses->end()), addresses->end());
+        }
+    }
+
+    // Splits the instructions into blocks at every leader and after every instruction that does not simply go on
+    void build_blocks() {
+        for (size_t start = load_address; start < analysis.rom_end; ++start) {
+            if (!leaders[start] || !analysis.instructions[start])
+                continue;
+            CfgBlock block{ static_cast<uint16_t>(start), 0, 0, {} };
+            size_t pc = start;
+            for (;;) {
+                const Instruction& instruction = instruction_at(pc);
+                const size_t next              = pc + 2;
+                const auto add                 = [&](size_t target, EdgeKind kind) { block.successors.push_back({ static_cast<uint16_t>(target), kind }); };
+                if (ends_flow(instruction.op)) {
+                    if (instruction.op == Op::Jp) {
+                        add(instruction.nnn, EdgeKind::Jump);
+                    } else if (instruction.op == Op::Call) {
+                        add(instruction.nnn, EdgeKind::Call);
+                    } else if (is_skip(instruction.op)) {
+                        add(next, EdgeKind::Next);
+                        add(pc + 4, EdgeKind::Skip);
+                    }
+                } else if (!in_rom(next) || leaders[next]) {
+                    add(next, EdgeKind::Next);
+                } else {
+                    pc = next;
+                    continue;
+                }
+                block.last = static_cast<uint16_t>(pc);
+                block.end  = static_cast<uint16_t>(next);
+                break;
+            }
+            analysis.blocks.push_back(std::move(block));
+            block_at[start] = static_cast<uint16_t>(analysis.blocks.size());
+        }
+    }
+
+    // The blocks that follow from block within the same subroutine, with a call standing in for everything up to
+    // the return to the instruction after it
+    template <typename Function>
+    void for_each_local_successor(const CfgBlock& block, Function&& function) const {
+        for (const CfgEdge& edge : block.successors) {
+            const size_t target = edge.kind == EdgeKind::Call ? block.end : edge.target;
+            if (edge.kind != EdgeKind::Return)
+                if (const CfgBlock* successor = block_starting_at(target))
+                    function(*successor);
+        }
+    }
+
+    // Every 00EE that a subroutine can get to returns to the instruction after each of its calls
+    void link_returns() {
+        // the instructions after the calls of every subroutine, in the same order as the subroutines
+        std::vector<std::vector<uint16_t>> return_sites(analysis.subroutines.size());
+        for (const CfgBlock& block : analysis.blocks) {
+            const Instruction& last = instruction_at(block.last);
+            if (last.op != Op::Call || !in_rom(last.nnn))
+                continue;
+            const auto sub = std::lower_bound(analysis.subroutines.begin(), analysis.subroutines.end(), last.nnn);
+            return_sites[static_cast<size_t>(sub - analysis.subroutines.begin())].push_back(block.end);
+        }
+
+        std::vector<bool> reached(analysis.blocks.size());
+        std::vector<const CfgBlock*> pending;
+        for (size_t sub = 0; sub < analysis.subroutines.size(); ++sub) {
+            std::fill(reached.begin(), reached.end(), false);
+            pending.assign(1, block_starting_at(analysis.subroutines[sub]));
+            reached[block_at[analysis.subroutines[sub]] - 1u] = true;
+            while (!pending.empty()) {
+                const CfgBlock& block = *pending.back();
+                pending.pop_back();
+                if (instruction_at(block.last).op == Op::Ret) {
+                    auto& successors = analysis.blocks[block_at[block.start] - 1u].successors;
+                    for (const uint16_t site : return_sites[sub]) {
+                        if (std::none_of(successors.begin(), successors.end(), [&](const CfgEdge& edge) { return edge.target == site; }))
+                            successors.push_back({ site, EdgeKind::Return });
+                    }
+                }
+                for_each_local_successor(block, [&](const CfgBlock& successor) {
+                    const size_t index = block_at[successor.start] - 1u;
+                    if (!reached[index]) {
+                        reached[index] = true;
+                        pending.push_back(&successor);
+                    }
+                });
+            }
+        }
+    }
+
+    // A depth first walk of every subroutine and of the code it is called from, an edge back to a block that is
+    // still being walked closes a loop
+    void find_loops() {
+        enum class Mark : uint8_t {
+            New,
+            Open,
+            Done
+        };
+        std::vector<Mark> marks(analysis.blocks.size());
+        std::vector<std::pair<const CfgBlock*, std::vector<const CfgBlock*>>> stack;
+        const auto open = [&](const CfgBlock& block) {
+            marks[block_at[block.start] - 1u] = Mark::Open;
+            std::vector<const CfgBlock*> successors;
+            for_each_local_successor(block, [&](const CfgBlock& successor) { successors.push_back(&successor); });
+            stack.emplace_back(&block, std::move(successors));
+        };
+
+        std::vector<uint16_t> entries{ load_address };
+        entries.insert(entries.end(), analysis.subroutines.begin(), analysis.subroutines.end());
+        for (const uint16_t entry : entries) {
+            const CfgBlock* root = block_starting_at(entry);
+            if (root == nullptr)
+                continue;
+            std::fill(marks.begin(), marks.end(), Mark::New);
+            open(*root);
+            while (!stack.empty()) {
+                auto& [block, successors] = stack.back();
+                if (successors.empty()) {
+                    marks[block_at[block->start] - 1u] = Mark::Done;
+                    stack.pop_back();
+                    continue;
+                }
+                const CfgBlock& successor = *successors.back();
+                successors.pop_back();
+                const Mark mark = marks[block_at[successor.start] - 1u];
+                if (mark == Mark::Open)
+                    analysis.loops.push_back({ successor.start, block->start });
+                else if (mark == Mark::New)
+                    open(successor);
+            }
+        }
+
+        const auto by_header = [](const CfgLoop& a, const CfgLoop& b) { return a.header != b.header ? a.header < b.header : a.latch < b.latch; };
+        const auto same      = [](const CfgLoop& a, const CfgLoop& b) { return a.header == b.header && a.latch == b.latch; };
+        std::sort(analysis.loops.begin(), analysis.loops.end(), by_header);
+        analysis.loops.erase(std::unique(analysis.loops.begin(), analysis.loops.end(), same), analysis.loops.end());
+    }
+
+    // what instruction leaves in I
+    IndexState step(const Instruction& instruction, IndexState index) const noexcept {
+        switch (instruction.op) {
+        case Op::LdAddr: return { IndexState::Known, instruction.nnn };
+        case Op::AddIdxReg:
+        case Op::LdFont:
+        case Op::LdHiresFont: return { IndexState::Unknown, 0 };
+        case Op::LdRegDump:
+        case Op::LdRegStore:
+            if (index.kind == IndexState::Known && quirks.load_store_advance == IndexAdvance::ByX)
+                index.value = static_cast<uint16_t>(index.value + instruction.x);
+            else if (index.kind == IndexState::Known && quirks.load_store_advance == IndexAdvance::ByXPlusOne)
+                index.value = static_cast<uint16_t>(index.value + instruction.x + 1);
+            return index;
+        default: return index;
+        }
+    }
+
+    // Works out I at the start of every block, then checks each Fx55 and Fx33 against the code found by explore().
+    // Paths that disagree on I leave it unknown, so does calling a subroutine that does not return within the rom.
+    void find_code_writes() {
+        std::vector<IndexState> entry(analysis.blocks.size());
+        std::vector<bool> queued(analysis.blocks.size());
+        std::vector<size_t> pending;
+        const auto reach = [&](size_t target, const IndexState& index) {
+            const CfgBlock* block = block_starting_at(target);
+            if (block == nullptr)
+                return;
+            const size_t i         = block_at[block->start] - 1u;
+            const IndexState state = meet(entry[i], index);
+            if (state == entry[i] && entry[i].kind != IndexState::Unset)
+                return;
+            entry[i] = state;
+            if (!queued[i]) {
+                queued[i] = true;
+                pending.push_back(i);
+            }
+        };
+        const auto exit_state = [&](const CfgBlock& block, IndexState index) {
+            for (size_t pc = block.start; pc < block.end; pc += 2)
+                index = step(instruction_at(pc), index);
+            return index;
+        };
+
+        // the emulator starts with I = 0
+        reach(load_address, { IndexState::Known, 0 });
+        for (const CfgBlock& block : analysis.blocks) {
+            const Instruction& last = instruction_at(block.last);
+            if (last.op == Op::Call && !std::binary_search(analysis.subroutines.begin(), analysis.subroutines.end(), last.nnn))
+                reach(block.end, { IndexState::Unknown, 0 });
+        }
+        while (!pending.empty()) {
+            const size_t i = pending.back();
+            pending.pop_back();
+            queued[i]              = false;
+            const CfgBlock& block  = analysis.blocks[i];
+            const IndexState index = exit_state(block, entry[i]);
+            for (const CfgEdge& edge : block.successors)
+                reach(edge.target, index);
+        }
+
+        for (size_t i = 0; i < analysis.blocks.size(); ++i) {
+            IndexState index = entry[i];
+            for (size_t pc = analysis.blocks[i].start; pc < analysis.blocks[i].end; pc += 2) {
+                const Instruction& instruction = instruction_at(pc);
+                const size_t length            = instruction.op == Op::LdRegDump ? instruction.x + 1u : instruction.op == Op::LdBcd ? 3 : 0;
+                if (length != 0) {
+                    if (index.kind != IndexState::Known)
+                        analysis.code_writes.push_back({ static_cast<uint16_t>(pc), std::nullopt });
+                    else if (writes_code(index.value, length))
+                        analysis.code_writes.push_back({ static_cast<uint16_t>(pc), index.value });
+                }
+                index = step(instruction, index);
+            }
+        }
+    }
+
+    bool writes_code(size_t address, size_t length) const noexcept {
+        for (size_t i = address; i < address + length && i < memory_size; ++i) {
+            if (analysis.code[i])
+                return true;
+        }
+        return false;
+    }
+};
+
+} // namespace
+
+RomAnalysis analyze_rom(const uint8_t* rom, size_t size, const Quirks& quirks) {
+    if (size > Chip8Emulator::max_program_size)
+        throw std::runtime_error("Not enough memory to load program");
+    return Analyzer(rom, size, quirks).run();
+}
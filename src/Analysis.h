@@ -0,0 +1,68 @@
+#pragma once
+
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+#include "Chip8Emulator.h"
+
+// How control gets from the end of one basic block to the start of another
+enum class EdgeKind : uint8_t {
+    Next,  // falls through, or the skip of an Exnn or 3xkk-9xy0 is not taken
+    Jump,  // 1nnn
+    Skip,  // the skip is taken
+    Call,  // 2nnn to the subroutine
+    Return // 00EE back to the instruction after one of the calls of its subroutine
+};
+
+struct CfgEdge {
+    uint16_t target;
+    EdgeKind kind;
+};
+
+// A straight run of instructions that is only entered at its start and only left after its last instruction
+struct CfgBlock {
+    uint16_t start;
+    uint16_t end;  // one past the last instruction
+    uint16_t last; // address of the last instruction
+    std::vector<CfgEdge> successors;
+};
+
+// A back edge found by a depth first walk of a subroutine (or of the code from the load address on)
+struct CfgLoop {
+    uint16_t header; // the block the loop jumps back to
+    uint16_t latch;  // the block that jumps back
+};
+
+// An Fx55 or Fx33 that writes to bytes of the rom that are executed, or whose I could not be worked out
+struct CodeWrite {
+    uint16_t address;
+    std::optional<uint16_t> target; // I at the write, if it is the same on every path that gets there
+};
+
+// What analyze_rom() found out about a rom without running it. Everything reachable from the load address through
+// jumps, calls, skips and returns counts as code and every other byte of the rom as data. Bnnn jumps to an address
+// that depends on a register, so code that is only reached through one shows up as data.
+struct RomAnalysis {
+    static constexpr size_t memory_size = 4096;
+
+    size_t rom_end;                         // load_address + the size of the rom
+    std::bitset<memory_size> code;          // every byte of an instruction that can be reached
+    std::bitset<memory_size> instructions;  // the first byte of each of those instructions
+    std::vector<CfgBlock> blocks;           // by start address, the first one starts at the load address
+    std::vector<uint16_t> subroutines;      // call targets within the rom, in order
+    std::vector<CfgLoop> loops;             // by header
+    std::vector<uint16_t> indirect_jumps;   // Bnnn instructions, in order
+    std::vector<CodeWrite> code_writes;     // in order
+    std::vector<uint16_t> external_targets; // jumps, calls and fall throughs that leave the rom, in order
+
+    size_t code_bytes() const noexcept { return code.count(); }
+    size_t data_bytes() const noexcept { return rom_end - load_address - code.count(); }
+};
+
+// Builds the control flow graph of a rom as it would be loaded by Chip8Emulator. quirks decides where Fx55 and Fx65
+// leave I, which matters for finding the writes to code that follow them. Throws std::runtime_error if the rom does
+// not fit in memory.
+RomAnalysis analyze_rom(const uint8_t* rom, size_t size, const Quirks& quirks);
@@ -0,0 +1,165 @@
+#include "BatchRunner.h"
+
+#include "Lockstep.h"
+
+#include <algorithm>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace
+{
+
+// chunks per worker, enough for stealing to even out instances that stop early without much locking
+constexpr size_t chunks_per_worker = 16;
+
+struct Chunk {
+    size_t begin;
+    size_t end;
+};
+
+// A worker takes chunks from the back of its own queue and other workers steal from the front. Chunks are only
+// ever added before the workers start, so a worker is done once it finds every queue empty.
+class alignas(64) WorkQueue {
+public:
+    void push(Chunk chunk) {
+        const std::lock_guard lock(mutex);
+        chunks.push_back(chunk);
+    }
+
+    std::optional<Chunk> pop() {
+        const std::lock_guard lock(mutex);
+        if (chunks.empty())
+            return std::nullopt;
+        const Chunk chunk = chunks.back();
+        chunks.pop_back();
+        return chunk;
+    }
+
+    std::optional<Chunk> steal() {
+        const std::lock_guard lock(mutex);
+        if (chunks.empty())
+            return std::nullopt;
+        const Chunk chunk = chunks.front();
+        chunks.pop_front();
+        return chunk;
+    }
+
+private:
+    std::mutex mutex;
+    std::deque<Chunk> chunks;
+};
+
+InstanceResult run_instance(Chip8Emulator& emulator, size_t instance, const BatchSettings& settings) {
+    std::optional<TraceRecorder> trace;
+    if (settings.trace_directory)
+        trace.emplace(*settings.trace_directory + "/" + std::to_string(instance) + ".trace", settings.trace_length);
+
+    InstanceStatus status     = InstanceStatus::BudgetReached;
+    const uint64_t last_cycle = emulator.cycles() + settings.cycles;
+    while (emulator.cycles() < last_cycle) {
+        const uint64_t budget              = last_cycle - emulator.cycles();
+        const Chip8Emulator::Action action = trace ? emulator.run_cycles(budget, *trace) : run_engine(emulator, settings.engine, budget);
+        if (action == Chip8Emulator::Action::Crash) {
+            status = InstanceStatus::Crashed;
+            break;
+        } else if (action == Chip8Emulator::Action::WaitForInput) {
+            if (!settings.wait_key) {
+                status = InstanceStatus::WaitingForInput;
+                break;
+            }
+            emulator.key_pressed_upon_wait(*settings.wait_key);
+        }
+    }
+    return { status, emulator.cycles(), emulator.registers(), emulator.index(), emulator.pc(), emulator.display_rows(), emulator.hires() };
+}
+
+InstanceStatus instance_status(LockstepGroup::LaneStatus status) {
+    switch (status) {
+    case LockstepGroup::LaneStatus::WaitingForInput: return InstanceStatus::WaitingForInput;
+    case LockstepGroup::LaneStatus::Crashed: return InstanceStatus::Crashed;
+    default: return InstanceStatus::BudgetReached;
+    }
+}
+
+void run_lockstep(std::vector<Chip8Emulator>& instances, std::vector<InstanceResult>& results, Chunk chunk,
+                  const BatchSettings& settings) {
+    std::array<Chip8Emulator*, LockstepGroup::max_lanes> machines{};
+    for (size_t first = chunk.begin; first < chunk.end; first += LockstepGroup::max_lanes) {
+        const size_t count = std::min(LockstepGroup::max_lanes, chunk.end - first);
+        for (size_t lane = 0; lane < count; ++lane)
+            machines[lane] = &instances[first + lane];
+
+        LockstepGroup group(machines.data(), count);
+        group.run(settings.cycles, settings.wait_key);
+        for (size_t lane = 0; lane < count; ++lane) {
+            const Chip8Emulator& emulator = instances[first + lane];
+            results[first + lane]         = { instance_status(group.status(lane)), emulator.cycles(), emulator.registers(),
+                                              emulator.index(), emulator.pc(), emulator.display_rows(), emulator.hires() };
+        }
+    }
+}
+
+void work(size_t self, std::vector<WorkQueue>& queues, std::vector<Chip8Emulator>& instances,
+          std::vector<InstanceResult>& results, const BatchSettings& settings, std::exception_ptr& error) {
+    try {
+        while (true) {
+            std::optional<Chunk> chunk = queues[self].pop();
+            for (size_t i = 1; !chunk && i < queues.size(); ++i)
+                chunk = queues[(self + i) % queues.size()].steal();
+            if (!chunk)
+                return;
+
+            // every instance belongs to exactly one chunk, so results can be written without further locking
+            if (settings.lockstep) {
+                run_lockstep(instances, results, *chunk, settings);
+            } else {
+                for (size_t i = chunk->begin; i < chunk->end; ++i)
+                    results[i] = run_instance(instances[i], i, settings);
+            }
+        }
+    } catch (...) {
+        // this worker stops, the others finish their chunks before run_batch() rethrows
+        error = std::current_exception();
+    }
+}
+
+} // namespace
+
+std::vector<InstanceResult> run_batch(std::vector<Chip8Emulator>& instances, const BatchSettings& settings) {
+    std::vector<InstanceResult> results(instances.size());
+    if (instances.empty())
+        return results;
+
+    const unsigned hardware_threads = std::max(1u, std::thread::hardware_concurrency());
+    const size_t worker_count       = std::min<size_t>(settings.threads != 0 ? settings.threads : hardware_threads, instances.size());
+    // whole lockstep groups per chunk, so that only the last group of the batch can be short of lanes
+    const size_t group_size   = settings.lockstep ? LockstepGroup::max_lanes : 1;
+    const size_t chunk_groups = std::max<size_t>(1, instances.size() / (worker_count * chunks_per_worker * group_size));
+    const size_t chunk_size   = chunk_groups * group_size;
+
+    std::vector<WorkQueue> queues(worker_count);
+    size_t next_queue = 0;
+    for (size_t begin = 0; begin < instances.size(); begin += chunk_size) {
+        queues[next_queue].push({ begin, std::min(begin + chunk_size, instances.size()) });
+        next_queue = (next_queue + 1) % worker_count;
+    }
+
+    // the calling thread is worker 0
+    std::vector<std::exception_ptr> errors(worker_count);
+    std::vector<std::thread> threads;
+    threads.reserve(worker_count - 1);
+    for (size_t i = 1; i < worker_count; ++i)
+        threads.emplace_back(work, i, std::ref(queues), std::ref(instances), std::ref(results), std::cref(settings), std::ref(errors[i]));
+    work(0, queues, instances, results, settings, errors[0]);
+    for (std::thread& thread : threads)
+        thread.join();
+
+    for (const std::exception_ptr& error : errors) {
+        if (error)
+            std::rethrow_exception(error);
+    }
+    return results;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "Chip8Emulator.h"
+#include "Engine.h"
+#include "Trace.h"
+
+struct BatchSettings {
+    uint64_t cycles = 10'000'000; // instructions each instance runs for, on top of any it already executed
+    Engine engine   = Engine::Blocks;
+    std::optional<uint8_t> wait_key; // key to answer Fx0A with, if not set an instance stops when it waits for input
+    unsigned threads = 0;            // 0 for one per hardware thread
+    bool lockstep    = false;        // run groups of instances with LockstepGroup, engine is then unused
+
+    // instance i records its last trace_length instructions to DIR/i.trace, only with the interpreter engine
+    std::optional<std::string> trace_directory;
+    uint32_t trace_length = TraceRecorder::default_capacity;
+};
+
+enum class InstanceStatus : uint8_t {
+    BudgetReached,
+    WaitingForInput,
+    Crashed
+};
+
+// the state an instance was left in when it stopped
+struct InstanceResult {
+    InstanceStatus status;
+    uint64_t cycles;
+    std::array<uint8_t, 16> registers;
+    uint16_t index;
+    uint16_t pc;
+    Chip8Emulator::DisplayRows display;
+    bool hires; // the display is 128x64
+};
+
+// Runs every instance until it has executed settings.cycles more instructions, crashes or waits for input that
+// settings.wait_key does not provide, spread over a pool of worker threads. The instances are cut into small chunks
+// that are dealt out to per worker queues, a worker whose queue runs dry steals from the others so instances that
+// stop early do not leave cores idle. Results are in the same order as the instances. Throws std::runtime_error if
+// a trace cannot be created.
+std::vector<InstanceResult> run_batch(std::vector<Chip8Emulator>& instances, const BatchSettings& settings);
@@ -0,0 +1,50 @@
+#include "BlockCache.h"
+
+#include <algorithm>
+
+BlockCache::Block BlockCache::get(const uint8_t* memory, uint16_t address) {
+    // there is nothing to run past the end of memory, running it crashes like the last byte does
+    if (address >= memory_size) {
+        static constexpr Instruction invalid{};
+        return { &invalid, 1 };
+    }
+    if (block_at.empty())
+        block_at.resize(memory_size);
+
+    if (const uint16_t index = block_at[address]; index != 0) {
+        const Entry& entry = blocks[index - 1];
+        return { instructions.data() + entry.first, entry.length };
+    }
+
+    const auto first = static_cast<uint32_t>(instructions.size());
+    size_t pc        = address;
+    while (pc + 1 < memory_size && instructions.size() - first < max_block_length) {
+        const Instruction& instruction = decoded(static_cast<uint16_t>((memory[pc] << 8) | memory[pc + 1]));
+        instructions.push_back(instruction);
+        code[pc]     = true;
+        code[pc + 1] = true;
+        pc += 2;
+        if (ends_block(instruction.op))
+            break;
+    }
+
+    // an address on the last byte of memory holds no whole instruction, running it crashes
+    if (pc == address)
+        instructions.push_back(Instruction{});
+
+    code_begin        = std::min<size_t>(code_begin, address);
+    code_end          = std::max(code_end, pc);
+    const auto length = static_cast<uint32_t>(instructions.size() - first);
+    blocks.push_back({ first, length });
+    block_at[address] = static_cast<uint16_t>(blocks.size());
+    return { instructions.data() + first, length };
+}
+
+void BlockCache::clear() noexcept {
+    std::fill(block_at.begin(), block_at.end(), uint16_t{ 0 });
+    blocks.clear();
+    instructions.clear();
+    code.reset();
+    code_begin = memory_size;
+    code_end   = 0;
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "Instruction.h"
+
+// Instructions that have to be the last one in a basic block. These either change the program counter in a way that
+// is not known when the block is built, interact with the timers (which are only brought up to date at the end of a
+// block), need the frontend to act, or write to memory that might hold code.
+constexpr bool ends_block(Op op) noexcept {
+    switch (op) {
+    case Op::Invalid:
+    case Op::Ret:
+    case Op::Jp:
+    case Op::Call:
+    case Op::JpOffset:
+    case Op::SeByte:
+    case Op::Sne:
+    case Op::SeReg:
+    case Op::SneReg:
+    case Op::Skp:
+    case Op::Sknp:
+    case Op::Drw:
+    case Op::LdWaitKey:
+    case Op::LdDt:
+    case Op::LdSetDt:
+    case Op::LdSt:
+    case Op::LdBcd:
+    case Op::LdRegDump:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Instructions that only touch registers and can only crash by running the pc off the end of memory, which for these
+// depends on nothing but the address they are at and the jump target. Engines that translate or vectorise
+// instructions handle exactly these themselves and leave everything else to the handlers.
+constexpr bool is_register_only(const Instruction& instruction, size_t address) noexcept {
+    constexpr size_t memory_size = 4096;
+    switch (instruction.op) {
+    case Op::Sys:
+    case Op::LdByte:
+    case Op::Add:
+    case Op::LdReg:
+    case Op::Or:
+    case Op::And:
+    case Op::Xor:
+    case Op::AddReg:
+    case Op::Sub:
+    case Op::Shr:
+    case Op::Subn:
+    case Op::Shl:
+    case Op::LdAddr:
+    case Op::AddIdxReg:
+        return address + 2 + 2 < memory_size;
+    case Op::Jp:
+        return size_t(instruction.nnn) + 2 < memory_size;
+    case Op::SeByte:
+    case Op::Sne:
+    case Op::SeReg:
+    case Op::SneReg:
+        return address + 4 + 2 < memory_size;
+    default:
+        return false;
+    }
+}
+
+// Caches straight line runs of decoded instructions by their start address so that Chip8Emulator::run_blocks() can
+// execute them without fetching and decoding each instruction again. Every block ends either with an instruction
+// for which ends_block() is true or after max_block_length instructions.
+class BlockCache {
+public:
+    static constexpr size_t max_block_length = 64;
+    static constexpr size_t memory_size      = 4096;
+
+    struct Block {
+        const Instruction* instructions;
+        size_t length;
+    };
+
+    // returns the block starting at address, building it from memory if it is not cached yet
+    Block get(const uint8_t* memory, uint16_t address);
+
+    // must be called whenever memory is written, drops every block if the write overlaps cached code
+    void invalidate(uint16_t address, size_t length) noexcept {
+        // most writes are to data well away from any code, rule those out without looking at individual bytes
+        if (address >= code_end || address + length <= code_begin)
+            return;
+        for (size_t i = address; i < address + length && i < memory_size; ++i) {
+            if (code[i]) {
+                clear();
+                return;
+            }
+        }
+    }
+
+    void clear() noexcept;
+
+private:
+    struct Entry {
+        uint32_t first;
+        uint32_t length;
+    };
+
+    // index + 1 into blocks for every start address, 0 if there is no block. Only allocated once the cache is used
+    // so that emulators that never run blocks do not pay for it.
+    std::vector<uint16_t> block_at;
+    std::vector<Entry> blocks;
+    std::vector<Instruction> instructions;
+    std::bitset<memory_size> code; // every byte that is part of a cached block
+    size_t code_begin = memory_size;
+    size_t code_end   = 0;
+};
@@ -1,94 +1,388 @@
 #include "Chip8Emulator.h"
 
+#include "IdleLoop.h"
+#include "Instrumentation.h"
+#include "Trace.h"
+
 #include <cassert>
+#include <optional>
+#include <type_traits>
+
+// The loops below rely on execute() being inlined into each of them. With a copy of the handlers per quirk profile
+// GCC no longer does that on its own, and every instruction would pay for a call. The SUPER-CHIP handlers go the
+// other way: they are rare, and inlined into every loop their own loops cost the common instructions registers.
+#if defined(_MSC_VER)
+#    define CHIP8_ALWAYS_INLINE __forceinline
+#    define CHIP8_NOINLINE      __declspec(noinline)
+#else
+#    define CHIP8_ALWAYS_INLINE inline __attribute__((always_inline))
+#    define CHIP8_NOINLINE      __attribute__((noinline))
+#endif
 
 namespace
 {
 
 constexpr uint8_t vf_index = 15;
 
-std::pair<uint8_t, uint8_t> get_regs_math_ops(uint16_t instruction) {
-    return {
-        static_cast<uint8_t>((instruction & 0x0F00) >> 8),
-        static_cast<uint8_t>((instruction & 0x00F0) >> 4)
-    };
+constexpr uint64_t rotate_right(uint64_t value, size_t shift) noexcept {
+    return (value >> shift) | (value << ((64 - shift) & 63));
+}
+
+std::pair<uint8_t, uint8_t> get_regs_math_ops(const Instruction& instruction) {
+    return { instruction.x, instruction.y };
 }
 
 } // namespace
 
+template <typename Policy>
+CHIP8_ALWAYS_INLINE Chip8Emulator::Action Chip8Emulator::execute(const Instruction& instruction) {
+    // the decode table has already resolved the opcode to its operation, this is a single jump table
+    switch (instruction.op) {
+    case Op::Invalid: return op_invalid(instruction);
+    case Op::Cls: return op_cls(instruction);
+    case Op::Ret: return op_ret(instruction);
+    case Op::ScrollDown: return op_scroll_down(instruction);
+    case Op::ScrollRight: return op_scroll_right(instruction);
+    case Op::ScrollLeft: return op_scroll_left(instruction);
+    case Op::Low: return op_low(instruction);
+    case Op::High: return op_high(instruction);
+    case Op::Sys: return op_sys(instruction);
+    case Op::Jp: return op_jp(instruction);
+    case Op::Call: return op_call(instruction);
+    case Op::SeByte: return op_se_byte(instruction);
+    case Op::Sne: return op_sne(instruction);
+    case Op::SeReg: return op_se_reg(instruction);
+    case Op::LdByte: return op_ld_byte(instruction);
+    case Op::Add: return op_add(instruction);
+    case Op::LdReg: return op_ld_reg(instruction);
+    case Op::Or: return op_or<Policy>(instruction);
+    case Op::And: return op_and<Policy>(instruction);
+    case Op::Xor: return op_xor<Policy>(instruction);
+    case Op::AddReg: return op_add_reg(instruction);
+    case Op::Sub: return op_sub(instruction);
+    case Op::Shr: return op_shr<Policy>(instruction);
+    case Op::Subn: return op_subn(instruction);
+    case Op::Shl: return op_shl<Policy>(instruction);
+    case Op::SneReg: return op_sne_reg(instruction);
+    case Op::LdAddr: return op_ld_addr(instruction);
+    case Op::JpOffset: return op_jp_offset<Policy>(instruction);
+    case Op::Rnd: return op_rnd(instruction);
+    case Op::Drw: return op_drw<Policy>(instruction);
+    case Op::Skp: return op_skp(instruction);
+    case Op::Sknp: return op_sknp(instruction);
+    case Op::LdDt: return op_ld_dt(instruction);
+    case Op::LdWaitKey: return op_ld_wait_key(instruction);
+    case Op::LdSetDt: return op_ld_set_dt(instruction);
+    case Op::LdSt: return op_ld_st(instruction);
+    case Op::AddIdxReg: return op_add_idx_reg(instruction);
+    case Op::LdFont: return op_ld_font(instruction);
+    case Op::LdHiresFont: return op_ld_hires_font(instruction);
+    case Op::LdBcd: return op_ld_bcd(instruction);
+    case Op::LdRegDump: return op_ld_reg_dump<Policy>(instruction);
+    case Op::LdRegStore: return op_ld_reg_store<Policy>(instruction);
+    case Op::LdFlagsDump: return op_ld_flags_dump(instruction);
+    case Op::LdFlagsStore: return op_ld_flags_store(instruction);
+    case Op::Count: break;
+    }
+    return Action::Crash;
+}
+
 Chip8Emulator::Action Chip8Emulator::process_next_instruction() {
-    assert(size_t(program_counter - 1) < memory.size());
-    const uint8_t hi           = memory[program_counter];
-    const uint8_t lo           = memory[program_counter + 1];
-    const uint16_t instruction = (static_cast<uint16_t>(hi) << 8) | lo;
-    cycle_count++;
+    return with_quirk_policy(profile, [this](auto policy) { return step<decltype(policy)>(); });
+}
 
-    constexpr auto cycles_for_decrement = clock_speed_hz / 60;
-    if (cycle_count % cycles_for_decrement == 0) {
-        if (delay_timer != 0)
-            delay_timer--;
-        if (sound_timer != 0)
-            sound_timer--;
+template <typename Policy>
+Chip8Emulator::Action Chip8Emulator::step() {
+    assert(size_t(program_counter) < memory.size());
+    // jumps stop at 0xFFD, but an instruction there moves the pc on to the last byte, which holds no whole instruction
+    if (size_t(program_counter + 1) >= memory.size()) {
+        advance_cycles(1);
+        return op_invalid(Instruction{});
     }
 
-    switch (instruction & 0xF000) {
-    case 0x0000:
-        if (instruction == 0x00E0) {
-            return op_cls(instruction);
-        } else if (instruction == 0x00EE) {
-            return op_ret(instruction);
-        } else {
-            return op_sys(instruction);
+    const uint8_t hi               = memory[program_counter];
+    const uint8_t lo               = memory[program_counter + 1];
+    const Instruction& instruction = decoded(static_cast<uint16_t>((hi << 8) | lo));
+    cycle_count++;
+
+    if (cycle_count % frame_length == 0)
+        tick_timers();
+
+    return execute<Policy>(instruction);
+}
+
+Chip8Emulator::Action Chip8Emulator::run_cycles(uint64_t max_instructions) {
+    NoInstrumentation none;
+    return run_cycles(max_instructions, none);
+}
+
+template <typename Instrumentation>
+Chip8Emulator::Action Chip8Emulator::run_cycles(uint64_t max_instructions, Instrumentation& instrumentation) {
+    return with_quirk_policy(profile, [&](auto policy) {
+        return run_cycles_with<decltype(policy)>(max_instructions, instrumentation);
+    });
+}
+
+template <typename Policy, typename Instrumentation>
+Chip8Emulator::Action Chip8Emulator::run_cycles_with(uint64_t max_instructions, Instrumentation& instrumentation) {
+    // the cycle of the next timer tick is worked out once per tick instead of taking a modulo every instruction
+    uint64_t next_tick        = (cycle_count / frame_length + 1) * frame_length;
+    const uint64_t last_cycle = cycle_count + max_instructions;
+    const bool sound_on       = sound_timer != 0;
+    while (cycle_count < last_cycle) {
+        if (size_t(program_counter + 1) >= memory.size()) {
+            advance_cycles(1);
+            return op_invalid(Instruction{});
         }
-    case 0x1000: return op_jp(instruction);
-    case 0x2000: return op_call(instruction);
-    case 0x3000: return op_se_byte(instruction);
-    case 0x4000: return op_sne(instruction);
-    case 0x5000: return op_se_reg(instruction);
-    case 0x6000: return op_ld_byte(instruction);
-    case 0x7000: return op_add(instruction);
-    case 0x8000: {
-        switch (instruction & 0xF) {
-        case 0x0: return op_ld_reg(instruction);
-        case 0x1: return op_or(instruction);
-        case 0x2: return op_and(instruction);
-        case 0x3: return op_xor(instruction);
-        case 0x4: return op_add_reg(instruction);
-        case 0x5: return op_sub(instruction);
-        case 0x6: return op_shr(instruction);
-        case 0x7: return op_subn(instruction);
-        case 0xE: return op_shl(instruction);
-        default: return Action::Crash;
+
+        const uint8_t hi               = memory[program_counter];
+        const uint8_t lo               = memory[program_counter + 1];
+        const auto opcode              = static_cast<uint16_t>((hi << 8) | lo);
+        const Instruction& instruction = decoded(opcode);
+        if (++cycle_count == next_tick) {
+            tick_timers();
+            next_tick += frame_length;
+        }
+
+        const uint16_t pc_before = program_counter;
+        const Action action      = execute<Policy>(instruction);
+        instrumentation.executed(*this, opcode, instruction, pc_before, action);
+        if (action != Action::DoNothing)
+            return action;
+        if ((sound_timer != 0) != sound_on)
+            return Action::SoundChanged;
+        // instrumented runs have to see every instruction, so only the plain loop skips idle loops
+        if constexpr (std::is_same_v<Instrumentation, NoInstrumentation>) {
+            if (instruction.op == Op::Jp && skip_idle_loop(last_cycle - cycle_count) != 0)
+                next_tick = (cycle_count / frame_length + 1) * frame_length;
         }
     }
-    case 0x9000: return op_sne_reg(instruction);
-    case 0xA000: return op_ld_addr(instruction);
-    case 0xB000: return op_jp_offset(instruction);
-    case 0xC000: return op_rnd(instruction);
-    case 0xD000: return op_drw(instruction);
-    case 0xE000: {
-        switch (instruction & 0xFF) {
-        case 0x9E: return op_skp(instruction);
-        case 0xA1: return op_sknp(instruction);
-        default: return Action::Crash;
+    return Action::DoNothing;
+}
+
+template Chip8Emulator::Action Chip8Emulator::run_cycles(uint64_t max_instructions, ExecutionProfile& instrumentation);
+template Chip8Emulator::Action Chip8Emulator::run_cycles(uint64_t max_instructions, TraceRecorder& instrumentation);
+
+Chip8Emulator::Action Chip8Emulator::run_blocks(uint64_t max_instructions) {
+    return with_quirk_policy(profile, [&](auto policy) { return run_blocks_with<decltype(policy)>(max_instructions); });
+}
+
+template <typename Policy>
+Chip8Emulator::Action Chip8Emulator::run_blocks_with(uint64_t max_instructions) {
+    while (max_instructions != 0) {
+        const BlockCache::Block block = block_cache.get(memory.data(), program_counter);
+        const size_t length           = std::min<uint64_t>(block.length, max_instructions);
+        max_instructions -= length;
+
+        // Only the last instruction of a block can touch the timers, so the timer decrements for the whole block can
+        // be applied in one go right before it runs. Everything before it either does nothing visible to the caller
+        // or crashes, in which case we stop there.
+        const size_t last = length - 1;
+        for (size_t i = 0; i < last; ++i) {
+            const Action action = execute<Policy>(block.instructions[i]);
+            if (action != Action::DoNothing) {
+                advance_cycles(i + 1);
+                return action;
+            }
         }
+
+        advance_cycles(length);
+        // an Fx33 or Fx55 that writes over cached code clears the cache, the block must not be looked at after it ran
+        const Op last_op    = block.instructions[last].op;
+        const Action action = execute<Policy>(block.instructions[last]);
+        if (action != Action::DoNothing)
+            return action;
+        if (last_op == Op::Jp)
+            max_instructions -= skip_idle_loop(max_instructions);
     }
-    case 0xF000: {
-        switch (instruction & 0xFF) {
-        case 0x07: return op_ld_dt(instruction);
-        case 0x0A: return op_ld_wait_key(instruction);
-        case 0x15: return op_ld_set_dt(instruction);
-        case 0x18: return op_ld_st(instruction);
-        case 0x1E: return op_add_idx_reg(instruction);
-        case 0x29: return op_ld_font(instruction);
-        case 0x33: return op_ld_bcd(instruction);
-        case 0x55: return op_ld_reg_dump(instruction);
-        case 0x65: return op_ld_reg_store(instruction);
-        default: return Action::Crash;
+    return Action::DoNothing;
+}
+
+Chip8Emulator::Action Chip8Emulator::run_compiled(uint64_t max_instructions) {
+    return with_quirk_policy(profile, [&](auto policy) { return run_compiled_with<decltype(policy)>(max_instructions); });
+}
+
+template <typename Policy>
+Chip8Emulator::Action Chip8Emulator::run_compiled_with(uint64_t max_instructions) {
+    static_assert(static_cast<uint32_t>(Action::DoNothing) == 0, "compiled code returns 0 to carry on");
+    if (!JitCompiler::supported())
+        return run_blocks_with<Policy>(max_instructions);
+    // the compiler only translates the default behaviour itself, see differs_from_default()
+    if (!jit)
+        jit = std::make_unique<JitCompiler>(&Chip8Emulator::jit_fallback<Policy>, Policy::quirks);
+
+    while (max_instructions != 0) {
+        // the compiler only translates whole instructions, leave a pc moved on from 0xFFD to the block cache
+        if (!jit->enabled() || size_t(program_counter + 1) >= memory.size())
+            return run_blocks_with<Policy>(max_instructions);
+
+        const JitCompiler::CompiledBlock block = jit->get(memory.data(), program_counter);
+        // a compiled block always runs to its end, so the tail of the budget goes through the cached blocks
+        if (block.length > max_instructions)
+            return run_blocks_with<Policy>(max_instructions);
+        if (block.code == nullptr) {
+            // nothing in the block is worth translating, interpreting it is the cheapest way through
+            for (uint32_t i = 0; i < block.length; ++i) {
+                max_instructions--;
+                if (const Action action = step<Policy>(); action != Action::DoNothing)
+                    return action;
+            }
+            continue;
+        }
+
+        // chained blocks may carry on as long as the longest possible block still fits in the budget
+        const auto budget = static_cast<uint32_t>(std::min<uint64_t>(max_instructions, UINT32_MAX));
+        const uint32_t chain_limit =
+            budget >= BlockCache::max_block_length ? budget - static_cast<uint32_t>(BlockCache::max_block_length) : 0;
+        JitFrame frame{ data_registers, index_register, program_counter, 0, chain_limit, 0, this };
+        const auto action = static_cast<Action>(block.code(&frame));
+        data_registers    = frame.v;
+        index_register    = frame.index;
+        program_counter   = frame.pc;
+        advance_cycles(frame.executed - frame.cycles_applied);
+        max_instructions -= frame.executed;
+        if (action != Action::DoNothing)
+            return action;
+        // compiled code never chains into an idle loop, it comes back here instead
+        max_instructions -= skip_idle_loop(max_instructions);
+    }
+    return Action::DoNothing;
+}
+
+template <typename Policy>
+uint32_t Chip8Emulator::jit_fallback(JitFrame* frame, uint32_t opcode, uint32_t address, uint32_t position) noexcept {
+    Chip8Emulator& emulator  = *static_cast<Chip8Emulator*>(frame->context);
+    emulator.data_registers  = frame->v;
+    emulator.index_register  = frame->index;
+    emulator.program_counter = static_cast<uint16_t>(address);
+    // the instruction may read the timers, bring them up to date first just like run_blocks() does
+    const uint32_t executed = frame->executed + position;
+    emulator.advance_cycles(executed - frame->cycles_applied);
+    frame->cycles_applied = executed;
+
+    const Action action = emulator.execute<Policy>(decoded(static_cast<uint16_t>(opcode)));
+    frame->v            = emulator.data_registers;
+    frame->index        = emulator.index_register;
+    frame->pc           = emulator.program_counter;
+    return static_cast<uint32_t>(action);
+}
+
+void Chip8Emulator::set_clock_speed(uint32_t hz) {
+    if (hz < 60)
+        throw std::invalid_argument("clock speed must be at least 60Hz");
+    frame_length = hz / 60;
+}
+
+void Chip8Emulator::set_quirk_profile(QuirkProfile new_profile) noexcept {
+    if (new_profile == profile)
+        return;
+    profile = new_profile;
+    // compiled code has the old profile's fallback and translations built in
+    jit.reset();
+}
+
+void Chip8Emulator::tick_timers() noexcept {
+    if (delay_timer != 0)
+        delay_timer--;
+    if (sound_timer != 0)
+        sound_timer--;
+}
+
+void Chip8Emulator::advance_cycles(uint64_t count) noexcept {
+    const uint64_t decrements = (cycle_count + count) / frame_length - cycle_count / frame_length;
+    cycle_count += count;
+
+    delay_timer = decrements >= delay_timer ? 0 : static_cast<uint8_t>(delay_timer - decrements);
+    sound_timer = decrements >= sound_timer ? 0 : static_cast<uint8_t>(sound_timer - decrements);
+}
+
+uint64_t Chip8Emulator::skip_idle_loop(uint64_t max_instructions) noexcept {
+    const std::optional<IdleLoop> loop = find_idle_loop(memory.data(), program_counter);
+    if (!loop)
+        return 0;
+
+    // a pass for a given value of the delay timer, returns whether it goes round again
+    std::array<uint8_t, 16> registers = data_registers;
+    uint16_t index                    = index_register;
+    const auto pass                   = [&](uint8_t timer) {
+        for (size_t i = 0; i < loop->load_count; ++i) {
+            const Instruction& load = loop->loads[i];
+            if (load.op == Op::LdAddr)
+                index = load.nnn;
+            else
+                registers[load.x] = load.op == Op::LdDt ? timer : load.kk;
+        }
+        if (!loop->skip)
+            return true;
+        const Instruction& skip = *loop->skip;
+        const uint8_t vx        = registers[skip.x];
+        bool skipped            = false;
+        switch (skip.op) {
+        case Op::SeByte: skipped = vx == skip.kk; break;
+        case Op::Sne: skipped = vx != skip.kk; break;
+        case Op::SeReg: skipped = vx == registers[skip.y]; break;
+        case Op::SneReg: skipped = vx != registers[skip.y]; break;
+        // a key that does not exist crashes, leave that to the handler
+        case Op::Skp: return vx < 16 && input_state[vx] == loop->loops_when_skipped;
+        case Op::Sknp: return vx < 16 && input_state[vx] != loop->loops_when_skipped;
+        default: break;
+        }
+        return skipped == loop->loops_when_skipped;
+    };
+
+    // The delay timer only ever counts down and is read at most once per pass, so the loop goes round until the
+    // first pass that reads a value it stops at. Ticks only happen when the cycle count reaches a multiple of
+    // frame_length, tick t from now right before instruction first_tick + (t - 1) * frame_length.
+    const uint64_t first_tick = (cycle_count / frame_length + 1) * frame_length;
+    const auto timer_read     = std::find_if(loop->loads.begin(), loop->loads.begin() + loop->load_count,
+                                             [](const Instruction& load) { return load.op == Op::LdDt; });
+    const uint64_t timer_at   = static_cast<uint64_t>(timer_read - loop->loads.begin()) + 1; // within a pass
+    uint64_t passes           = max_instructions / loop->length;
+    if (timer_read == loop->loads.begin() + loop->load_count) {
+        if (!pass(delay_timer))
+            return 0;
+    } else {
+        int timer = delay_timer;
+        while (timer >= 0 && pass(static_cast<uint8_t>(timer)))
+            --timer;
+        if (timer >= 0) {
+            // passes that read the timer before it has ticked down to timer go round, later ones do not
+            const uint64_t stop_tick = first_tick + static_cast<uint64_t>(delay_timer - timer - 1) * frame_length;
+            if (delay_timer == timer || stop_tick <= cycle_count + timer_at)
+                return 0;
+            passes = std::min(passes, (stop_tick - cycle_count - timer_at - 1) / loop->length + 1);
         }
     }
+    // stepping stops right after the sound timer runs out, the skip has to end before that tick
+    if (sound_timer != 0) {
+        const uint64_t sound_off = first_tick + (sound_timer - 1u) * frame_length;
+        passes                   = std::min(passes, (sound_off - 1 - cycle_count) / loop->length);
     }
-    return Action::Crash;
+    if (passes == 0)
+        return 0;
+
+    // the machine is left as the last of the passes leaves it, with the timer as it was when that pass read it
+    const uint64_t last_pass = cycle_count + (passes - 1) * loop->length;
+    const uint64_t ticks     = (last_pass + timer_at) / frame_length - cycle_count / frame_length;
+    pass(ticks >= delay_timer ? 0 : static_cast<uint8_t>(delay_timer - ticks));
+    data_registers = registers;
+    index_register = index;
+    advance_cycles(passes * loop->length);
+    return passes * loop->length;
+}
+
+void Chip8Emulator::memory_written(uint16_t address, size_t length) noexcept {
+    block_cache.invalidate(address, length);
+    if (jit)
+        jit->invalidate(address, length);
+}
+
+template <typename Policy>
+void Chip8Emulator::advance_index(uint8_t last_register) noexcept {
+    if constexpr (Policy::quirks.load_store_advance == IndexAdvance::ByX)
+        index_register += last_register;
+    else if constexpr (Policy::quirks.load_store_advance == IndexAdvance::ByXPlusOne)
+        index_register += last_register + 1;
 }
 
 Chip8Emulator::Action Chip8Emulator::increase_pc(Action action) {
@@ -112,13 +406,75 @@ void Chip8Emulator::key_pressed_upon_wait(uint8_t key) noexcept {
     data_registers[wait_for_key_reg_idx] = key;
 }
 
-Chip8Emulator::Action Chip8Emulator::op_cls([[maybe_unused]] uint16_t instruction) {
-    for (auto& col : pixel_memory)
-        std::fill(col.begin(), col.end(), false);
+Snapshot Chip8Emulator::snapshot() const noexcept {
+    Snapshot snapshot{};
+    snapshot.magic   = Snapshot::expected_magic;
+    snapshot.version = Snapshot::current_version;
+    snapshot.size    = sizeof(Snapshot);
+
+    snapshot.memory    = memory;
+    snapshot.display   = pixel_rows;
+    snapshot.stack     = stack.entries();
+    snapshot.registers = data_registers;
+    for (size_t key = 0; key < input_state.size(); ++key)
+        snapshot.input[key] = input_state[key];
+    snapshot.flags         = user_flags;
+    snapshot.index         = index_register;
+    snapshot.pc            = program_counter;
+    snapshot.stack_depth   = stack.depth();
+    snapshot.delay_timer   = delay_timer;
+    snapshot.sound_timer   = sound_timer;
+    snapshot.wait_register = wait_for_key_reg_idx;
+    snapshot.hires         = hires_mode;
+    snapshot.cycles        = cycle_count;
+    snapshot.rng           = rng.state();
+    return snapshot;
+}
+
+void Chip8Emulator::restore(const Snapshot& snapshot) {
+    if (snapshot.wait_register >= data_registers.size())
+        throw std::runtime_error("snapshot has an invalid wait register");
+    if (size_t(snapshot.pc) + 1 >= memory.size())
+        throw std::runtime_error("snapshot has an invalid program counter");
+    stack.assign(snapshot.stack, snapshot.stack_depth);
+
+    // Restoring writes memory like any instruction does, only where it changes bytes. Going back to a snapshot of the
+    // same rom, like every reset of an environment, usually only changes data and keeps the cached and compiled code.
+    for (size_t i = 0; i < memory.size(); ++i) {
+        if (memory[i] != snapshot.memory[i])
+            memory_written(static_cast<uint16_t>(i), 1);
+    }
+    memory         = snapshot.memory;
+    pixel_rows     = snapshot.display;
+    hires_mode     = snapshot.hires != 0;
+    dirty_rows     = ~uint64_t{ 0 }; // whatever was shown before has nothing to do with the restored display
+    data_registers = snapshot.registers;
+    for (size_t key = 0; key < input_state.size(); ++key)
+        input_state[key] = snapshot.input[key] != 0;
+    user_flags           = snapshot.flags;
+    index_register       = snapshot.index;
+    program_counter      = snapshot.pc;
+    delay_timer          = snapshot.delay_timer;
+    sound_timer          = snapshot.sound_timer;
+    wait_for_key_reg_idx = snapshot.wait_register;
+    cycle_count          = snapshot.cycles;
+    rng.set_state(snapshot.rng);
+}
+
+Chip8Emulator::Action Chip8Emulator::op_invalid([[maybe_unused]] const Instruction& instruction) {
+    return Action::Crash;
+}
+
+Chip8Emulator::Action Chip8Emulator::op_cls([[maybe_unused]] const Instruction& instruction) {
+    for (size_t y = 0; y < hires_height; ++y) {
+        if ((pixel_rows[0][y] | pixel_rows[1][y]) != 0)
+            dirty_rows |= uint64_t{ 1 } << y;
+    }
+    pixel_rows = {};
     return increase_pc(Action::DoNothing);
 }
 
-Chip8Emulator::Action Chip8Emulator::op_ret([[maybe_unused]] uint16_t instruction) {
+Chip8Emulator::Action Chip8Emulator::op_ret([[maybe_unused]] const Instruction& instruction) {
     if (stack.empty())
         return Action::Crash;
     const uint16_t new_pc = stack.top();
@@ -126,25 +482,79 @@ Chip8Emulator::Action Chip8Emulator::op_ret([[maybe_unused]] uint16_t instructio
     return change_pc(new_pc + 2);
 }
 
-Chip8Emulator::Action Chip8Emulator::op_sys([[maybe_unused]] uint16_t instruction) {
+// Scrolling down is a memmove per half, scrolling sideways a shift per word that carries the bits crossing from one
+// half into the other. In low resolution the scrolls move by low resolution pixels and only touch the first half.
+CHIP8_NOINLINE Chip8Emulator::Action Chip8Emulator::op_scroll_down(const Instruction& instruction) {
+    const size_t height = screen_height();
+    const size_t lines  = std::min<size_t>(instruction.n, height);
+    for (size_t half = 0; half < (hires_mode ? 2 : 1); ++half) {
+        uint64_t* words = pixel_rows[half].data();
+        std::move_backward(words, words + height - lines, words + height);
+        std::fill(words, words + lines, 0);
+    }
+    if (lines != 0)
+        dirty_rows |= ~uint64_t{ 0 } >> (64 - height);
+    return increase_pc(Action::DoNothing);
+}
+
+CHIP8_NOINLINE Chip8Emulator::Action Chip8Emulator::op_scroll_right([[maybe_unused]] const Instruction& instruction) {
+    auto& [left, right] = pixel_rows;
+    for (size_t y = 0; y < screen_height(); ++y) {
+        if (hires_mode)
+            right[y] = (right[y] >> 4) | (left[y] << 60);
+        left[y] >>= 4;
+    }
+    dirty_rows |= ~uint64_t{ 0 } >> (64 - screen_height());
+    return increase_pc(Action::DoNothing);
+}
+
+CHIP8_NOINLINE Chip8Emulator::Action Chip8Emulator::op_scroll_left([[maybe_unused]] const Instruction& instruction) {
+    // the right half is blank in low resolution, so nothing comes over from it
+    auto& [left, right] = pixel_rows;
+    for (size_t y = 0; y < screen_height(); ++y) {
+        left[y] = (left[y] << 4) | (right[y] >> 60);
+        right[y] <<= 4;
+    }
+    dirty_rows |= ~uint64_t{ 0 } >> (64 - screen_height());
+    return increase_pc(Action::DoNothing);
+}
+
+CHIP8_NOINLINE Chip8Emulator::Action Chip8Emulator::op_low([[maybe_unused]] const Instruction& instruction) {
+    set_resolution(false);
+    return increase_pc(Action::DoNothing);
+}
+
+CHIP8_NOINLINE Chip8Emulator::Action Chip8Emulator::op_high([[maybe_unused]] const Instruction& instruction) {
+    set_resolution(true);
+    return increase_pc(Action::DoNothing);
+}
+
+void Chip8Emulator::set_resolution(bool high) noexcept {
+    // clearing keeps everything low resolution does not use blank
+    hires_mode = high;
+    pixel_rows = {};
+    dirty_rows = ~uint64_t{ 0 };
+}
+
+Chip8Emulator::Action Chip8Emulator::op_sys([[maybe_unused]] const Instruction& instruction) {
     // ignore this instruction
     return increase_pc(Action::DoNothing);
 }
 
-Chip8Emulator::Action Chip8Emulator::op_jp(uint16_t instruction) {
-    return change_pc(instruction & 0x0FFF);
+Chip8Emulator::Action Chip8Emulator::op_jp(const Instruction& instruction) {
+    return change_pc(instruction.nnn);
 }
 
-Chip8Emulator::Action Chip8Emulator::op_call(uint16_t instruction) {
+Chip8Emulator::Action Chip8Emulator::op_call(const Instruction& instruction) {
     if (stack.full())
         return Action::Crash;
     stack.push(program_counter);
-    return change_pc(instruction & 0x0FFF);
+    return change_pc(instruction.nnn);
 }
 
-Chip8Emulator::Action Chip8Emulator::op_se_byte(uint16_t instruction) {
-    const uint8_t val       = instruction & 0xFF;
-    const uint8_t reg_index = (instruction & 0x0F00) >> 8;
+Chip8Emulator::Action Chip8Emulator::op_se_byte(const Instruction& instruction) {
+    const uint8_t val       = instruction.kk;
+    const uint8_t reg_index = instruction.x;
     if (data_registers[reg_index] == val) {
         return change_pc(program_counter + 4);
     } else {
@@ -152,9 +562,9 @@ Chip8Emulator::Action Chip8Emulator::op_se_byte(uint16_t instruction) {
     }
 }
 
-Chip8Emulator::Action Chip8Emulator::op_sne(uint16_t instruction) {
-    const uint8_t val       = instruction & 0xFF;
-    const uint8_t reg_index = (instruction & 0x0F00) >> 8;
+Chip8Emulator::Action Chip8Emulator::op_sne(const Instruction& instruction) {
+    const uint8_t val       = instruction.kk;
+    const uint8_t reg_index = instruction.x;
     if (data_registers[reg_index] != val) {
         return change_pc(program_counter + 4);
     } else {
@@ -162,9 +572,9 @@ Chip8Emulator::Action Chip8Emulator::op_sne(uint16_t instruction) {
     }
 }
 
-Chip8Emulator::Action Chip8Emulator::op_se_reg(uint16_t instruction) {
-    const uint8_t reg1_index = (instruction & 0x0F00) >> 8;
-    const uint8_t reg2_index = (instruction & 0x00F0) >> 4;
+Chip8Emulator::Action Chip8Emulator::op_se_reg(const Instruction& instruction) {
+    const uint8_t reg1_index = instruction.x;
+    const uint8_t reg2_index = instruction.y;
     if (data_registers[reg1_index] == data_registers[reg2_index]) {
         return change_pc(program_counter + 4);
     } else {
@@ -172,45 +582,54 @@ Chip8Emulator::Action Chip8Emulator::op_se_reg(uint16_t instruction) {
     }
 }
 
-Chip8Emulator::Action Chip8Emulator::op_ld_byte(uint16_t instruction) {
-    const uint8_t reg_index   = (instruction & 0x0F00) >> 8;
-    const uint8_t val         = instruction & 0xFF;
+Chip8Emulator::Action Chip8Emulator::op_ld_byte(const Instruction& instruction) {
+    const uint8_t reg_index   = instruction.x;
+    const uint8_t val         = instruction.kk;
     data_registers[reg_index] = val;
     return increase_pc(Action::DoNothing);
 }
 
-Chip8Emulator::Action Chip8Emulator::op_add(uint16_t instruction) {
-    const uint8_t reg_index = (instruction & 0x0F00) >> 8;
-    const uint8_t val       = instruction & 0xFF;
+Chip8Emulator::Action Chip8Emulator::op_add(const Instruction& instruction) {
+    const uint8_t reg_index = instruction.x;
+    const uint8_t val       = instruction.kk;
     data_registers[reg_index] += val; // let the overflow happen - intended behaviour
     return increase_pc(Action::DoNothing);
 }
 
-Chip8Emulator::Action Chip8Emulator::op_ld_reg(uint16_t instruction) {
+Chip8Emulator::Action Chip8Emulator::op_ld_reg(const Instruction& instruction) {
     const auto [reg_x_idx, reg_y_idx] = get_regs_math_ops(instruction);
     data_registers[reg_x_idx]         = data_registers[reg_y_idx];
     return increase_pc(Action::DoNothing);
 }
 
-Chip8Emulator::Action Chip8Emulator::op_or(uint16_t instruction) {
+template <typename Policy>
+Chip8Emulator::Action Chip8Emulator::op_or(const Instruction& instruction) {
     const auto [reg_x_idx, reg_y_idx] = get_regs_math_ops(instruction);
     data_registers[reg_x_idx] |= data_registers[reg_y_idx];
+    if constexpr (Policy::quirks.logic_resets_vf)
+        data_registers[vf_index] = 0;
     return increase_pc(Action::DoNothing);
 }
 
-Chip8Emulator::Action Chip8Emulator::op_and(uint16_t instruction) {
+template <typename Policy>
+Chip8Emulator::Action Chip8Emulator::op_and(const Instruction& instruction) {
     const auto [reg_x_idx, reg_y_idx] = get_regs_math_ops(instruction);
     data_registers[reg_x_idx] &= data_registers[reg_y_idx];
+    if constexpr (Policy::quirks.logic_resets_vf)
+        data_registers[vf_index] = 0;
     return increase_pc(Action::DoNothing);
 }
 
-Chip8Emulator::Action Chip8Emulator::op_xor(uint16_t instruction) {
+template <typename Policy>
+Chip8Emulator::Action Chip8Emulator::op_xor(const Instruction& instruction) {
     const auto [reg_x_idx, reg_y_idx] = get_regs_math_ops(instruction);
     data_registers[reg_x_idx] ^= data_registers[reg_y_idx];
+    if constexpr (Policy::quirks.logic_resets_vf)
+        data_registers[vf_index] = 0;
     return increase_pc(Action::DoNothing);
 }
 
-Chip8Emulator::Action Chip8Emulator::op_add_reg(uint16_t instruction) {
+Chip8Emulator::Action Chip8Emulator::op_add_reg(const Instruction& instruction) {
     const auto [reg_x_idx, reg_y_idx] = get_regs_math_ops(instruction);
     const uint8_t old                 = data_registers[reg_x_idx];
     data_registers[reg_x_idx] += data_registers[reg_y_idx];
@@ -221,7 +640,7 @@ Chip8Emulator::Action Chip8Emulator::op_add_reg(uint16_t instruction) {
     return increase_pc(Action::DoNothing);
 }
 
-Chip8Emulator::Action Chip8Emulator::op_sub(uint16_t instruction) {
+Chip8Emulator::Action Chip8Emulator::op_sub(const Instruction& instruction) {
     const auto [reg_x_idx, reg_y_idx] = get_regs_math_ops(instruction);
     const uint8_t old                 = data_registers[reg_x_idx];
     data_registers[reg_x_idx] -= data_registers[reg_y_idx];
@@ -233,14 +652,22 @@ Chip8Emulator::Action Chip8Emulator::op_sub(uint16_t instruction) {
     return increase_pc(Action::DoNothing);
 }
 
-Chip8Emulator::Action Chip8Emulator::op_shr(uint16_t instruction) {
+template <typename Policy>
+Chip8Emulator::Action Chip8Emulator::op_shr(const Instruction& instruction) {
     const auto [reg_x_idx, reg_y_idx] = get_regs_math_ops(instruction);
-    data_registers[vf_index]          = data_registers[reg_x_idx] & 0x0001;
-    data_registers[reg_x_idx] >>= 1;
+    if constexpr (Policy::quirks.shift_reads_vy) {
+        // read Vy before the flag is written, it may be VF
+        const uint8_t source      = data_registers[reg_y_idx];
+        data_registers[vf_index]  = source & 0x0001;
+        data_registers[reg_x_idx] = source >> 1;
+    } else {
+        data_registers[vf_index] = data_registers[reg_x_idx] & 0x0001;
+        data_registers[reg_x_idx] >>= 1;
+    }
     return increase_pc(Action::DoNothing);
 }
 
-Chip8Emulator::Action Chip8Emulator::op_subn(uint16_t instruction) {
+Chip8Emulator::Action Chip8Emulator::op_subn(const Instruction& instruction) {
     const auto [reg_x_idx, reg_y_idx] = get_regs_math_ops(instruction);
     const uint8_t old                 = data_registers[reg_x_idx];
     data_registers[reg_x_idx]         = data_registers[reg_y_idx] - data_registers[reg_x_idx];
@@ -252,16 +679,23 @@ Chip8Emulator::Action Chip8Emulator::op_subn(uint16_t instruction) {
     return increase_pc(Action::DoNothing);
 }
 
-Chip8Emulator::Action Chip8Emulator::op_shl(uint16_t instruction) {
+template <typename Policy>
+Chip8Emulator::Action Chip8Emulator::op_shl(const Instruction& instruction) {
     const auto [reg_x_idx, reg_y_idx] = get_regs_math_ops(instruction);
-    data_registers[vf_index]          = data_registers[reg_x_idx] & 0b1000'0000;
-    data_registers[reg_x_idx] <<= 1;
+    if constexpr (Policy::quirks.shift_reads_vy) {
+        const uint8_t source      = data_registers[reg_y_idx];
+        data_registers[vf_index]  = source & 0b1000'0000;
+        data_registers[reg_x_idx] = static_cast<uint8_t>(source << 1);
+    } else {
+        data_registers[vf_index] = data_registers[reg_x_idx] & 0b1000'0000;
+        data_registers[reg_x_idx] <<= 1;
+    }
     return increase_pc(Action::DoNothing);
 }
 
-Chip8Emulator::Action Chip8Emulator::op_sne_reg(uint16_t instruction) {
-    const uint8_t reg1_index = (instruction & 0x0F00) >> 8;
-    const uint8_t reg2_index = (instruction & 0x00F0) >> 4;
+Chip8Emulator::Action Chip8Emulator::op_sne_reg(const Instruction& instruction) {
+    const uint8_t reg1_index = instruction.x;
+    const uint8_t reg2_index = instruction.y;
     if (data_registers[reg1_index] != data_registers[reg2_index]) {
         return change_pc(program_counter + 4);
     } else {
@@ -269,53 +703,114 @@ Chip8Emulator::Action Chip8Emulator::op_sne_reg(uint16_t instruction) {
     }
 }
 
-Chip8Emulator::Action Chip8Emulator::op_ld_addr(uint16_t instruction) {
-    index_register = instruction & 0x0FFF;
+Chip8Emulator::Action Chip8Emulator::op_ld_addr(const Instruction& instruction) {
+    index_register = instruction.nnn;
     return increase_pc(Action::DoNothing);
 }
 
-Chip8Emulator::Action Chip8Emulator::op_jp_offset(uint16_t instruction) {
-    return change_pc((instruction & 0x0FFF) + data_registers[0]);
+template <typename Policy>
+Chip8Emulator::Action Chip8Emulator::op_jp_offset(const Instruction& instruction) {
+    if constexpr (Policy::quirks.jump_reads_vx)
+        return change_pc((instruction.nnn) + data_registers[instruction.x]);
+    else
+        return change_pc((instruction.nnn) + data_registers[0]);
 }
 
-Chip8Emulator::Action Chip8Emulator::op_rnd(uint16_t instruction) {
-    const uint8_t vx_index   = (instruction & 0x0F00) >> 8;
-    const uint8_t val        = instruction & 0xFF;
+Chip8Emulator::Action Chip8Emulator::op_rnd(const Instruction& instruction) {
+    const uint8_t vx_index   = instruction.x;
+    const uint8_t val        = instruction.kk;
     data_registers[vx_index] = val & rng.next();
     return increase_pc(Action::DoNothing);
 }
 
-Chip8Emulator::Action Chip8Emulator::op_drw(uint16_t instruction) {
-    const uint8_t vx     = data_registers[(instruction & 0x0F00) >> 8];
-    const uint8_t vy     = data_registers[(instruction & 0x00F0) >> 4];
-    const uint8_t height = instruction & 0xF;
-
-    bool any_flip = false;
-    for (size_t i = 0; i < height; ++i) {
-        for (size_t j = 0; j < 8; ++j) {
-            if (index_register + i >= memory.size())
-                return Action::Crash;
-            const bool bit_set    = memory[index_register + i] & (1 << (7 - j));
-            const uint8_t x_coord = (vx + j) % 64;
-            const uint8_t y_coord = (vy + i) % 32;
-            bool& pixel           = pixel_memory[y_coord][x_coord];
-            if (pixel && bit_set)
-                any_flip = true;
-
-            if (bit_set)
-                pixel ^= bit_set;
-        }
+template <typename Policy>
+Chip8Emulator::Action Chip8Emulator::op_drw(const Instruction& instruction) {
+    const uint8_t vx     = data_registers[instruction.x];
+    const uint8_t vy     = data_registers[instruction.y];
+    const uint8_t height = instruction.n;
+    if (hires_mode)
+        return draw_hires<Policy>(vx, vy, height);
+
+    // a sprite that runs off the end of memory is drawn up to there and then crashes
+    const size_t rows_in_memory = index_register < memory.size() ? memory.size() - index_register : 0;
+    const size_t rows           = std::min<size_t>(height, rows_in_memory);
+
+    // Each sprite row is placed at the top of a word and rotated into position, which wraps it around the right edge,
+    // or shifted, which cuts it off there. Either way the sprite starts on the screen.
+    uint64_t collisions = 0;
+    constexpr bool clip = Policy::quirks.clip_sprites;
+    for (size_t i = 0; i < rows; ++i) {
+        const size_t y = clip ? vy % display_height + i : (vy + i) % display_height;
+        if (clip && y >= display_height)
+            break;
+        const uint64_t sprite_bits = uint64_t{ memory[index_register + i] } << 56;
+        const uint64_t sprite_row  = clip ? sprite_bits >> (vx % display_width) : rotate_right(sprite_bits, vx % display_width);
+        uint64_t& row              = pixel_rows[0][y];
+        collisions |= row & sprite_row;
+        row ^= sprite_row;
+        if (sprite_row != 0)
+            dirty_rows |= uint64_t{ 1 } << y;
     }
+    if (rows < height)
+        return Action::Crash;
 
-    if (any_flip) {
+    if (collisions != 0) {
         data_registers[vf_index] = 1;
     }
 
     return increase_pc(Action::ReDraw);
 }
 
-Chip8Emulator::Action Chip8Emulator::op_skp(uint16_t instruction) {
-    const uint8_t reg_idx   = (instruction & 0x0F00) >> 8;
+template <typename Policy>
+Chip8Emulator::Action Chip8Emulator::draw_hires(uint8_t vx, uint8_t vy, uint8_t height) {
+    // Dxy0 draws a 16x16 sprite, two bytes per row
+    const size_t row_bytes       = height == 0 ? 2 : 1;
+    const size_t sprite_rows     = height == 0 ? 16 : height;
+    const size_t bytes_in_memory = index_register < memory.size() ? memory.size() - index_register : 0;
+    const size_t rows            = std::min(sprite_rows, bytes_in_memory / row_bytes);
+
+    // A sprite row goes into the word it starts in, whatever sticks out of that word goes into the start of the
+    // other one, or off the screen when it sticks out of the right edge and clipping is on.
+    const size_t x      = vx % hires_width;
+    const size_t word   = x / 64;
+    const size_t shift  = x % 64;
+    uint64_t collisions = 0;
+    uint64_t drawn_rows = 0;
+    constexpr bool clip = Policy::quirks.clip_sprites;
+    for (size_t i = 0; i < rows; ++i) {
+        const size_t y = clip ? vy % hires_height + i : (vy + i) % hires_height;
+        if (clip && y >= hires_height)
+            break;
+        const uint8_t* sprite      = memory.data() + index_register + i * row_bytes;
+        const uint64_t sprite_bits = row_bytes == 2 ? uint64_t{ sprite[0] } << 56 | uint64_t{ sprite[1] } << 48
+                                                    : uint64_t{ sprite[0] } << 56;
+        const uint64_t overflow    = shift == 0 ? 0 : sprite_bits << (64 - shift);
+        uint64_t sprite_halves[2]  = {};
+        sprite_halves[word]        = sprite_bits >> shift;
+        if (word == 0)
+            sprite_halves[1] = overflow;
+        else if (!clip)
+            sprite_halves[0] = overflow;
+
+        for (size_t half = 0; half < 2; ++half) {
+            uint64_t& row = pixel_rows[half][y];
+            collisions |= row & sprite_halves[half];
+            row ^= sprite_halves[half];
+        }
+        if ((sprite_halves[0] | sprite_halves[1]) != 0)
+            drawn_rows |= uint64_t{ 1 } << y;
+    }
+    dirty_rows |= drawn_rows;
+    if (rows < sprite_rows)
+        return Action::Crash;
+
+    if (collisions != 0)
+        data_registers[vf_index] = 1;
+    return increase_pc(Action::ReDraw);
+}
+
+Chip8Emulator::Action Chip8Emulator::op_skp(const Instruction& instruction) {
+    const uint8_t reg_idx   = instruction.x;
     const uint8_t input_idx = data_registers[reg_idx];
     if (input_idx >= 16)
         return Action::Crash;
@@ -327,8 +822,8 @@ Chip8Emulator::Action Chip8Emulator::op_skp(uint16_t instruction) {
     }
 }
 
-Chip8Emulator::Action Chip8Emulator::op_sknp(uint16_t instruction) {
-    const uint8_t reg_idx   = (instruction & 0x0F00) >> 8;
+Chip8Emulator::Action Chip8Emulator::op_sknp(const Instruction& instruction) {
+    const uint8_t reg_idx   = instruction.x;
     const uint8_t input_idx = data_registers[reg_idx];
     if (input_idx >= 16)
         return Action::Crash;
@@ -340,37 +835,37 @@ Chip8Emulator::Action Chip8Emulator::op_sknp(uint16_t instruction) {
     }
 }
 
-Chip8Emulator::Action Chip8Emulator::op_ld_dt(uint16_t instruction) {
-    const uint8_t idx   = (instruction & 0x0F00) >> 8;
+Chip8Emulator::Action Chip8Emulator::op_ld_dt(const Instruction& instruction) {
+    const uint8_t idx   = instruction.x;
     data_registers[idx] = delay_timer;
     return increase_pc(Action::DoNothing);
 }
 
-Chip8Emulator::Action Chip8Emulator::op_ld_wait_key(uint16_t instruction) {
-    wait_for_key_reg_idx = (instruction & 0x0F00) >> 8;
+Chip8Emulator::Action Chip8Emulator::op_ld_wait_key(const Instruction& instruction) {
+    wait_for_key_reg_idx = instruction.x;
     return increase_pc(Action::WaitForInput);
 }
 
-Chip8Emulator::Action Chip8Emulator::op_ld_set_dt(uint16_t instruction) {
-    const uint8_t idx = (instruction & 0x0F00) >> 8;
+Chip8Emulator::Action Chip8Emulator::op_ld_set_dt(const Instruction& instruction) {
+    const uint8_t idx = instruction.x;
     delay_timer       = data_registers[idx];
     return increase_pc(Action::DoNothing);
 }
 
-Chip8Emulator::Action Chip8Emulator::op_ld_st(uint16_t instruction) {
-    const uint8_t idx = (instruction & 0x0F00) >> 8;
+Chip8Emulator::Action Chip8Emulator::op_ld_st(const Instruction& instruction) {
+    const uint8_t idx = instruction.x;
     sound_timer       = data_registers[idx];
     return increase_pc(Action::DoNothing);
 }
 
-Chip8Emulator::Action Chip8Emulator::op_add_idx_reg(uint16_t instruction) {
-    const uint8_t idx = (instruction & 0x0F00) >> 8;
+Chip8Emulator::Action Chip8Emulator::op_add_idx_reg(const Instruction& instruction) {
+    const uint8_t idx = instruction.x;
     index_register += data_registers[idx];
     return increase_pc(Action::DoNothing);
 }
 
-Chip8Emulator::Action Chip8Emulator::op_ld_font(uint16_t instruction) {
-    const uint8_t reg_index  = (instruction & 0x0F00) >> 8;
+Chip8Emulator::Action Chip8Emulator::op_ld_font(const Instruction& instruction) {
+    const uint8_t reg_index  = instruction.x;
     const uint8_t val_to_get = data_registers[reg_index];
     if (val_to_get >= 16)
         return Action::Crash;
@@ -380,8 +875,18 @@ Chip8Emulator::Action Chip8Emulator::op_ld_font(uint16_t instruction) {
     return increase_pc(Action::DoNothing);
 }
 
-Chip8Emulator::Action Chip8Emulator::op_ld_bcd(uint16_t instruction) {
-    const uint8_t reg_index = (instruction & 0x0F00) >> 8;
+CHIP8_NOINLINE Chip8Emulator::Action Chip8Emulator::op_ld_hires_font(const Instruction& instruction) {
+    const uint8_t val_to_get = data_registers[instruction.x];
+    if (val_to_get >= 16)
+        return Action::Crash;
+
+    // each of these is 10 bytes, they are loaded in right after the small ones
+    index_register = static_cast<uint16_t>(hires_font_address + val_to_get * 10);
+    return increase_pc(Action::DoNothing);
+}
+
+Chip8Emulator::Action Chip8Emulator::op_ld_bcd(const Instruction& instruction) {
+    const uint8_t reg_index = instruction.x;
     const uint8_t val       = data_registers[reg_index];
 
     const uint8_t hundreds_digit = val / 100;
@@ -394,26 +899,44 @@ Chip8Emulator::Action Chip8Emulator::op_ld_bcd(uint16_t instruction) {
     memory[index_register]     = hundreds_digit;
     memory[index_register + 1] = tens_digit;
     memory[index_register + 2] = single_digit;
+    memory_written(index_register, 3);
 
     return increase_pc(Action::DoNothing);
 }
 
-Chip8Emulator::Action Chip8Emulator::op_ld_reg_dump(uint16_t instruction) {
-    const uint8_t reg_index = (instruction & 0x0F00) >> 8;
+template <typename Policy>
+Chip8Emulator::Action Chip8Emulator::op_ld_reg_dump(const Instruction& instruction) {
+    const uint8_t reg_index = instruction.x;
     if (size_t(index_register + reg_index) >= memory.size())
         return Action::Crash;
     for (size_t i = 0; i <= reg_index; ++i) {
         memory[index_register + i] = data_registers[i];
     }
+    memory_written(index_register, reg_index + 1u);
+    advance_index<Policy>(reg_index);
     return increase_pc(Action::DoNothing);
 }
 
-Chip8Emulator::Action Chip8Emulator::op_ld_reg_store(uint16_t instruction) {
-    const uint8_t reg_index = (instruction & 0x0F00) >> 8;
+template <typename Policy>
+Chip8Emulator::Action Chip8Emulator::op_ld_reg_store(const Instruction& instruction) {
+    const uint8_t reg_index = instruction.x;
     if (size_t(index_register + reg_index) >= memory.size())
         return Action::Crash;
     for (size_t i = 0; i <= reg_index; ++i) {
         data_registers[i] = memory[index_register + i];
     }
+    advance_index<Policy>(reg_index);
+    return increase_pc(Action::DoNothing);
+}
+
+CHIP8_NOINLINE Chip8Emulator::Action Chip8Emulator::op_ld_flags_dump(const Instruction& instruction) {
+    const uint8_t reg_index = instruction.x;
+    std::copy(data_registers.begin(), data_registers.begin() + reg_index + 1, user_flags.begin());
+    return increase_pc(Action::DoNothing);
+}
+
+CHIP8_NOINLINE Chip8Emulator::Action Chip8Emulator::op_ld_flags_store(const Instruction& instruction) {
+    const uint8_t reg_index = instruction.x;
+    std::copy(user_flags.begin(), user_flags.begin() + reg_index + 1, data_registers.begin());
     return increase_pc(Action::DoNothing);
 }
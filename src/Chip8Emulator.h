@@ -2,8 +2,18 @@
 
 #include <algorithm>
 #include <array>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <utility>
 
+#include "BlockCache.h"
+#include "Instruction.h"
+#include "Jit.h"
+#include "Quirks.h"
 #include "RandomNumberGenerator.h"
+#include "Snapshot.h"
 #include "StaticStack.h"
 
 constexpr uint16_t load_address                  = 0x200;
@@ -26,41 +36,168 @@ constexpr std::array<uint8_t, 80> dec_pixel_data = {
     0xF0, 0x80, 0xF0, 0x80, 0x80  //F
 };
 
+// the SUPER-CHIP's 8x10 digits for Fx30, loaded right after the small ones
+constexpr uint16_t hires_font_address               = static_cast<uint16_t>(dec_pixel_data.size());
+constexpr std::array<uint8_t, 160> hires_pixel_data = {
+    0xFF, 0xFF, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, //0
+    0x18, 0x78, 0x78, 0x18, 0x18, 0x18, 0x18, 0x18, 0xFF, 0xFF, //1
+    0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, //2
+    0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, //3
+    0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0x03, 0x03, //4
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, //5
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, //6
+    0xFF, 0xFF, 0x03, 0x03, 0x06, 0x0C, 0x18, 0x18, 0x18, 0x18, //7
+    0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, //8
+    0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, //9
+    0x7E, 0xFF, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3, //A
+    0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, //B
+    0x3C, 0xFF, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0xFF, 0x3C, //C
+    0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC, //D
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, //E
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xC0, 0xC0  //F
+};
+static_assert(hires_font_address + hires_pixel_data.size() <= load_address, "both fonts go below the program");
+
 class Chip8Emulator {
 public:
-    static constexpr int clock_speed_hz = 540;
+    static constexpr int clock_speed_hz      = 540; // the default, see set_clock_speed()
+    static constexpr size_t display_width    = 64;
+    static constexpr size_t display_height   = 32;
+    static constexpr size_t hires_width      = 128; // the SUPER-CHIP's high resolution mode, see 00FF
+    static constexpr size_t hires_height     = 64;
+    static constexpr size_t max_program_size = 4096 - load_address; // everything from the load address on
+
+    // The display is one word per row in each of two halves, the left 64 pixels of a row in the first and the right 64
+    // in the second, with the leftmost pixel as the most significant bit. Low resolution only uses the first 32 words
+    // of the first half, so its rows are just as close together as they were before there was a second half.
+    using DisplayHalf = std::array<uint64_t, hires_height>;
+    using DisplayRows = std::array<DisplayHalf, 2>;
+    static constexpr bool pixel_set(const DisplayRows& rows, size_t x, size_t y) noexcept {
+        return (rows[x / 64][y] >> (63 - x % 64)) & 1;
+    }
 
+    // seed is all that Cxkk depends on, the same rom and seed always run the same way
     template <typename InputIt>
-    Chip8Emulator(InputIt start, InputIt end)
-        : program_counter(load_address) {
-        if (std::distance(start, end) > static_cast<int64_t>(memory.size())) {
+    Chip8Emulator(InputIt start, InputIt end, uint64_t seed)
+        : program_counter(load_address),
+          rng(seed) {
+        if (std::distance(start, end) > static_cast<int64_t>(max_program_size)) {
             throw std::runtime_error("Not enough memory to load program");
         }
 
         // copy number fonts into memory at address 0 and then the actual program at the load address
         std::copy(dec_pixel_data.begin(), dec_pixel_data.end(), memory.data());
+        std::copy(hires_pixel_data.begin(), hires_pixel_data.end(), memory.data() + hires_font_address);
         std::copy(start, end, memory.data() + load_address);
     }
 
+    // Continues exactly where the machine the snapshot was taken from left off, see restore()
+    explicit Chip8Emulator(const Snapshot& snapshot)
+        : rng(0) {
+        restore(snapshot);
+    }
+
     enum class Action {
         DoNothing,
         ReDraw,
         WaitForInput,
-        Crash
+        Crash,
+        SoundChanged // only returned by run_cycles()
     };
     [[nodiscard]] Action process_next_instruction();
 
+    // Runs up to max_instructions instructions one at a time in a single loop, with the timers ticking on schedule.
+    // The state afterwards is the same as calling process_next_instruction() once per instruction executed. Returns
+    // early with the action of the first instruction that returns something other than DoNothing, or with
+    // SoundChanged right after the sound timer starts or stops.
+    [[nodiscard]] Action run_cycles(uint64_t max_instructions);
+
+    // run_cycles() that tells instrumentation about every instruction it executes, see Instrumentation.h for the
+    // policies. Instantiated for ExecutionProfile and TraceRecorder, plain run_cycles() is this with NoInstrumentation.
+    template <typename Instrumentation>
+    [[nodiscard]] Action run_cycles(uint64_t max_instructions, Instrumentation& instrumentation);
+
+    // Runs cached basic blocks, starting at the program counter, until an instruction returns something other than
+    // DoNothing or max_instructions have been executed. The state afterwards is the same as calling
+    // process_next_instruction() once per instruction executed, and the action of the last one is returned.
+    [[nodiscard]] Action run_blocks(uint64_t max_instructions);
+
+    // Same contract as run_blocks(), but runs blocks translated to native code by JitCompiler. Falls back to
+    // run_blocks() where the compiler is not supported or has given up on the rom.
+    [[nodiscard]] Action run_compiled(uint64_t max_instructions);
+
     std::array<bool, 16>& input_buttons() noexcept { return input_state; }
-    const std::array<std::array<bool, 64>, 32>& video_memory() const noexcept { return pixel_memory; }
+    const DisplayRows& display_rows() const noexcept { return pixel_rows; }
+    // whether 00FF switched to the 128x64 display, and the size of the display in the current mode
+    bool hires() const noexcept { return hires_mode; }
+    size_t screen_width() const noexcept { return hires_mode ? hires_width : display_width; }
+    size_t screen_height() const noexcept { return hires_mode ? hires_height : display_height; }
+    // Bit y is set for every display row that was drawn to, scrolled or cleared since the last call. Renderers use
+    // this to upload only what changed and to skip presenting frames where nothing did.
+    [[nodiscard]] uint64_t take_dirty_rows() noexcept { return std::exchange(dirty_rows, 0); }
     void key_pressed_upon_wait(uint8_t key) noexcept;
 
+    // Sets the number of instructions per second of emulated time, rounded down to a whole number per 60Hz frame. The
+    // timers tick once per frame at any clock speed. Throws std::invalid_argument for less than one instruction per frame.
+    void set_clock_speed(uint32_t hz);
+    // instructions per 60Hz frame, the timers tick whenever the cycle count reaches a multiple of this
+    uint64_t cycles_per_frame() const noexcept { return frame_length; }
+
+    // Chooses how the instructions the original interpreters disagree on behave, see Quirks.h. Every engine picks the
+    // handlers instantiated for the profile once per call, the handlers themselves never check it.
+    void set_quirk_profile(QuirkProfile new_profile) noexcept;
+    QuirkProfile quirk_profile() const noexcept { return profile; }
+
     [[nodiscard]] bool should_play_sound() const noexcept {
         return sound_timer != 0;
     }
 
+    // read only views of the machine state, used by the headless tools to report on a run
+    const std::array<uint8_t, 16>& registers() const noexcept { return data_registers; }
+    uint16_t index() const noexcept { return index_register; }
+    uint16_t pc() const noexcept { return program_counter; }
+    uint8_t delay_timer_value() const noexcept { return delay_timer; }
+    uint8_t sound_timer_value() const noexcept { return sound_timer; }
+    uint64_t cycles() const noexcept { return cycle_count; }
+    uint8_t stack_depth() const noexcept { return stack.depth(); }
+    const std::array<uint8_t, 4096>& memory_contents() const noexcept { return memory; }
+
+    // The registers, timers and cycle count. Engines that run many machines at once keep these outside of
+    // Chip8Emulator while they can and move them back in for instructions they leave to the handlers.
+    struct CpuState {
+        std::array<uint8_t, 16> registers;
+        uint16_t index;
+        uint16_t pc;
+        uint8_t delay_timer;
+        uint8_t sound_timer;
+        uint64_t cycles;
+    };
+    CpuState cpu_state() const noexcept {
+        return { data_registers, index_register, program_counter, delay_timer, sound_timer, cycle_count };
+    }
+    void set_cpu_state(const CpuState& state) noexcept {
+        data_registers  = state.registers;
+        index_register  = state.index;
+        program_counter = state.pc;
+        delay_timer     = state.delay_timer;
+        sound_timer     = state.sound_timer;
+        cycle_count     = state.cycles;
+    }
+
+    // Copies the whole machine state, including the random number generator, into a snapshot and back. Cached and
+    // compiled code is kept on restore unless the snapshot's memory differs where it was built from. Throws
+    // std::runtime_error for a snapshot with an invalid stack, register or program counter.
+    [[nodiscard]] Snapshot snapshot() const noexcept;
+    void restore(const Snapshot& snapshot);
+
+    // restarts the random numbers from seed, e.g. so that instances forked from one snapshot diverge
+    void reseed_random(uint64_t seed) noexcept { rng.reseed(seed); }
+
 private:
     std::array<uint8_t, 4096> memory{};
-    std::array<std::array<bool, 64>, 32> pixel_memory{};
+    DisplayRows pixel_rows{};
+    uint64_t dirty_rows = 0;
+    bool hires_mode     = false;
     StaticStack stack{};
     std::array<uint8_t, 16> data_registers{};
     uint16_t index_register{};
@@ -70,49 +207,116 @@ private:
     uint8_t delay_timer{};
     uint8_t sound_timer{};
     uint8_t wait_for_key_reg_idx = 0; // When the opcode to wait for a keypress is used we use this to "remember" which reg to put it in
+    std::array<uint8_t, 16> user_flags{}; // the HP48's RPL flags, written by Fx75 and read back by Fx85
 
-    uint64_t cycle_count = 0;
+    uint64_t cycle_count  = 0;
+    uint64_t frame_length = clock_speed_hz / 60;
+    QuirkProfile profile  = QuirkProfile::Default;
     RandomNumberGenerator rng;
+    BlockCache block_cache;
+    std::unique_ptr<JitCompiler> jit; // only created once run_compiled() is used
 
     // using these to increase the pc and return allows us to crash on the instruction that
     // causes the program_counter to go out of bounds opposed to waiting until the next cycle
     Action increase_pc(Action action);
     Action change_pc(uint16_t new_pc);
 
-    // instruction handlers
-    Action op_cls(uint16_t instruction);
-    Action op_ret(uint16_t instruction);
-    Action op_sys(uint16_t instruction);
-    Action op_jp(uint16_t instruction);
-    Action op_call(uint16_t instruction);
-    Action op_se_byte(uint16_t instruction);
-    Action op_sne(uint16_t instruction);
-    Action op_se_reg(uint16_t instruction);
-    Action op_ld_byte(uint16_t instruction);
-    Action op_add(uint16_t instruction);
-    Action op_ld_reg(uint16_t instruction);
-    Action op_or(uint16_t instruction);
-    Action op_and(uint16_t instruction);
-    Action op_xor(uint16_t instruction);
-    Action op_add_reg(uint16_t instruction);
-    Action op_sub(uint16_t instruction);
-    Action op_shr(uint16_t instruction);
-    Action op_subn(uint16_t instruction);
-    Action op_shl(uint16_t instruction);
-    Action op_sne_reg(uint16_t instruction);
-    Action op_ld_addr(uint16_t instruction);
-    Action op_jp_offset(uint16_t instruction);
-    Action op_rnd(uint16_t instruction);
-    Action op_drw(uint16_t instruction);
-    Action op_skp(uint16_t instruction);
-    Action op_sknp(uint16_t instruction);
-    Action op_ld_dt(uint16_t instruction);
-    Action op_ld_wait_key(uint16_t instruction);
-    Action op_ld_set_dt(uint16_t instruction);
-    Action op_ld_st(uint16_t instruction);
-    Action op_add_idx_reg(uint16_t instruction);
-    Action op_ld_font(uint16_t instruction);
-    Action op_ld_bcd(uint16_t instruction);
-    Action op_ld_reg_dump(uint16_t instruction);
-    Action op_ld_reg_store(uint16_t instruction);
+    // the once per frame decrement of both timers
+    void tick_timers() noexcept;
+
+    // counts cycles that have already been executed and applies any timer decrements that happened during them
+    void advance_cycles(uint64_t count) noexcept;
+
+    // If the pc is at the start of an idle loop (see IdleLoop.h), skips as many whole passes of it as stepping would
+    // run before the loop ends, the sound timer runs out or max_instructions are used up, leaving the machine exactly
+    // as stepping would. Returns the number of instructions skipped.
+    uint64_t skip_idle_loop(uint64_t max_instructions) noexcept;
+
+    // lets the block cache and compiled code know that memory has been written to
+    void memory_written(uint16_t address, size_t length) noexcept;
+
+    // clears the whole display and switches to the other resolution, for 00FE and 00FF
+    void set_resolution(bool high) noexcept;
+
+    // Dxyn and Dxy0 on the 128x64 display, where a row may straddle both words
+    template <typename Policy>
+    Action draw_hires(uint8_t vx, uint8_t vy, uint8_t height);
+
+    // what Fx55 and Fx65 leave in I once they have gone up to last_register
+    template <typename Policy>
+    void advance_index(uint8_t last_register) noexcept;
+
+    // process_next_instruction(), run_cycles(), run_blocks() and run_compiled() with the handlers of one quirk profile
+    template <typename Policy>
+    Action step();
+    template <typename Policy, typename Instrumentation>
+    Action run_cycles_with(uint64_t max_instructions, Instrumentation& instrumentation);
+    template <typename Policy>
+    Action run_blocks_with(uint64_t max_instructions);
+    template <typename Policy>
+    Action run_compiled_with(uint64_t max_instructions);
+
+    // JitFallback for compiled code, runs one instruction through execute()
+    template <typename Policy>
+    static uint32_t jit_fallback(JitFrame* frame, uint32_t opcode, uint32_t address, uint32_t position) noexcept;
+
+    // runs the handler for an already decoded instruction
+    template <typename Policy>
+    Action execute(const Instruction& instruction);
+
+    // instruction handlers, one per Op, those that differ between quirk profiles are instantiated with the profile's
+    // QuirkPolicy
+    Action op_invalid(const Instruction& instruction);
+    Action op_cls(const Instruction& instruction);
+    Action op_ret(const Instruction& instruction);
+    Action op_scroll_down(const Instruction& instruction);
+    Action op_scroll_right(const Instruction& instruction);
+    Action op_scroll_left(const Instruction& instruction);
+    Action op_low(const Instruction& instruction);
+    Action op_high(const Instruction& instruction);
+    Action op_sys(const Instruction& instruction);
+    Action op_jp(const Instruction& instruction);
+    Action op_call(const Instruction& instruction);
+    Action op_se_byte(const Instruction& instruction);
+    Action op_sne(const Instruction& instruction);
+    Action op_se_reg(const Instruction& instruction);
+    Action op_ld_byte(const Instruction& instruction);
+    Action op_add(const Instruction& instruction);
+    Action op_ld_reg(const Instruction& instruction);
+    template <typename Policy>
+    Action op_or(const Instruction& instruction);
+    template <typename Policy>
+    Action op_and(const Instruction& instruction);
+    template <typename Policy>
+    Action op_xor(const Instruction& instruction);
+    Action op_add_reg(const Instruction& instruction);
+    Action op_sub(const Instruction& instruction);
+    template <typename Policy>
+    Action op_shr(const Instruction& instruction);
+    Action op_subn(const Instruction& instruction);
+    template <typename Policy>
+    Action op_shl(const Instruction& instruction);
+    Action op_sne_reg(const Instruction& instruction);
+    Action op_ld_addr(const Instruction& instruction);
+    template <typename Policy>
+    Action op_jp_offset(const Instruction& instruction);
+    Action op_rnd(const Instruction& instruction);
+    template <typename Policy>
+    Action op_drw(const Instruction& instruction);
+    Action op_skp(const Instruction& instruction);
+    Action op_sknp(const Instruction& instruction);
+    Action op_ld_dt(const Instruction& instruction);
+    Action op_ld_wait_key(const Instruction& instruction);
+    Action op_ld_set_dt(const Instruction& instruction);
+    Action op_ld_st(const Instruction& instruction);
+    Action op_add_idx_reg(const Instruction& instruction);
+    Action op_ld_font(const Instruction& instruction);
+    Action op_ld_hires_font(const Instruction& instruction);
+    Action op_ld_bcd(const Instruction& instruction);
+    template <typename Policy>
+    Action op_ld_reg_dump(const Instruction& instruction);
+    template <typename Policy>
+    Action op_ld_reg_store(const Instruction& instruction);
+    Action op_ld_flags_dump(const Instruction& instruction);
+    Action op_ld_flags_store(const Instruction& instruction);
 };
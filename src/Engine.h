@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string_view>
+
+#include "Chip8Emulator.h"
+
+// The ways Chip8Emulator can execute a rom, selected with --engine by the headless tools
+enum class Engine {
+    Interpreter, // run_cycles(), one instruction at a time
+    Blocks,      // run_blocks()
+    Jit          // run_compiled()
+};
+
+inline std::optional<Engine> parse_engine(std::string_view name) {
+    if (name == "interpreter")
+        return Engine::Interpreter;
+    if (name == "blocks")
+        return Engine::Blocks;
+    if (name == "jit")
+        return Engine::Jit;
+    return std::nullopt;
+}
+
+// runs at most budget instructions with the chosen engine
+inline Chip8Emulator::Action run_engine(Chip8Emulator& emulator, Engine engine, uint64_t budget) {
+    switch (engine) {
+    case Engine::Blocks: return emulator.run_blocks(budget);
+    case Engine::Jit: return emulator.run_compiled(budget);
+    case Engine::Interpreter: break;
+    }
+    return emulator.run_cycles(budget);
+}
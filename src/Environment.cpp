@@ -0,0 +1,269 @@
+#include "Environment.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+
+namespace
+{
+
+constexpr size_t small_row_bytes = Chip8Emulator::display_width / 8;
+constexpr size_t large_row_bytes = Chip8Emulator::hires_width / 8;
+
+void store_big_endian(uint64_t word, uint8_t* bytes) noexcept {
+    for (size_t i = 0; i < 8; ++i)
+        bytes[i] = static_cast<uint8_t>(word >> (56 - 8 * i));
+}
+
+// 64 pixels to the 32 they halve to, each set if either of its pair is
+uint64_t halve_pixels(uint64_t word) noexcept {
+    word = (word | word >> 1) & 0x5555555555555555;
+    word = (word | word >> 1) & 0x3333333333333333;
+    word = (word | word >> 2) & 0x0F0F0F0F0F0F0F0F;
+    word = (word | word >> 4) & 0x00FF00FF00FF00FF;
+    word = (word | word >> 8) & 0x0000FFFF0000FFFF;
+    return (word | word >> 16) & 0x00000000FFFFFFFF;
+}
+
+// the low 32 pixels of word to the 64 they double to
+uint64_t double_pixels(uint64_t word) noexcept {
+    word &= 0x00000000FFFFFFFF;
+    word = (word | word << 16) & 0x0000FFFF0000FFFF;
+    word = (word | word << 8) & 0x00FF00FF00FF00FF;
+    word = (word | word << 4) & 0x0F0F0F0F0F0F0F0F;
+    word = (word | word << 2) & 0x3333333333333333;
+    word = (word | word << 1) & 0x5555555555555555;
+    return word | word << 1;
+}
+
+uint8_t lowest_key(uint16_t keys) noexcept {
+    uint8_t key = 0;
+    while ((keys >> key & 1) == 0)
+        ++key;
+    return key;
+}
+
+} // namespace
+
+VectorEnvironment::VectorEnvironment(const uint8_t* rom, size_t rom_size, size_t instances, const EnvironmentSettings& environment_settings)
+    : settings(environment_settings),
+      waiting(instances),
+      crashed(instances) {
+    if (instances == 0)
+        throw std::invalid_argument("An environment needs at least one instance");
+
+    // every instance starts out as, and is reset to, a copy of this one
+    power_on = Chip8Emulator(rom, rom + rom_size, 0).snapshot();
+    emulators.reserve(instances);
+    for (size_t i = 0; i < instances; ++i) {
+        Chip8Emulator& emulator = emulators.emplace_back(power_on);
+        emulator.set_quirk_profile(settings.quirks);
+        emulator.set_clock_speed(settings.clock_hz);
+    }
+
+    const unsigned hardware_threads = std::max(1u, std::thread::hardware_concurrency());
+    const size_t slices             = std::min<size_t>(settings.threads != 0 ? settings.threads : hardware_threads, instances);
+    errors.resize(slices);
+    workers.reserve(slices - 1);
+    try {
+        for (size_t slice = 1; slice < slices; ++slice)
+            workers.emplace_back(&VectorEnvironment::work, this, slice);
+    } catch (...) {
+        stop_workers();
+        throw;
+    }
+}
+
+VectorEnvironment::~VectorEnvironment() {
+    stop_workers();
+}
+
+void VectorEnvironment::stop_workers() noexcept {
+    {
+        const std::lock_guard lock(mutex);
+        stopping = true;
+    }
+    job_ready.notify_all();
+    for (std::thread& worker : workers)
+        worker.join();
+}
+
+size_t VectorEnvironment::observation_size() const noexcept {
+    return settings.hires ? Chip8Emulator::hires_height * large_row_bytes : Chip8Emulator::display_height * small_row_bytes;
+}
+
+void VectorEnvironment::add_reward(uint16_t address, RewardKind kind, float scale) {
+    if (address >= power_on.memory.size())
+        throw std::invalid_argument("Reward address is outside of memory");
+    hooks.push_back({ address, kind, scale });
+
+    // deltas start from what the instances hold now
+    std::vector<uint8_t> values(emulators.size() * hooks.size());
+    for (size_t i = 0; i < emulators.size(); ++i) {
+        for (size_t h = 0; h < hooks.size(); ++h)
+            values[i * hooks.size() + h] = emulators[i].memory_contents()[hooks[h].address];
+    }
+    last_values = std::move(values);
+}
+
+void VectorEnvironment::reset(const uint64_t* seeds, uint8_t* observations) {
+    if (!seeds)
+        throw std::invalid_argument("No seeds to reset with");
+    Job next;
+    next.seeds        = seeds;
+    next.observations = observations;
+    run_job(next);
+}
+
+void VectorEnvironment::reset(size_t instance, uint64_t seed, uint8_t* observation) {
+    reset_instance(instance, seed, observation);
+}
+
+void VectorEnvironment::step(const uint16_t* actions, uint8_t* observations, float* rewards, uint8_t* done) {
+    if (!actions)
+        throw std::invalid_argument("No actions to step with");
+    Job next;
+    next.actions      = actions;
+    next.observations = observations;
+    next.rewards      = rewards;
+    next.done         = done;
+    run_job(next);
+}
+
+void VectorEnvironment::work(size_t slice) {
+    uint64_t last_job = 0;
+    while (true) {
+        {
+            std::unique_lock lock(mutex);
+            job_ready.wait(lock, [&] { return stopping || job_number != last_job; });
+            if (stopping)
+                return;
+            last_job = job_number;
+        }
+        run_slice(slice);
+        {
+            const std::lock_guard lock(mutex);
+            if (--busy_workers == 0)
+                job_finished.notify_one();
+        }
+    }
+}
+
+void VectorEnvironment::run_job(const Job& next) {
+    {
+        const std::lock_guard lock(mutex);
+        job          = next;
+        busy_workers = workers.size();
+        ++job_number;
+    }
+    job_ready.notify_all();
+    run_slice(0);
+    {
+        std::unique_lock lock(mutex);
+        job_finished.wait(lock, [&] { return busy_workers == 0; });
+    }
+
+    for (std::exception_ptr& error : errors) {
+        if (error)
+            std::rethrow_exception(std::exchange(error, nullptr));
+    }
+}
+
+void VectorEnvironment::run_slice(size_t slice) noexcept {
+    const size_t begin = emulators.size() * slice / errors.size();
+    const size_t end   = emulators.size() * (slice + 1) / errors.size();
+    const size_t bytes = observation_size();
+    try {
+        for (size_t i = begin; i < end; ++i) {
+            uint8_t* observation = job.observations ? job.observations + i * bytes : nullptr;
+            if (job.seeds)
+                reset_instance(i, job.seeds[i], observation);
+            else
+                step_instance(i, job.actions[i], observation, job.rewards ? job.rewards + i : nullptr, job.done ? job.done + i : nullptr);
+        }
+    } catch (...) {
+        // the rest of this slice is left as it was, run_job() rethrows once every slice is done
+        errors[slice] = std::current_exception();
+    }
+}
+
+void VectorEnvironment::reset_instance(size_t i, uint64_t seed, uint8_t* observation) {
+    Chip8Emulator& emulator = emulators[i];
+    emulator.restore(power_on);
+    emulator.reseed_random(seed);
+    waiting[i] = 0;
+    crashed[i] = 0;
+    for (size_t h = 0; h < hooks.size(); ++h)
+        last_values[i * hooks.size() + h] = emulator.memory_contents()[hooks[h].address];
+    if (observation)
+        write_observation(emulator, observation);
+}
+
+void VectorEnvironment::step_instance(size_t i, uint16_t action, uint8_t* observation, float* reward, uint8_t* done) {
+    Chip8Emulator& emulator = emulators[i];
+    for (size_t key = 0; key < 16; ++key)
+        emulator.input_buttons()[key] = (action >> key & 1) != 0;
+
+    // an instance that waits for a key stays at the start of its frame until it gets one
+    if (waiting[i] && action != 0) {
+        emulator.key_pressed_upon_wait(lowest_key(action));
+        waiting[i] = 0;
+    }
+    const uint64_t frame_length = emulator.cycles_per_frame();
+    const uint64_t frame_end    = (emulator.cycles() / frame_length + 1) * frame_length;
+    while (!waiting[i] && !crashed[i] && emulator.cycles() < frame_end) {
+        const Chip8Emulator::Action result = run_engine(emulator, settings.engine, frame_end - emulator.cycles());
+        if (result == Chip8Emulator::Action::Crash) {
+            crashed[i] = 1;
+        } else if (result == Chip8Emulator::Action::WaitForInput) {
+            if (action != 0)
+                emulator.key_pressed_upon_wait(lowest_key(action));
+            else
+                waiting[i] = 1;
+        }
+    }
+
+    float total = 0.0f;
+    for (size_t h = 0; h < hooks.size(); ++h) {
+        const RewardHook& hook = hooks[h];
+        const uint8_t value    = emulator.memory_contents()[hook.address];
+        uint8_t& last_value    = last_values[i * hooks.size() + h];
+        if (hook.kind == RewardKind::Value)
+            total += hook.scale * static_cast<float>(value);
+        else
+            total += hook.scale * (static_cast<float>(value) - static_cast<float>(last_value));
+        last_value = value;
+    }
+    if (reward)
+        *reward = total;
+    if (done)
+        *done = crashed[i];
+    if (observation)
+        write_observation(emulator, observation);
+}
+
+void VectorEnvironment::write_observation(const Chip8Emulator& emulator, uint8_t* observation) const noexcept {
+    const Chip8Emulator::DisplayRows& rows = emulator.display_rows();
+    if (!settings.hires) {
+        for (size_t y = 0; y < Chip8Emulator::display_height; ++y) {
+            uint64_t row = rows[0][y];
+            if (emulator.hires()) {
+                const uint64_t left  = rows[0][2 * y] | rows[0][2 * y + 1];
+                const uint64_t right = rows[1][2 * y] | rows[1][2 * y + 1];
+                row                  = halve_pixels(left) << 32 | halve_pixels(right);
+            }
+            store_big_endian(row, observation + y * small_row_bytes);
+        }
+        return;
+    }
+    for (size_t y = 0; y < Chip8Emulator::hires_height; ++y) {
+        uint64_t left  = rows[0][y];
+        uint64_t right = rows[1][y];
+        if (!emulator.hires()) {
+            left  = double_pixels(rows[0][y / 2] >> 32);
+            right = double_pixels(rows[0][y / 2]);
+        }
+        store_big_endian(left, observation + y * large_row_bytes);
+        store_big_endian(right, observation + y * large_row_bytes + 8);
+    }
+}
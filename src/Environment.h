@@ -0,0 +1,119 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Chip8Emulator.h"
+#include "Engine.h"
+#include "Quirks.h"
+#include "Snapshot.h"
+
+struct EnvironmentSettings {
+    Engine engine       = Engine::Blocks;
+    QuirkProfile quirks = QuirkProfile::Default;
+    uint32_t clock_hz   = Chip8Emulator::clock_speed_hz;
+    unsigned threads    = 0;     // 0 for one per hardware thread, never more than there are instances
+    bool hires          = false; // 128x64 observations instead of 64x32
+};
+
+// What a reward hook adds to the reward of an instance after every step
+enum class RewardKind : uint8_t {
+    Value, // scale times the byte at the address
+    Delta  // scale times how much the byte changed during the step
+};
+
+// Many copies of one rom stepped a frame at a time with the keys an agent picks, for reinforcement learning.
+//
+// An action is a 16 bit mask with bit k set while key k is held. A step sets the keys of every instance from its
+// action and runs it up to the end of the current 60Hz frame. Fx0A is answered right away with the lowest key held,
+// with no key held the instance waits, frozen, for a step with one. Instances that crash stay crashed and report done
+// until they are reset.
+//
+// An observation is the display as packed bits, a row after the other with the leftmost pixel in the most
+// significant bit of the first byte of the row: 32 rows of 8 bytes, or 64 rows of 16 bytes with settings.hires.
+// High resolution displays are halved for small observations, a pixel is set if any of the 4 it covers is, and low
+// resolution displays are doubled for large ones, so every observation has the same shape whatever the rom does.
+//
+// Instances are split into one slice per thread, the calling thread steps the first and workers that live as long as
+// the environment step the others. A step allocates nothing and copies nothing but the observations, apart from the
+// blocks an engine caches the first time it meets them.
+class VectorEnvironment {
+public:
+    // Every instance starts at power on with seed 0 until the first reset(). Throws std::runtime_error if the rom does
+    // not fit in memory, std::invalid_argument for no instances or a clock speed below 60Hz.
+    VectorEnvironment(const uint8_t* rom, size_t rom_size, size_t instances, const EnvironmentSettings& settings);
+    VectorEnvironment(const VectorEnvironment&)            = delete;
+    VectorEnvironment& operator=(const VectorEnvironment&) = delete;
+    ~VectorEnvironment();
+
+    size_t size() const noexcept { return emulators.size(); }
+    // bytes per instance in the observations written by reset() and step()
+    size_t observation_size() const noexcept;
+
+    // Adds scale times the byte at address (or its change) to the reward of every step, see RewardKind. Byte hooks
+    // add up, a big endian 16 bit score at address is a hook with scale 256 there and one with scale 1 at address + 1.
+    // Throws std::invalid_argument for an address outside of memory.
+    void add_reward(uint16_t address, RewardKind kind, float scale);
+
+    // Starts every instance over from power on, instance i with random numbers from seeds[i], and writes their
+    // observations unless observations is null. Runs on the workers like step(). Throws std::invalid_argument if
+    // seeds is null.
+    void reset(const uint64_t* seeds, uint8_t* observations);
+    // reset() for a single instance, on the calling thread, e.g. for one that is done
+    void reset(size_t instance, uint64_t seed, uint8_t* observation);
+
+    // Steps every instance by a frame with the keys in actions[i] and writes size() observations, rewards and done
+    // flags (1 for a crashed instance), each output may be null if it is not needed. Throws std::invalid_argument if
+    // actions is null, rethrows the first exception an instance ran into.
+    void step(const uint16_t* actions, uint8_t* observations, float* rewards, uint8_t* done);
+
+    const Chip8Emulator& instance(size_t i) const noexcept { return emulators[i]; }
+
+private:
+    struct RewardHook {
+        uint16_t address;
+        RewardKind kind;
+        float scale;
+    };
+
+    // what the workers do next, the pointers are those passed to reset() or step()
+    struct Job {
+        const uint64_t* seeds   = nullptr; // set for a reset
+        const uint16_t* actions = nullptr;
+        uint8_t* observations   = nullptr;
+        float* rewards          = nullptr;
+        uint8_t* done           = nullptr;
+    };
+
+    EnvironmentSettings settings;
+    Snapshot power_on;
+    std::vector<Chip8Emulator> emulators;
+    std::vector<uint8_t> waiting; // 1 while an instance waits for Fx0A to be answered
+    std::vector<uint8_t> crashed;
+    std::vector<RewardHook> hooks;
+    std::vector<uint8_t> last_values; // the byte of every hook after the last step, hooks.size() per instance
+
+    std::vector<std::thread> workers;
+    std::vector<std::exception_ptr> errors; // one per slice
+    std::mutex mutex;
+    std::condition_variable job_ready;
+    std::condition_variable job_finished;
+    Job job;
+    uint64_t job_number = 0; // counts the jobs handed out, workers compare it to the last one they did
+    size_t busy_workers = 0;
+    bool stopping       = false;
+
+    void work(size_t slice);
+    void stop_workers() noexcept;
+    // runs job on every slice and waits for all of them
+    void run_job(const Job& next);
+    void run_slice(size_t slice) noexcept;
+    void reset_instance(size_t i, uint64_t seed, uint8_t* observation);
+    void step_instance(size_t i, uint16_t action, uint8_t* observation, float* reward, uint8_t* done);
+    void write_observation(const Chip8Emulator& emulator, uint8_t* observation) const noexcept;
+};
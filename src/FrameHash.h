@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "Chip8Emulator.h"
+
+// Non-cryptographic hashes of the display, cheap enough to take after every frame. They only have to tell apart
+// displays that differ, never withstand someone crafting collisions.
+namespace frame_hash
+{
+
+// murmur3's 64 bit finalizer, every input bit affects every output bit
+constexpr uint64_t mix(uint64_t value) noexcept {
+    value ^= value >> 33;
+    value *= 0xFF51AFD7ED558CCD;
+    value ^= value >> 33;
+    value *= 0xC4CEB9FE1A85EC53;
+    value ^= value >> 33;
+    return value;
+}
+
+// The rows are folded into four independent lanes so the multiplies overlap instead of waiting on each other, which
+// keeps a whole display at a few dozen cycles. Only the words the current resolution uses are hashed, a high
+// resolution display starts the lanes elsewhere so that it never hashes like a low resolution one.
+constexpr uint64_t display(const Chip8Emulator::DisplayRows& rows, bool hires) noexcept {
+    static_assert(Chip8Emulator::display_height % 4 == 0, "rows are hashed four at a time");
+    constexpr uint64_t multiplier = 0x9E3779B97F4A7C15;
+    const uint64_t seed           = hires ? 5 : 1;
+    uint64_t lanes[4]             = { seed, seed + 1, seed + 2, seed + 3 };
+    const size_t words            = hires ? 2 * Chip8Emulator::hires_height : Chip8Emulator::display_height;
+    for (size_t word = 0; word < words; word += 4) {
+        for (size_t lane = 0; lane < 4; ++lane) {
+            const size_t i       = word + lane;
+            const uint64_t value = (lanes[lane] ^ (hires ? rows[i % 2][i / 2] : rows[0][i])) * multiplier;
+            lanes[lane]          = value ^ (value >> 29);
+        }
+    }
+    uint64_t result = lanes[0];
+    for (size_t lane = 1; lane < 4; ++lane)
+        result = (result ^ lanes[lane]) * multiplier;
+    return mix(result);
+}
+
+// Folds the hash of one more frame into the hash of all frames before it. The result depends on every frame and on
+// their order, so a display that is only wrong for a few frames in between still changes it.
+constexpr uint64_t chain(uint64_t previous, uint64_t frame) noexcept {
+    return mix(previous ^ frame) + 0x9E3779B97F4A7C15;
+}
+
+} // namespace frame_hash
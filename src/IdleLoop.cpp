@@ -0,0 +1,61 @@
+#include "IdleLoop.h"
+
+namespace
+{
+
+constexpr size_t memory_size = 4096;
+
+bool is_skip(Op op) noexcept {
+    switch (op) {
+    case Op::SeByte:
+    case Op::Sne:
+    case Op::SeReg:
+    case Op::SneReg:
+    case Op::Skp:
+    case Op::Sknp: return true;
+    default: return false;
+    }
+}
+
+} // namespace
+
+std::optional<IdleLoop> find_idle_loop(const uint8_t* memory, uint16_t address) noexcept {
+    const auto instruction_at = [&](size_t pc) -> const Instruction& {
+        return decoded(static_cast<uint16_t>(memory[pc] << 8 | memory[pc + 1]));
+    };
+    const auto jumps_to = [&](size_t pc, size_t target) {
+        const Instruction& instruction = instruction_at(pc);
+        return instruction.op == Op::Jp && instruction.nnn == target;
+    };
+
+    IdleLoop loop{};
+    bool reads_timer = false;
+    // a skip at pc lands on pc + 4 and carries on from there, which has to stay clear of the end of memory
+    for (size_t pc = address; pc + 6 < memory_size; pc += 2) {
+        const Instruction& instruction = instruction_at(pc);
+        if (instruction.op == Op::Jp) {
+            if (instruction.nnn != address)
+                return std::nullopt;
+            loop.length = static_cast<uint8_t>(loop.load_count + 1);
+            return loop;
+        }
+        if (is_skip(instruction.op)) {
+            loop.skip   = instruction;
+            loop.length = static_cast<uint8_t>(loop.load_count + 2);
+            if (jumps_to(pc + 2, address))
+                return loop;
+            if (instruction_at(pc + 2).op == Op::Jp && jumps_to(pc + 4, address)) {
+                loop.loops_when_skipped = true;
+                return loop;
+            }
+            return std::nullopt;
+        }
+
+        const bool load = instruction.op == Op::LdByte || instruction.op == Op::LdAddr || (instruction.op == Op::LdDt && !reads_timer);
+        if (!load || loop.load_count == IdleLoop::max_loads)
+            return std::nullopt;
+        reads_timer |= instruction.op == Op::LdDt;
+        loop.loads[loop.load_count++] = instruction;
+    }
+    return std::nullopt;
+}
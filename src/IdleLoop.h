@@ -0,0 +1,29 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+
+#include "Instruction.h"
+
+// A loop that does nothing but wait, for the delay timer, for a key or forever:
+//   wait: LD V0, DT / SE V0, 0x00 / JP wait
+//   wait: SKP V5 / JP wait
+//   wait: JP wait
+// A pass loads constants or the delay timer, checks them or a key with at most one skip and jumps back. Nothing else
+// is read or written, so every pass leaves the machine just like the one before it until the timer ticks or a key
+// changes, and passes can be skipped over instead of run, see Chip8Emulator::skip_idle_loop().
+struct IdleLoop {
+    static constexpr size_t max_loads = 4;
+
+    std::array<Instruction, max_loads> loads; // 6xkk, Annn or Fx07, in order and with at most one Fx07
+    uint8_t load_count;
+    std::optional<Instruction> skip; // without one the loop never ends
+    bool loops_when_skipped;         // the skip jumps over a jump out of the loop onto the one back
+    uint8_t length;                  // instructions per pass
+};
+
+// The idle loop that starts at address in memory (4096 bytes), if there is one. Loops so close to the end of memory
+// that a pass could crash are never idle.
+std::optional<IdleLoop> find_idle_loop(const uint8_t* memory, uint16_t address) noexcept;
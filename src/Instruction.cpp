@@ -0,0 +1,83 @@
+#include "Instruction.h"
+
+#include <cstddef>
+
+namespace
+{
+
+constexpr char hex_digits[] = "0123456789ABCDEF";
+
+std::array<Instruction, 0x10000> make_instruction_table() {
+    std::array<Instruction, 0x10000> table{};
+    for (size_t opcode = 0; opcode < table.size(); ++opcode) {
+        table[opcode] = decode(static_cast<uint16_t>(opcode));
+    }
+    return table;
+}
+
+} // namespace
+
+const std::array<Instruction, 0x10000> instruction_table = make_instruction_table();
+
+std::string disassemble(uint16_t opcode) {
+    const auto hex = [](unsigned value, int digits) {
+        std::string text = "0x";
+        for (int shift = (digits - 1) * 4; shift >= 0; shift -= 4)
+            text += hex_digits[(value >> shift) & 0xF];
+        return text;
+    };
+    const Instruction& instruction = decoded(opcode);
+    const std::string vx           = std::string("V") + hex_digits[instruction.x];
+    const std::string vy           = std::string("V") + hex_digits[instruction.y];
+    const std::string kk           = hex(instruction.kk, 2);
+    const std::string nnn          = hex(instruction.nnn, 3);
+
+    switch (instruction.op) {
+    case Op::Cls: return "CLS";
+    case Op::Ret: return "RET";
+    case Op::ScrollDown: return "SCD " + std::to_string(instruction.n);
+    case Op::ScrollRight: return "SCR";
+    case Op::ScrollLeft: return "SCL";
+    case Op::Low: return "LOW";
+    case Op::High: return "HIGH";
+    case Op::Sys: return "SYS " + nnn;
+    case Op::Jp: return "JP " + nnn;
+    case Op::Call: return "CALL " + nnn;
+    case Op::SeByte: return "SE " + vx + ", " + kk;
+    case Op::Sne: return "SNE " + vx + ", " + kk;
+    case Op::SeReg: return "SE " + vx + ", " + vy;
+    case Op::LdByte: return "LD " + vx + ", " + kk;
+    case Op::Add: return "ADD " + vx + ", " + kk;
+    case Op::LdReg: return "LD " + vx + ", " + vy;
+    case Op::Or: return "OR " + vx + ", " + vy;
+    case Op::And: return "AND " + vx + ", " + vy;
+    case Op::Xor: return "XOR " + vx + ", " + vy;
+    case Op::AddReg: return "ADD " + vx + ", " + vy;
+    case Op::Sub: return "SUB " + vx + ", " + vy;
+    case Op::Shr: return "SHR " + vx + ", " + vy;
+    case Op::Subn: return "SUBN " + vx + ", " + vy;
+    case Op::Shl: return "SHL " + vx + ", " + vy;
+    case Op::SneReg: return "SNE " + vx + ", " + vy;
+    case Op::LdAddr: return "LD I, " + nnn;
+    case Op::JpOffset: return "JP V0, " + nnn;
+    case Op::Rnd: return "RND " + vx + ", " + kk;
+    case Op::Drw: return "DRW " + vx + ", " + vy + ", " + std::to_string(instruction.n);
+    case Op::Skp: return "SKP " + vx;
+    case Op::Sknp: return "SKNP " + vx;
+    case Op::LdDt: return "LD " + vx + ", DT";
+    case Op::LdWaitKey: return "LD " + vx + ", K";
+    case Op::LdSetDt: return "LD DT, " + vx;
+    case Op::LdSt: return "LD ST, " + vx;
+    case Op::AddIdxReg: return "ADD I, " + vx;
+    case Op::LdFont: return "LD F, " + vx;
+    case Op::LdHiresFont: return "LD HF, " + vx;
+    case Op::LdBcd: return "LD B, " + vx;
+    case Op::LdRegDump: return "LD [I], " + vx;
+    case Op::LdRegStore: return "LD " + vx + ", [I]";
+    case Op::LdFlagsDump: return "LD R, " + vx;
+    case Op::LdFlagsStore: return "LD " + vx + ", R";
+    case Op::Invalid:
+    case Op::Count: break;
+    }
+    return "DW " + hex(opcode, 4);
+}
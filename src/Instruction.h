@@ -0,0 +1,166 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string>
+
+// One entry per instruction handler in Chip8Emulator
+enum class Op : uint8_t {
+    Invalid,
+    Cls,
+    Ret,
+    ScrollDown,
+    ScrollRight,
+    ScrollLeft,
+    Low,
+    High,
+    Sys,
+    Jp,
+    Call,
+    SeByte,
+    Sne,
+    SeReg,
+    LdByte,
+    Add,
+    LdReg,
+    Or,
+    And,
+    Xor,
+    AddReg,
+    Sub,
+    Shr,
+    Subn,
+    Shl,
+    SneReg,
+    LdAddr,
+    JpOffset,
+    Rnd,
+    Drw,
+    Skp,
+    Sknp,
+    LdDt,
+    LdWaitKey,
+    LdSetDt,
+    LdSt,
+    AddIdxReg,
+    LdFont,
+    LdHiresFont,
+    LdBcd,
+    LdRegDump,
+    LdRegStore,
+    LdFlagsDump,
+    LdFlagsStore,
+    Count
+};
+
+// An opcode decoded into the operation it performs and all of its operand fields, so that the handlers do not
+// need to mask and shift the raw opcode. Not every field is meaningful for every operation.
+struct Instruction {
+    Op op;
+    uint8_t x;    // 0x0X00
+    uint8_t y;    // 0x00Y0
+    uint8_t n;    // 0x000N
+    uint8_t kk;   // 0x00KK
+    uint16_t nnn; // 0x0NNN
+};
+
+constexpr Instruction decode(uint16_t opcode) {
+    Instruction instruction{
+        Op::Invalid,
+        static_cast<uint8_t>((opcode & 0x0F00) >> 8),
+        static_cast<uint8_t>((opcode & 0x00F0) >> 4),
+        static_cast<uint8_t>(opcode & 0x000F),
+        static_cast<uint8_t>(opcode & 0x00FF),
+        static_cast<uint16_t>(opcode & 0x0FFF)
+    };
+
+    switch (opcode & 0xF000) {
+    case 0x0000:
+        if (opcode == 0x00E0) {
+            instruction.op = Op::Cls;
+        } else if (opcode == 0x00EE) {
+            instruction.op = Op::Ret;
+        } else if ((opcode & 0xFFF0) == 0x00C0) {
+            instruction.op = Op::ScrollDown;
+        } else if (opcode == 0x00FB) {
+            instruction.op = Op::ScrollRight;
+        } else if (opcode == 0x00FC) {
+            instruction.op = Op::ScrollLeft;
+        } else if (opcode == 0x00FE) {
+            instruction.op = Op::Low;
+        } else if (opcode == 0x00FF) {
+            instruction.op = Op::High;
+        } else {
+            instruction.op = Op::Sys;
+        }
+        break;
+    case 0x1000: instruction.op = Op::Jp; break;
+    case 0x2000: instruction.op = Op::Call; break;
+    case 0x3000: instruction.op = Op::SeByte; break;
+    case 0x4000: instruction.op = Op::Sne; break;
+    case 0x5000: instruction.op = Op::SeReg; break;
+    case 0x6000: instruction.op = Op::LdByte; break;
+    case 0x7000: instruction.op = Op::Add; break;
+    case 0x8000: {
+        switch (opcode & 0xF) {
+        case 0x0: instruction.op = Op::LdReg; break;
+        case 0x1: instruction.op = Op::Or; break;
+        case 0x2: instruction.op = Op::And; break;
+        case 0x3: instruction.op = Op::Xor; break;
+        case 0x4: instruction.op = Op::AddReg; break;
+        case 0x5: instruction.op = Op::Sub; break;
+        case 0x6: instruction.op = Op::Shr; break;
+        case 0x7: instruction.op = Op::Subn; break;
+        case 0xE: instruction.op = Op::Shl; break;
+        default: break;
+        }
+        break;
+    }
+    case 0x9000: instruction.op = Op::SneReg; break;
+    case 0xA000: instruction.op = Op::LdAddr; break;
+    case 0xB000: instruction.op = Op::JpOffset; break;
+    case 0xC000: instruction.op = Op::Rnd; break;
+    case 0xD000: instruction.op = Op::Drw; break;
+    case 0xE000: {
+        switch (opcode & 0xFF) {
+        case 0x9E: instruction.op = Op::Skp; break;
+        case 0xA1: instruction.op = Op::Sknp; break;
+        default: break;
+        }
+        break;
+    }
+    case 0xF000: {
+        switch (opcode & 0xFF) {
+        case 0x07: instruction.op = Op::LdDt; break;
+        case 0x0A: instruction.op = Op::LdWaitKey; break;
+        case 0x15: instruction.op = Op::LdSetDt; break;
+        case 0x18: instruction.op = Op::LdSt; break;
+        case 0x1E: instruction.op = Op::AddIdxReg; break;
+        case 0x29: instruction.op = Op::LdFont; break;
+        case 0x30: instruction.op = Op::LdHiresFont; break;
+        case 0x33: instruction.op = Op::LdBcd; break;
+        case 0x55: instruction.op = Op::LdRegDump; break;
+        case 0x65: instruction.op = Op::LdRegStore; break;
+        case 0x75: instruction.op = Op::LdFlagsDump; break;
+        case 0x85: instruction.op = Op::LdFlagsStore; break;
+        default: break;
+        }
+        break;
+    }
+    default: break;
+    }
+
+    return instruction;
+}
+
+// Every possible opcode decoded ahead of time, shared by all emulator instances. Looking an opcode up here
+// replaces the chain of switches above with a single load on the hot path.
+extern const std::array<Instruction, 0x10000> instruction_table;
+
+inline const Instruction& decoded(uint16_t opcode) noexcept {
+    return instruction_table[opcode];
+}
+
+// The opcode in the usual assembler notation (Cowgod's, with the SUPER-CHIP mnemonics), e.g. "DRW V0, V1, 5".
+// Opcodes that are not instructions are shown as data words.
+std::string disassemble(uint16_t opcode);
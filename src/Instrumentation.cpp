@@ -0,0 +1,36 @@
+#include "Instrumentation.h"
+
+#include <numeric>
+#include <ostream>
+
+namespace
+{
+
+// the handler an Op stands for, by the opcode pattern it decodes from
+constexpr std::array<const char*, static_cast<size_t>(Op::Count)> op_names = {
+    "invalid", "00E0", "00EE", "00Cn", "00FB", "00FC", "00FE", "00FF", "0nnn", "1nnn", "2nnn", "3xkk",
+    "4xkk",    "5xy0", "6xkk", "7xkk", "8xy0", "8xy1", "8xy2", "8xy3", "8xy4", "8xy5", "8xy6", "8xy7",
+    "8xyE",    "9xy0", "Annn", "Bnnn", "Cxkk", "Dxyn", "Ex9E", "ExA1", "Fx07", "Fx0A", "Fx15", "Fx18",
+    "Fx1E",    "Fx29", "Fx30", "Fx33", "Fx55", "Fx65", "Fx75", "Fx85"
+};
+
+} // namespace
+
+uint64_t ExecutionProfile::instructions() const noexcept {
+    return std::accumulate(op_counts.begin(), op_counts.end(), uint64_t{ 0 });
+}
+
+void ExecutionProfile::write_json(std::ostream& out, double elapsed_seconds) const {
+    const uint64_t total = instructions();
+    out << "{\n  \"instructions\": " << total << ",\n  \"seconds\": " << elapsed_seconds
+        << ",\n  \"instructions_per_sec\": " << (elapsed_seconds > 0.0 ? static_cast<double>(total) / elapsed_seconds : 0.0)
+        << ",\n  \"opcodes\": {";
+    for (size_t i = 0; i < op_counts.size(); ++i)
+        out << (i == 0 ? "\n" : ",\n") << "    \"" << op_names[i] << "\": " << op_counts[i];
+    out << "\n  },\n  \"skips\": { \"taken\": " << skips_taken << ", \"not_taken\": " << skips_not_taken
+        << " },\n  \"draw_heights\": [";
+    for (size_t i = 0; i < draw_heights.size(); ++i)
+        out << (i == 0 ? "" : ", ") << draw_heights[i];
+    out << "],\n  \"stack_high_water\": " << unsigned{ stack_high_water } << ",\n  \"key_waits\": " << key_waits
+        << "\n}\n";
+}
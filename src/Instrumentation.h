@@ -0,0 +1,52 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <iosfwd>
+
+#include "Chip8Emulator.h"
+#include "Instruction.h"
+
+// Policies for the instrumented Chip8Emulator::run_cycles(). The loop calls executed() after every instruction with
+// its opcode, the machine already in the state the instruction left it in and the action it returned. TraceRecorder
+// in Trace.h is another.
+
+// Every call is empty and inlines away, the loop compiles to the same code as if it had no instrumentation at all
+struct NoInstrumentation {
+    void executed(const Chip8Emulator&, uint16_t, const Instruction&, uint16_t, Chip8Emulator::Action) noexcept {}
+};
+
+// Counts what a rom spends its instructions on
+struct ExecutionProfile {
+    std::array<uint64_t, static_cast<size_t>(Op::Count)> op_counts{};
+    uint64_t skips_taken     = 0;
+    uint64_t skips_not_taken = 0;
+    std::array<uint64_t, 16> draw_heights{}; // Dxyn by n, n = 0 counts the 16x16 sprites of high resolution
+    uint8_t stack_high_water = 0;
+    uint64_t key_waits       = 0; // Fx0A stalls, the machine stops until a key is pressed
+
+    void executed(const Chip8Emulator& emulator, uint16_t, const Instruction& instruction, uint16_t pc_before,
+                  Chip8Emulator::Action action) noexcept {
+        ++op_counts[static_cast<size_t>(instruction.op)];
+        switch (instruction.op) {
+        case Op::SeByte:
+        case Op::Sne:
+        case Op::SeReg:
+        case Op::SneReg:
+        case Op::Skp:
+        case Op::Sknp: ++(emulator.pc() == pc_before + 4 ? skips_taken : skips_not_taken); break;
+        case Op::Drw: ++draw_heights[instruction.n]; break;
+        case Op::Call: stack_high_water = std::max(stack_high_water, emulator.stack_depth()); break;
+        default: break;
+        }
+        if (action == Chip8Emulator::Action::WaitForInput)
+            ++key_waits;
+    }
+
+    uint64_t instructions() const noexcept;
+
+    // Writes the counts as json, together with the host's speed over elapsed_seconds of wall time. Can be called at
+    // any point of a run, the counts are whatever has been executed up to then.
+    void write_json(std::ostream& out, double elapsed_seconds) const;
+};
@@ -0,0 +1,622 @@
+#include "Jit.h"
+
+#include "BlockCache.h"
+#include "IdleLoop.h"
+#include "Instruction.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#if defined(__x86_64__) && defined(__unix__)
+#    define CHIP8_JIT_SUPPORTED 1
+#    include <sys/mman.h>
+#else
+#    define CHIP8_JIT_SUPPORTED 0
+#endif
+
+#if CHIP8_JIT_SUPPORTED
+
+namespace
+{
+
+enum Reg : uint8_t {
+    rax,
+    rcx,
+    rdx,
+    rbx,
+    rsp,
+    rbp,
+    rsi,
+    rdi,
+    r8,
+    r9,
+    r10,
+    r11,
+    r12,
+    r13,
+    r14,
+    r15
+};
+
+// rax is scratch, rbx holds the frame and r12 the index register, everything else can hold a data register
+constexpr Reg frame_reg                      = rbx;
+constexpr Reg index_reg                      = r12;
+constexpr std::array<Reg, 12> register_pool = { rcx, rdx, rsi, rdi, r8, r9, r10, r11, rbp, r13, r14, r15 };
+
+// condition codes for setcc/jcc
+constexpr uint8_t cc_b  = 0x2;
+constexpr uint8_t cc_a  = 0x7;
+constexpr uint8_t cc_e  = 0x4;
+constexpr uint8_t cc_ne = 0x5;
+constexpr uint8_t cc_be = 0x6;
+
+// group opcodes, the reg field of the ModRM byte selects the operation
+constexpr uint8_t ext_add = 0;
+constexpr uint8_t ext_and = 4;
+constexpr uint8_t ext_shl = 4;
+constexpr uint8_t ext_shr = 5;
+constexpr uint8_t ext_cmp = 7;
+
+// two operand "op r/m8, r8" opcodes
+constexpr uint8_t op_add = 0x00;
+constexpr uint8_t op_or  = 0x08;
+constexpr uint8_t op_and = 0x20;
+constexpr uint8_t op_sub = 0x28;
+constexpr uint8_t op_xor = 0x30;
+constexpr uint8_t op_cmp = 0x38;
+constexpr uint8_t op_mov = 0x88;
+
+constexpr uint8_t vf_index = 15;
+
+constexpr uint8_t frame_v(size_t reg) { return static_cast<uint8_t>(offsetof(JitFrame, v) + reg); }
+constexpr auto frame_index       = static_cast<uint8_t>(offsetof(JitFrame, index));
+constexpr auto frame_pc          = static_cast<uint8_t>(offsetof(JitFrame, pc));
+constexpr auto frame_executed    = static_cast<uint8_t>(offsetof(JitFrame, executed));
+constexpr auto frame_chain_limit = static_cast<uint8_t>(offsetof(JitFrame, chain_limit));
+
+// A minimal x86-64 encoder for exactly the instructions the compiler needs
+class Assembler {
+public:
+    std::vector<uint8_t> bytes;
+
+    size_t size() const noexcept { return bytes.size(); }
+
+    void emit(uint8_t byte) { bytes.push_back(byte); }
+    void emit16(uint16_t value) {
+        emit(static_cast<uint8_t>(value));
+        emit(static_cast<uint8_t>(value >> 8));
+    }
+    void emit32(uint32_t value) {
+        emit16(static_cast<uint16_t>(value));
+        emit16(static_cast<uint16_t>(value >> 16));
+    }
+    void emit64(uint64_t value) {
+        emit32(static_cast<uint32_t>(value));
+        emit32(static_cast<uint32_t>(value >> 32));
+    }
+
+    // The REX prefix is emitted even when no bits are set so that byte operations on rsi/rdi/rbp address
+    // sil/dil/bpl instead of dh/bh/ch
+    void rex(bool wide, uint8_t reg, uint8_t rm) {
+        emit(static_cast<uint8_t>(0x40 | (wide ? 0x8 : 0) | ((reg >> 3) << 2) | (rm >> 3)));
+    }
+    void modrm(uint8_t mod, uint8_t reg, uint8_t rm) {
+        emit(static_cast<uint8_t>((mod << 6) | ((reg & 7) << 3) | (rm & 7)));
+    }
+
+    // op dst8, src8
+    void op8(uint8_t opcode, Reg dst, Reg src) {
+        rex(false, src, dst);
+        emit(opcode);
+        modrm(3, src, dst);
+    }
+    // op dst8, imm8 from the 0x80 group
+    void op8_imm(uint8_t ext, Reg dst, uint8_t imm) {
+        rex(false, 0, dst);
+        emit(0x80);
+        modrm(3, ext, dst);
+        emit(imm);
+    }
+    void mov8_imm(Reg dst, uint8_t imm) {
+        rex(false, 0, dst);
+        emit(static_cast<uint8_t>(0xB0 + (dst & 7)));
+        emit(imm);
+    }
+    // shl/shr dst8, 1
+    void shift8_one(uint8_t ext, Reg dst) {
+        rex(false, 0, dst);
+        emit(0xD0);
+        modrm(3, ext, dst);
+    }
+    void setcc(uint8_t cc, Reg dst) {
+        rex(false, 0, dst);
+        emit(0x0F);
+        emit(static_cast<uint8_t>(0x90 | cc));
+        modrm(3, 0, dst);
+    }
+    // movzx dst32, src8
+    void movzx8(Reg dst, Reg src) {
+        rex(false, dst, src);
+        emit(0x0F);
+        emit(0xB6);
+        modrm(3, dst, src);
+    }
+    // movzx dst32, byte [frame + disp]
+    void load8(Reg dst, uint8_t disp) {
+        rex(false, dst, frame_reg);
+        emit(0x0F);
+        emit(0xB6);
+        modrm(1, dst, frame_reg);
+        emit(disp);
+    }
+    // mov byte [frame + disp], src8
+    void store8(uint8_t disp, Reg src) {
+        rex(false, src, frame_reg);
+        emit(0x88);
+        modrm(1, src, frame_reg);
+        emit(disp);
+    }
+    // movzx dst32, word [frame + disp]
+    void load16(Reg dst, uint8_t disp) {
+        rex(false, dst, frame_reg);
+        emit(0x0F);
+        emit(0xB7);
+        modrm(1, dst, frame_reg);
+        emit(disp);
+    }
+    // mov word [frame + disp], src16
+    void store16(uint8_t disp, Reg src) {
+        emit(0x66);
+        rex(false, src, frame_reg);
+        emit(0x89);
+        modrm(1, src, frame_reg);
+        emit(disp);
+    }
+    // mov word [frame + disp], imm16
+    void store16_imm(uint8_t disp, uint16_t imm) {
+        emit(0x66);
+        emit(0xC7);
+        modrm(1, 0, frame_reg);
+        emit(disp);
+        emit16(imm);
+    }
+    // mov eax, dword [frame + disp]
+    void load32_eax(uint8_t disp) {
+        emit(0x8B);
+        modrm(1, rax, frame_reg);
+        emit(disp);
+    }
+    // mov dword [frame + disp], eax
+    void store32_eax(uint8_t disp) {
+        emit(0x89);
+        modrm(1, rax, frame_reg);
+        emit(disp);
+    }
+    // cmp eax, dword [frame + disp]
+    void cmp32_eax(uint8_t disp) {
+        emit(0x3B);
+        modrm(1, rax, frame_reg);
+        emit(disp);
+    }
+    // add dword [frame + disp], imm32
+    void add32_imm(uint8_t disp, uint32_t imm) {
+        emit(0x81);
+        modrm(1, ext_add, frame_reg);
+        emit(disp);
+        emit32(imm);
+    }
+    void add_eax(uint32_t imm) {
+        emit(0x05);
+        emit32(imm);
+    }
+    void zero_eax() {
+        emit(0x31);
+        emit(0xC0);
+    }
+    // add dst16, src16
+    void add16(Reg dst, Reg src) {
+        emit(0x66);
+        rex(false, src, dst);
+        emit(0x01);
+        modrm(3, src, dst);
+    }
+    void mov32_imm(Reg dst, uint32_t imm) {
+        rex(false, 0, dst);
+        emit(static_cast<uint8_t>(0xB8 + (dst & 7)));
+        emit32(imm);
+    }
+    void mov64_imm(Reg dst, uint64_t imm) {
+        rex(true, 0, dst);
+        emit(static_cast<uint8_t>(0xB8 + (dst & 7)));
+        emit64(imm);
+    }
+    void mov64(Reg dst, Reg src) {
+        rex(true, src, dst);
+        emit(0x89);
+        modrm(3, src, dst);
+    }
+    void test_eax() {
+        emit(0x85);
+        emit(0xC0);
+    }
+    void call(Reg target) {
+        rex(false, 0, target);
+        emit(0xFF);
+        modrm(3, 2, target);
+    }
+    void push(Reg reg) {
+        rex(false, 0, reg);
+        emit(static_cast<uint8_t>(0x50 + (reg & 7)));
+    }
+    void pop(Reg reg) {
+        rex(false, 0, reg);
+        emit(static_cast<uint8_t>(0x58 + (reg & 7)));
+    }
+    void adjust_rsp(bool grow) {
+        emit(0x48);
+        emit(0x83);
+        emit(grow ? 0xEC : 0xC4);
+        emit(8);
+    }
+    void ret() { emit(0xC3); }
+
+    // jumps return the offset of their rel32 so it can be patched once the target is known
+    size_t jmp() {
+        emit(0xE9);
+        emit32(0);
+        return size() - 4;
+    }
+    size_t jcc(uint8_t cc) {
+        emit(0x0F);
+        emit(static_cast<uint8_t>(0x80 | cc));
+        emit32(0);
+        return size() - 4;
+    }
+    void patch(size_t fixup, size_t target) {
+        const auto rel = static_cast<uint32_t>(static_cast<int64_t>(target) - static_cast<int64_t>(fixup + 4));
+        std::memcpy(bytes.data() + fixup, &rel, sizeof(rel));
+    }
+};
+
+// the data registers a natively translated instruction touches, as a bit mask
+uint16_t registers_used(const Instruction& instruction) {
+    const auto x  = static_cast<uint16_t>(1u << instruction.x);
+    const auto y  = static_cast<uint16_t>(1u << instruction.y);
+    const auto vf = static_cast<uint16_t>(1u << vf_index);
+    switch (instruction.op) {
+    case Op::LdByte:
+    case Op::Add:
+    case Op::AddIdxReg:
+    case Op::SeByte:
+    case Op::Sne:
+        return x;
+    case Op::LdReg:
+    case Op::Or:
+    case Op::And:
+    case Op::Xor:
+    case Op::SeReg:
+    case Op::SneReg:
+        return x | y;
+    case Op::AddReg:
+    case Op::Sub:
+    case Op::Subn:
+        return x | y | vf;
+    case Op::Shr:
+    case Op::Shl:
+        return x | vf;
+    default:
+        return 0;
+    }
+}
+
+} // namespace
+
+JitCompiler::JitCompiler(JitFallback fallback_handler, const Quirks& profile_quirks)
+    : fallback(fallback_handler),
+      quirks(profile_quirks) {
+    void* buffer = mmap(nullptr, code_buffer_size, PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buffer != MAP_FAILED)
+        code_buffer = static_cast<uint8_t*>(buffer);
+}
+
+JitCompiler::~JitCompiler() {
+    if (code_buffer != nullptr)
+        munmap(code_buffer, code_buffer_size);
+}
+
+bool JitCompiler::supported() noexcept {
+    return true;
+}
+
+void JitCompiler::compile(const uint8_t* memory, uint16_t address) {
+    if (compiled_at.empty())
+        compiled_at.resize(memory_size);
+
+    struct Entry {
+        Instruction instruction;
+        uint16_t opcode;
+        uint16_t address;
+        bool native;
+    };
+
+    // Collect the block with the same boundaries as BlockCache, but end it early rather than spill if the native
+    // instructions would need more data registers than there are host registers to hold them
+    std::vector<Entry> entries;
+    std::array<Reg, 16> host{};
+    uint16_t allocated  = 0;
+    size_t pool_used    = 0;
+    size_t native_count = 0;
+    size_t source_end   = address;
+    for (size_t pc = address; pc + 1 < memory_size && entries.size() < BlockCache::max_block_length; pc += 2) {
+        const auto opcode              = static_cast<uint16_t>((memory[pc] << 8) | memory[pc + 1]);
+        const Instruction& instruction = decoded(opcode);
+        const bool native              = is_register_only(instruction, pc) && !differs_from_default(quirks, instruction.op);
+        if (native) {
+            const auto wanted = static_cast<uint16_t>(registers_used(instruction) & ~allocated);
+            if (pool_used + static_cast<size_t>(__builtin_popcount(wanted)) > register_pool.size())
+                break;
+            for (uint8_t reg = 0; reg < 16; ++reg) {
+                if (wanted & (1u << reg))
+                    host[reg] = register_pool[pool_used++];
+            }
+            allocated |= wanted;
+            native_count++;
+        }
+
+        entries.push_back({ instruction, opcode, static_cast<uint16_t>(pc), native });
+        source_end = pc + 2;
+        if (ends_block(instruction.op))
+            break;
+    }
+
+    const auto mark_source = [&]() {
+        for (size_t i = address; i < source_end; ++i)
+            code[i] = true;
+        code_begin = std::min<size_t>(code_begin, address);
+        code_end   = std::max(code_end, source_end);
+    };
+
+    // calling into native code only to call straight back out for every instruction is slower than interpreting
+    if (native_count == 0) {
+        mark_source();
+        compiled_at[address] = { { nullptr, static_cast<uint32_t>(entries.size()) }, nullptr };
+        return;
+    }
+
+    Assembler a;
+    const auto load_state = [&]() {
+        a.load16(index_reg, frame_index);
+        for (uint8_t reg = 0; reg < 16; ++reg) {
+            if (allocated & (1u << reg))
+                a.load8(host[reg], frame_v(reg));
+        }
+    };
+    const auto store_state = [&]() {
+        a.store16(frame_index, index_reg);
+        for (uint8_t reg = 0; reg < 16; ++reg) {
+            if (allocated & (1u << reg))
+                a.store8(frame_v(reg), host[reg]);
+        }
+    };
+
+    std::vector<size_t> exits;
+    std::vector<Link> chains;
+    // leaves the block for target once the state has been stored, jumping straight into the block compiled there
+    // while the budget allows it. Idle loops are left to run_compiled(), which skips over their passes.
+    const auto exit_to = [&](uint32_t position, uint16_t target) {
+        a.load32_eax(frame_executed);
+        a.add_eax(position);
+        a.store32_eax(frame_executed);
+        a.store16_imm(frame_pc, target);
+        if (!find_idle_loop(memory, target)) {
+            a.cmp32_eax(frame_chain_limit);
+            const size_t over_limit = a.jcc(cc_a);
+            chains.push_back({ target, a.jmp() }); // falls through until linked
+            a.patch(chains.back().offset, a.size());
+            a.patch(over_limit, a.size());
+        }
+        a.zero_eax();
+        exits.push_back(a.jmp());
+    };
+
+    // rbx, rbp and r12-r15 are callee saved. Six pushes plus the return address leave the stack 16 byte aligned
+    // after one more 8 byte adjustment, as the fallback call requires
+    for (const Reg reg : { rbx, rbp, r12, r13, r14, r15 })
+        a.push(reg);
+    a.adjust_rsp(true);
+    a.mov64(frame_reg, rdi);
+    const size_t chain_entry = a.size();
+    load_state();
+
+    for (size_t k = 0; k < entries.size(); ++k) {
+        const Entry& entry             = entries[k];
+        const Instruction& instruction = entry.instruction;
+        const auto position            = static_cast<uint32_t>(k + 1);
+        const bool last                = k + 1 == entries.size();
+
+        if (!entry.native) {
+            store_state();
+            a.mov64(rdi, frame_reg);
+            a.mov32_imm(rsi, entry.opcode);
+            a.mov32_imm(rdx, entry.address);
+            a.mov32_imm(rcx, position);
+            a.mov64_imm(rax, reinterpret_cast<uint64_t>(fallback));
+            a.call(rax);
+            if (last) {
+                // the handler has set the pc, which is not known here, so this is never chained
+                a.add32_imm(frame_executed, position);
+                exits.push_back(a.jmp());
+            } else {
+                // stop at the first action that is not DoNothing, the handler has already set the pc
+                a.test_eax();
+                const size_t carry_on = a.jcc(cc_e);
+                a.add32_imm(frame_executed, position);
+                exits.push_back(a.jmp());
+                a.patch(carry_on, a.size());
+                load_state();
+            }
+            continue;
+        }
+
+        const Reg vx = host[instruction.x];
+        const Reg vy = host[instruction.y];
+        const Reg vf = host[vf_index];
+        bool ended   = false;
+        switch (instruction.op) {
+        case Op::Sys: break;
+        case Op::LdByte: a.mov8_imm(vx, instruction.kk); break;
+        case Op::Add: a.op8_imm(ext_add, vx, instruction.kk); break;
+        case Op::LdReg: a.op8(op_mov, vx, vy); break;
+        case Op::Or: a.op8(op_or, vx, vy); break;
+        case Op::And: a.op8(op_and, vx, vy); break;
+        case Op::Xor: a.op8(op_xor, vx, vy); break;
+        // The flag results follow the handlers exactly: VF = new < old for add and VF = !(new > old) for both
+        // subtractions, written after Vx so that VF is the flag when x is 15
+        case Op::AddReg:
+            a.op8(op_mov, rax, vx);
+            a.op8(op_add, vx, vy);
+            a.op8(op_cmp, vx, rax);
+            a.setcc(cc_b, vf);
+            break;
+        case Op::Sub:
+            a.op8(op_mov, rax, vx);
+            a.op8(op_sub, vx, vy);
+            a.op8(op_cmp, vx, rax);
+            a.setcc(cc_be, vf);
+            break;
+        case Op::Subn:
+            a.op8(op_mov, rax, vx);
+            a.op8(op_mov, vx, vy);
+            a.op8(op_sub, vx, rax);
+            a.op8(op_cmp, vx, rax);
+            a.setcc(cc_be, vf);
+            break;
+        // VF is written before the shift, so shifting VF itself shifts the flag
+        case Op::Shr:
+            a.op8(op_mov, rax, vx);
+            a.op8_imm(ext_and, rax, 0x01);
+            a.op8(op_mov, vf, rax);
+            a.shift8_one(ext_shr, vx);
+            break;
+        case Op::Shl:
+            a.op8(op_mov, rax, vx);
+            a.op8_imm(ext_and, rax, 0x80);
+            a.op8(op_mov, vf, rax);
+            a.shift8_one(ext_shl, vx);
+            break;
+        case Op::LdAddr: a.mov32_imm(index_reg, instruction.nnn); break;
+        case Op::AddIdxReg:
+            a.movzx8(rax, vx);
+            a.add16(index_reg, rax);
+            break;
+        case Op::Jp:
+            store_state();
+            exit_to(position, instruction.nnn);
+            ended = true;
+            break;
+        case Op::SeByte:
+        case Op::Sne:
+        case Op::SeReg:
+        case Op::SneReg: {
+            store_state();
+            if (instruction.op == Op::SeByte || instruction.op == Op::Sne)
+                a.op8_imm(ext_cmp, vx, instruction.kk);
+            else
+                a.op8(op_cmp, vx, vy);
+            const bool skip_if_equal = instruction.op == Op::SeByte || instruction.op == Op::SeReg;
+            const size_t skip        = a.jcc(skip_if_equal ? cc_e : cc_ne);
+            exit_to(position, static_cast<uint16_t>(entry.address + 2));
+            a.patch(skip, a.size());
+            exit_to(position, static_cast<uint16_t>(entry.address + 4));
+            ended = true;
+            break;
+        }
+        default: throw std::logic_error("instruction cannot be compiled natively");
+        }
+
+        if (last && !ended) {
+            store_state();
+            exit_to(position, static_cast<uint16_t>(entry.address + 2));
+        }
+    }
+
+    for (const size_t exit : exits)
+        a.patch(exit, a.size());
+    a.adjust_rsp(false);
+    for (const Reg reg : { r15, r14, r13, r12, rbp, rbx })
+        a.pop(reg);
+    a.ret();
+
+    if (code_used + a.size() > code_buffer_size)
+        clear();
+
+    mark_source();
+
+    // Kernels that forbid switching a mapping between writable and executable (PaX MPROTECT, SELinux execmem) refuse
+    // either call, the block then runs in the interpreter and the compiler disables itself like after too many flushes
+    const auto disable = [&]() {
+        code_flushes         = max_code_flushes;
+        compiled_at[address] = { { nullptr, static_cast<uint32_t>(entries.size()) }, nullptr };
+    };
+    const size_t base = code_used;
+    if (mprotect(code_buffer, code_buffer_size, PROT_READ | PROT_WRITE) != 0) {
+        disable();
+        return;
+    }
+    std::memcpy(code_buffer + base, a.bytes.data(), a.size());
+    code_used += a.size();
+    compiled_at[address] = { { reinterpret_cast<NativeBlock>(code_buffer + base), static_cast<uint32_t>(entries.size()) },
+                             code_buffer + base + chain_entry };
+
+    // link this block's exits to blocks that already exist and the jumps that were waiting for this one to it
+    for (const Link& chain : chains) {
+        if (const uint8_t* target = compiled_at[chain.target].chain_entry; target != nullptr)
+            link(base + chain.offset, target);
+        else
+            pending_links.push_back({ chain.target, base + chain.offset });
+    }
+    const auto waiting = std::partition(pending_links.begin(), pending_links.end(),
+                                        [address](const Link& pending) { return pending.target != address; });
+    for (auto it = waiting; it != pending_links.end(); ++it)
+        link(it->offset, compiled_at[address].chain_entry);
+    pending_links.erase(waiting, pending_links.end());
+    if (mprotect(code_buffer, code_buffer_size, PROT_READ | PROT_EXEC) != 0)
+        disable();
+}
+
+void JitCompiler::link(size_t offset, const uint8_t* target) noexcept {
+    const auto rel = static_cast<int32_t>(target - (code_buffer + offset + 4));
+    std::memcpy(code_buffer + offset, &rel, sizeof(rel));
+}
+
+void JitCompiler::clear() noexcept {
+    std::fill(compiled_at.begin(), compiled_at.end(), Slot{ { nullptr, 0 }, nullptr });
+    pending_links.clear();
+    code.reset();
+    code_begin = memory_size;
+    code_end   = 0;
+    code_used  = 0;
+}
+
+#else
+
+JitCompiler::JitCompiler(JitFallback fallback_handler, const Quirks& profile_quirks)
+    : fallback(fallback_handler),
+      quirks(profile_quirks) {
+}
+
+JitCompiler::~JitCompiler() = default;
+
+bool JitCompiler::supported() noexcept {
+    return false;
+}
+
+void JitCompiler::compile([[maybe_unused]] const uint8_t* memory, [[maybe_unused]] uint16_t address) {
+    throw std::logic_error("the jit compiler is not supported on this platform");
+}
+
+void JitCompiler::clear() noexcept {
+}
+
+#endif
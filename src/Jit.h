@@ -0,0 +1,111 @@
+#pragma once
+
+#include <array>
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "Quirks.h"
+
+// The machine state that compiled code works on. Chip8Emulator copies its registers in before running compiled code
+// and back out afterwards, this keeps the generated code independent of Chip8Emulator's layout.
+struct JitFrame {
+    std::array<uint8_t, 16> v;
+    uint16_t index;
+    uint16_t pc;
+    uint32_t executed;       // instructions completed by the blocks run so far
+    uint32_t chain_limit;    // a block only jumps straight into the next one while executed is at most this
+    uint32_t cycles_applied; // how many of the executed instructions the fallback has already counted
+    void* context;           // the Chip8Emulator the code runs on
+};
+
+// Called from compiled code for every instruction that is not translated to native code. It must run the
+// instruction at address through the interpreter, with cycles up to and including frame->executed + position
+// (position is the 1 based index of the instruction within its block) accounted for, and return the resulting
+// action, 0 to carry on.
+using JitFallback = uint32_t (*)(JitFrame* frame, uint32_t opcode, uint32_t address, uint32_t position);
+
+// Translates basic blocks (see ends_block()) into x86-64 machine code. Within a block the data registers and the
+// index register live in host registers, arithmetic, loads, jumps and skips are translated directly and everything
+// else goes through the fallback so the interpreter's handlers stay the only definition of those instructions. The
+// same goes for instructions that the quirk profile makes behave differently from the default one.
+// Blocks that end in a jump, skip or plain fall through to a known address jump straight into the block compiled
+// there, so tight loops run without returning to the caller until frame->chain_limit is reached.
+//
+// Compiled code returns the first non-zero action the fallback returned, or 0, with the pc and the number of
+// instructions executed left in the frame. Only available on x86-64 with POSIX mmap, see supported().
+class JitCompiler {
+public:
+    using NativeBlock = uint32_t (*)(JitFrame* frame);
+
+    struct CompiledBlock {
+        NativeBlock code; // null if the block has no instruction worth translating, run it in the interpreter
+        uint32_t length;  // 0 until the block has been compiled
+    };
+
+    JitCompiler(JitFallback fallback, const Quirks& quirks);
+    ~JitCompiler();
+    JitCompiler(const JitCompiler&) = delete;
+    JitCompiler& operator=(const JitCompiler&) = delete;
+
+    [[nodiscard]] static bool supported() noexcept;
+
+    // Compiled code is thrown away every time a rom writes over it. A rom that keeps doing that is better off in the
+    // interpreter, so after too many of those flushes the compiler disables itself. It does the same when the kernel
+    // does not let it make its code buffer writable or executable.
+    [[nodiscard]] bool enabled() const noexcept { return code_flushes < max_code_flushes && code_buffer != nullptr; }
+
+    // returns the block at address, compiling it from memory first if needed. Past the end of memory there is a
+    // single untranslated instruction, which crashes in the interpreter.
+    const CompiledBlock& get(const uint8_t* memory, uint16_t address) {
+        static constexpr CompiledBlock outside_memory{ nullptr, 1 };
+        if (address >= memory_size)
+            return outside_memory;
+        if (compiled_at.empty() || compiled_at[address].block.length == 0)
+            compile(memory, address);
+        return compiled_at[address].block;
+    }
+
+    // must be called whenever memory is written, throws away all compiled code if the write overlaps any of it
+    void invalidate(uint16_t address, size_t length) noexcept {
+        if (address >= code_end || address + length <= code_begin)
+            return;
+        for (size_t i = address; i < address + length && i < memory_size; ++i) {
+            if (code[i]) {
+                clear();
+                code_flushes++;
+                return;
+            }
+        }
+    }
+
+private:
+    static constexpr size_t memory_size      = 4096;
+    static constexpr size_t code_buffer_size = 256 * 1024;
+    static constexpr int max_code_flushes    = 16;
+
+    JitFallback fallback;
+    Quirks quirks;
+    uint8_t* code_buffer = nullptr; // mmap'd, only ever writable or executable, never both
+    size_t code_used     = 0;
+    struct Slot {
+        CompiledBlock block;
+        const uint8_t* chain_entry; // where blocks jumping here continue, past the prologue
+    };
+    struct Link {
+        uint16_t target;
+        size_t offset; // of the rel32 to patch in code_buffer
+    };
+
+    std::vector<Slot> compiled_at;
+    std::vector<Link> pending_links; // chained jumps to blocks that are not compiled yet
+    std::bitset<memory_size> code; // every byte of chip8 memory that compiled code was translated from
+    size_t code_begin = memory_size;
+    size_t code_end   = 0;
+    int code_flushes  = 0;
+
+    void compile(const uint8_t* memory, uint16_t address);
+    void link(size_t offset, const uint8_t* target) noexcept;
+    void clear() noexcept;
+};
@@ -0,0 +1,335 @@
+#include "Lockstep.h"
+
+#include "BlockCache.h"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#    define CHIP8_LOCKSTEP_SSE2 1
+#    include <emmintrin.h>
+#else
+#    define CHIP8_LOCKSTEP_SSE2 0
+#endif
+
+namespace
+{
+
+constexpr uint8_t vf_index = 15;
+
+// One byte for each of the 16 lanes. Masks have all bits of a lane set or clear.
+#if CHIP8_LOCKSTEP_SSE2
+using Lanes = __m128i;
+
+Lanes load(const std::array<uint8_t, 16>& bytes) {
+    Lanes lanes;
+    std::memcpy(&lanes, bytes.data(), sizeof(lanes));
+    return lanes;
+}
+void store(std::array<uint8_t, 16>& bytes, Lanes lanes) { std::memcpy(bytes.data(), &lanes, sizeof(lanes)); }
+Lanes splat(uint8_t value) { return _mm_set1_epi8(static_cast<char>(value)); }
+Lanes add(Lanes a, Lanes b) { return _mm_add_epi8(a, b); }
+Lanes sub(Lanes a, Lanes b) { return _mm_sub_epi8(a, b); }
+Lanes bit_and(Lanes a, Lanes b) { return _mm_and_si128(a, b); }
+Lanes bit_or(Lanes a, Lanes b) { return _mm_or_si128(a, b); }
+Lanes bit_xor(Lanes a, Lanes b) { return _mm_xor_si128(a, b); }
+Lanes equal(Lanes a, Lanes b) { return _mm_cmpeq_epi8(a, b); }
+Lanes max_unsigned(Lanes a, Lanes b) { return _mm_max_epu8(a, b); }
+// there is no 8 bit shift, shift 16 bit lanes and drop what crossed over from the neighbouring byte
+Lanes shift_right_one(Lanes a) { return _mm_and_si128(_mm_srli_epi16(a, 1), _mm_set1_epi8(0x7F)); }
+Lanes select(Lanes mask, Lanes a, Lanes b) { return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b)); }
+uint32_t mask_bits(Lanes mask) { return static_cast<uint32_t>(_mm_movemask_epi8(mask)); }
+#else
+struct Lanes {
+    std::array<uint8_t, 16> bytes;
+};
+
+template <typename Operation>
+Lanes each(Lanes a, Lanes b, Operation operation) {
+    Lanes result;
+    for (size_t i = 0; i < 16; ++i)
+        result.bytes[i] = static_cast<uint8_t>(operation(a.bytes[i], b.bytes[i]));
+    return result;
+}
+
+Lanes load(const std::array<uint8_t, 16>& bytes) { return { bytes }; }
+void store(std::array<uint8_t, 16>& bytes, Lanes lanes) { bytes = lanes.bytes; }
+Lanes splat(uint8_t value) {
+    Lanes lanes;
+    lanes.bytes.fill(value);
+    return lanes;
+}
+Lanes add(Lanes a, Lanes b) { return each(a, b, [](uint8_t x, uint8_t y) { return x + y; }); }
+Lanes sub(Lanes a, Lanes b) { return each(a, b, [](uint8_t x, uint8_t y) { return x - y; }); }
+Lanes bit_and(Lanes a, Lanes b) { return each(a, b, [](uint8_t x, uint8_t y) { return x & y; }); }
+Lanes bit_or(Lanes a, Lanes b) { return each(a, b, [](uint8_t x, uint8_t y) { return x | y; }); }
+Lanes bit_xor(Lanes a, Lanes b) { return each(a, b, [](uint8_t x, uint8_t y) { return x ^ y; }); }
+Lanes equal(Lanes a, Lanes b) { return each(a, b, [](uint8_t x, uint8_t y) { return x == y ? 0xFF : 0; }); }
+Lanes max_unsigned(Lanes a, Lanes b) { return each(a, b, [](uint8_t x, uint8_t y) { return std::max(x, y); }); }
+Lanes shift_right_one(Lanes a) { return each(a, a, [](uint8_t x, uint8_t) { return x >> 1; }); }
+Lanes select(Lanes mask, Lanes a, Lanes b) {
+    return each(bit_and(mask, a), each(mask, b, [](uint8_t m, uint8_t y) { return ~m & y; }),
+                [](uint8_t x, uint8_t y) { return x | y; });
+}
+uint32_t mask_bits(Lanes mask) {
+    uint32_t bits = 0;
+    for (size_t i = 0; i < 16; ++i)
+        bits |= static_cast<uint32_t>(mask.bytes[i] >> 7) << i;
+    return bits;
+}
+#endif
+
+Lanes lane_mask(uint32_t lanes) {
+    std::array<uint8_t, 16> bytes{};
+    for (size_t i = 0; i < bytes.size(); ++i)
+        bytes[i] = (lanes >> i) & 1 ? 0xFF : 0x00;
+    return load(bytes);
+}
+
+} // namespace
+
+LockstepGroup::LockstepGroup(Chip8Emulator* const* lane_machines, size_t count)
+    : lane_count(std::min(count, max_lanes)) {
+    if (lane_count == 0)
+        return;
+
+    reference = lane_machines[0]->memory_contents();
+    quirks    = quirks_of(lane_machines[0]->quirk_profile());
+    for (size_t lane = 0; lane < lane_count; ++lane) {
+        machines[lane]     = lane_machines[lane];
+        statuses[lane]     = LaneStatus::Running;
+        frame_length[lane] = machines[lane]->cycles_per_frame();
+        scatter(lane, machines[lane]->cpu_state());
+        if (machines[lane]->memory_contents() != reference || machines[lane]->quirk_profile() != lane_machines[0]->quirk_profile())
+            solo_lanes |= 1u << lane;
+    }
+    block_at.resize(memory_size);
+}
+
+void LockstepGroup::run(uint64_t instructions_per_lane, std::optional<uint8_t> wait_key) {
+    std::array<uint64_t, max_lanes> last_cycle{};
+    for (size_t lane = 0; lane < lane_count; ++lane)
+        last_cycle[lane] = cycles[lane] + instructions_per_lane;
+
+    while (true) {
+        // the lane furthest behind leads, every other lane at the same pc comes along
+        uint32_t active = 0;
+        size_t leader   = max_lanes;
+        for (size_t lane = 0; lane < lane_count; ++lane) {
+            if (statuses[lane] != LaneStatus::Running)
+                continue;
+            if (cycles[lane] >= last_cycle[lane]) {
+                statuses[lane] = LaneStatus::BudgetReached;
+                continue;
+            }
+            active |= 1u << lane;
+            if (leader == max_lanes || cycles[lane] < cycles[leader])
+                leader = lane;
+        }
+        if (active == 0)
+            break;
+
+        const uint16_t address = pc[leader];
+        const Block found      = ((solo_lanes >> leader) & 1) == 0 ? block(address) : Block{ 0, 0 };
+        uint32_t together      = 0;
+        if (found.length != 0) {
+            for (size_t lane = 0; lane < lane_count; ++lane) {
+                // a block always runs to its end, lanes without the budget for it finish one instruction at a time
+                if (((active & ~solo_lanes) >> lane) & 1 && pc[lane] == address && last_cycle[lane] - cycles[lane] >= found.length)
+                    together |= 1u << lane;
+            }
+        }
+
+        if ((together >> leader) & 1) {
+            execute_block(found, together);
+        } else {
+            // lanes are independent machines, so all of them at this pc may take their one step in one pass
+            for (size_t lane = 0; lane < lane_count; ++lane) {
+                if ((active >> lane) & 1 && pc[lane] == address)
+                    step_alone(lane, wait_key);
+            }
+        }
+    }
+
+    for (size_t lane = 0; lane < lane_count; ++lane)
+        machines[lane]->set_cpu_state(gather(lane));
+}
+
+LockstepGroup::Block LockstepGroup::block(uint16_t address) {
+    if (size_t(address + 1) >= memory_size)
+        return { 0, 0 };
+    if (built[address])
+        return block_at[address];
+
+    // the longest run of lockstep instructions that nobody has written over, possibly empty
+    const auto first = static_cast<uint32_t>(instructions.size());
+    for (size_t at = address; at + 1 < memory_size && instructions.size() - first < BlockCache::max_block_length; at += 2) {
+        if (written[at] || written[at + 1])
+            break;
+        const Instruction& instruction = decoded(static_cast<uint16_t>((reference[at] << 8) | reference[at + 1]));
+        if (!is_register_only(instruction, at) || differs_from_default(quirks, instruction.op))
+            break;
+        instructions.push_back(instruction);
+        code[at]     = true;
+        code[at + 1] = true;
+        if (ends_block(instruction.op))
+            break;
+    }
+
+    block_at[address] = { first, static_cast<uint32_t>(instructions.size() - first) };
+    built[address]    = true;
+    return block_at[address];
+}
+
+void LockstepGroup::execute_block(Block found, uint32_t lanes) {
+    const Lanes mask = lane_mask(lanes);
+    const Lanes one  = splat(1);
+    Lanes regs[16]; // a plain array, std::array would drop the vector type's alignment attributes
+    for (size_t reg = 0; reg < v.size(); ++reg)
+        regs[reg] = load(v[reg]);
+
+    const Instruction* block_instructions = instructions.data() + found.first;
+    uint16_t start                        = 0;
+    for (size_t lane = 0; lane < lane_count; ++lane) {
+        if ((lanes >> lane) & 1) {
+            start = pc[lane];
+            break;
+        }
+    }
+    uint32_t skipping                     = 0;
+    for (size_t k = 0; k < found.length; ++k) {
+        const Instruction& instruction = block_instructions[k];
+        Lanes& x                       = regs[instruction.x];
+        const Lanes y                  = regs[instruction.y];
+        Lanes& vf                      = regs[vf_index];
+        switch (instruction.op) {
+        case Op::LdByte: x = select(mask, splat(instruction.kk), x); break;
+        case Op::Add: x = select(mask, add(x, splat(instruction.kk)), x); break;
+        case Op::LdReg: x = select(mask, y, x); break;
+        case Op::Or: x = select(mask, bit_or(x, y), x); break;
+        case Op::And: x = select(mask, bit_and(x, y), x); break;
+        case Op::Xor: x = select(mask, bit_xor(x, y), x); break;
+        // VF is written after Vx, as in the handlers, so it holds the flag when x is 15
+        case Op::AddReg: {
+            const Lanes old = x;
+            const Lanes sum = add(old, y);
+            x               = select(mask, sum, old);
+            vf              = select(mask, bit_and(bit_xor(equal(max_unsigned(sum, old), sum), splat(0xFF)), one), vf);
+            break;
+        }
+        case Op::Sub:
+        case Op::Subn: {
+            const Lanes old        = x;
+            const Lanes difference = instruction.op == Op::Sub ? sub(old, y) : sub(y, old);
+            x                      = select(mask, difference, old);
+            vf                     = select(mask, bit_and(equal(max_unsigned(difference, old), old), one), vf);
+            break;
+        }
+        // while VF is written before the shift, so shifting VF itself shifts the flag
+        case Op::Shr:
+            vf = select(mask, bit_and(x, one), vf);
+            x  = select(mask, shift_right_one(x), x);
+            break;
+        case Op::Shl:
+            vf = select(mask, bit_and(x, splat(0x80)), vf);
+            x  = select(mask, add(x, x), x);
+            break;
+        case Op::LdAddr:
+            for (size_t lane = 0; lane < lane_count; ++lane) {
+                if ((lanes >> lane) & 1)
+                    index[lane] = instruction.nnn;
+            }
+            break;
+        case Op::AddIdxReg: {
+            std::array<uint8_t, 16> values;
+            store(values, x);
+            for (size_t lane = 0; lane < lane_count; ++lane) {
+                if ((lanes >> lane) & 1)
+                    index[lane] = static_cast<uint16_t>(index[lane] + values[lane]);
+            }
+            break;
+        }
+        case Op::SeByte: skipping = mask_bits(equal(x, splat(instruction.kk))) & lanes; break;
+        case Op::Sne: skipping = ~mask_bits(equal(x, splat(instruction.kk))) & lanes; break;
+        case Op::SeReg: skipping = mask_bits(equal(x, y)) & lanes; break;
+        case Op::SneReg: skipping = ~mask_bits(equal(x, y)) & lanes; break;
+        default: break; // Sys, and Jp which only changes the pc below
+        }
+    }
+
+    for (size_t reg = 0; reg < v.size(); ++reg)
+        store(v[reg], regs[reg]);
+
+    const Instruction& last = block_instructions[found.length - 1];
+    const auto next         = static_cast<uint16_t>(start + 2 * found.length);
+    for (size_t lane = 0; lane < lane_count; ++lane) {
+        if (((lanes >> lane) & 1) == 0)
+            continue;
+        pc[lane] = last.op == Op::Jp ? last.nnn : static_cast<uint16_t>(next + ((skipping >> lane) & 1) * 2);
+
+        const uint64_t decrements = (cycles[lane] + found.length) / frame_length[lane] - cycles[lane] / frame_length[lane];
+        cycles[lane] += found.length;
+        delay_timer[lane] = decrements >= delay_timer[lane] ? 0 : static_cast<uint8_t>(delay_timer[lane] - decrements);
+        sound_timer[lane] = decrements >= sound_timer[lane] ? 0 : static_cast<uint8_t>(sound_timer[lane] - decrements);
+    }
+}
+
+void LockstepGroup::step_alone(size_t lane, std::optional<uint8_t> wait_key) {
+    Chip8Emulator& machine = *machines[lane];
+    machine.set_cpu_state(gather(lane));
+
+    const auto& memory = machine.memory_contents();
+    if (size_t(pc[lane] + 1) < memory_size)
+        note_writes(decoded(static_cast<uint16_t>((memory[pc[lane]] << 8) | memory[pc[lane] + 1])), lane);
+
+    const Chip8Emulator::Action action = machine.process_next_instruction();
+    if (action == Chip8Emulator::Action::WaitForInput && wait_key)
+        machine.key_pressed_upon_wait(*wait_key);
+    scatter(lane, machine.cpu_state());
+
+    if (action == Chip8Emulator::Action::Crash)
+        statuses[lane] = LaneStatus::Crashed;
+    else if (action == Chip8Emulator::Action::WaitForInput && !wait_key)
+        statuses[lane] = LaneStatus::WaitingForInput;
+}
+
+void LockstepGroup::note_writes(const Instruction& instruction, size_t lane) {
+    size_t length = 0;
+    if (instruction.op == Op::LdBcd)
+        length = 3;
+    else if (instruction.op == Op::LdRegDump)
+        length = instruction.x + 1u;
+
+    bool overwrites_code = false;
+    for (size_t i = index[lane]; i < index[lane] + length && i < memory_size; ++i) {
+        written[i] = true;
+        overwrites_code |= code[i];
+    }
+    if (overwrites_code) {
+        built.reset();
+        code.reset();
+        instructions.clear();
+    }
+}
+
+Chip8Emulator::CpuState LockstepGroup::gather(size_t lane) const noexcept {
+    Chip8Emulator::CpuState state{};
+    for (size_t reg = 0; reg < v.size(); ++reg)
+        state.registers[reg] = v[reg][lane];
+    state.index       = index[lane];
+    state.pc          = pc[lane];
+    state.delay_timer = delay_timer[lane];
+    state.sound_timer = sound_timer[lane];
+    state.cycles      = cycles[lane];
+    return state;
+}
+
+void LockstepGroup::scatter(size_t lane, const Chip8Emulator::CpuState& state) noexcept {
+    for (size_t reg = 0; reg < v.size(); ++reg)
+        v[reg][lane] = state.registers[reg];
+    index[lane]       = state.index;
+    pc[lane]          = state.pc;
+    delay_timer[lane] = state.delay_timer;
+    sound_timer[lane] = state.sound_timer;
+    cycles[lane]      = state.cycles;
+}
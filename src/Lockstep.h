@@ -0,0 +1,80 @@
+#pragma once
+
+#include <array>
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+#include "Chip8Emulator.h"
+#include "Instruction.h"
+#include "Quirks.h"
+
+// Runs up to 16 machines (lanes) that were loaded with the same rom side by side, for sweeps that only differ in
+// their random numbers or input. The registers, index, pc, timers and cycle counts of all lanes are kept as
+// structure of arrays, and whenever lanes are at the same pc the arithmetic, loads, jumps and skips of the block
+// there run for all of them at once, one 16 byte SIMD operation per instruction with lanes at other pcs masked off.
+// Anything else runs on the lane's own Chip8Emulator through its handlers, one instruction at a time, and so do
+// instructions that the machines' quirk profile makes behave differently from the default one.
+class LockstepGroup {
+public:
+    static constexpr size_t max_lanes = 16;
+
+    enum class LaneStatus : uint8_t {
+        Running,
+        BudgetReached,
+        WaitingForInput,
+        Crashed
+    };
+
+    // The machines must outlive the group. One whose memory or quirk profile differs from the first machine's is
+    // never run in lockstep with the others.
+    LockstepGroup(Chip8Emulator* const* machines, size_t count);
+
+    // Runs every lane until it has executed instructions_per_lane more instructions, crashes or waits for input that
+    // wait_key does not answer, then moves the lanes' state back into their machines.
+    void run(uint64_t instructions_per_lane, std::optional<uint8_t> wait_key);
+
+    LaneStatus status(size_t lane) const noexcept { return statuses[lane]; }
+
+private:
+    static constexpr size_t memory_size = 4096;
+
+    struct Block {
+        uint32_t first;
+        uint32_t length;
+    };
+
+    std::array<Chip8Emulator*, max_lanes> machines{};
+    size_t lane_count = 0;
+    uint32_t solo_lanes = 0; // lanes that started with different memory or quirks
+    Quirks quirks{};         // of the first machine, shared by every lane that is not solo
+    std::array<LaneStatus, max_lanes> statuses{};
+
+    // structure of arrays, v[register][lane]
+    alignas(16) std::array<std::array<uint8_t, max_lanes>, 16> v{};
+    std::array<uint16_t, max_lanes> index{};
+    std::array<uint16_t, max_lanes> pc{};
+    std::array<uint8_t, max_lanes> delay_timer{};
+    std::array<uint8_t, max_lanes> sound_timer{};
+    std::array<uint64_t, max_lanes> cycles{};
+    std::array<uint64_t, max_lanes> frame_length{}; // Chip8Emulator::cycles_per_frame()
+
+    // Memory as the rom loaded it. Lanes only ever differ from it where some lane wrote to memory, blocks are only
+    // built from bytes nobody wrote to so that they are valid for every lane.
+    std::array<uint8_t, memory_size> reference{};
+    std::bitset<memory_size> written;
+    std::bitset<memory_size> code; // bytes that cached blocks were built from
+    std::vector<Block> block_at;   // by start address, only valid where built is set
+    std::bitset<memory_size> built;
+    std::vector<Instruction> instructions;
+
+    Block block(uint16_t address);
+    void execute_block(Block block, uint32_t lanes);
+    void step_alone(size_t lane, std::optional<uint8_t> wait_key);
+    void note_writes(const Instruction& instruction, size_t lane);
+
+    Chip8Emulator::CpuState gather(size_t lane) const noexcept;
+    void scatter(size_t lane, const Chip8Emulator::CpuState& state) noexcept;
+};
@@ -0,0 +1,143 @@
+#include "Movie.h"
+
+#include <iterator>
+
+namespace
+{
+
+// 64 bit FNV-1a, enough to tell roms apart
+uint64_t hash_rom(const uint8_t* rom, size_t size) noexcept {
+    uint64_t hash = 0xCBF29CE484222325;
+    for (size_t i = 0; i < size; ++i)
+        hash = (hash ^ rom[i]) * 0x100000001B3;
+    return hash;
+}
+
+} // namespace
+
+MovieHeader movie_header(const uint8_t* rom, size_t size, uint64_t seed, uint32_t clock_hz, QuirkProfile quirks) noexcept {
+    MovieHeader header{};
+    header.magic    = MovieHeader::expected_magic;
+    header.version  = MovieHeader::current_version;
+    header.clock_hz = clock_hz;
+    header.seed     = seed;
+    header.rom_hash = hash_rom(rom, size);
+    header.rom_size = static_cast<uint32_t>(size);
+    header.profile  = static_cast<uint8_t>(quirks);
+    return header;
+}
+
+Movie load_movie(const std::string& path) {
+    std::ifstream file(path, std::ios_base::binary);
+    if (!file.is_open())
+        throw std::runtime_error("Could not find movie " + path);
+
+    Movie movie{};
+    file.read(reinterpret_cast<char*>(&movie.header), sizeof(movie.header));
+    if (!file || movie.header.magic != MovieHeader::expected_magic)
+        throw std::runtime_error(path + " is not a movie");
+    if (movie.header.version != MovieHeader::current_version || movie.header.profile > static_cast<uint8_t>(QuirkProfile::Schip))
+        throw std::runtime_error("movie " + path + " was written by an incompatible version");
+
+    const std::vector<uint8_t> bytes{ std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>() };
+    uint64_t cycle = 0;
+    for (size_t position = 0; position < bytes.size();) {
+        uint64_t delta = 0;
+        for (unsigned shift = 0;; shift += 7) {
+            if (position == bytes.size() || shift > 63)
+                throw std::runtime_error("movie " + path + " is corrupt");
+            const uint8_t byte = bytes[position++];
+            delta |= uint64_t{ byte & 0x7Fu } << shift;
+            if ((byte & 0x80) == 0)
+                break;
+        }
+        if (position == bytes.size())
+            throw std::runtime_error("movie " + path + " is corrupt");
+        const uint8_t event = bytes[position++];
+        const auto kind     = static_cast<MovieEventKind>(event >> 4);
+        cycle += delta;
+
+        if (kind == MovieEventKind::End) {
+            if (position != bytes.size())
+                throw std::runtime_error("movie " + path + " has trailing data");
+            movie.length = cycle;
+            return movie;
+        }
+        if (kind > MovieEventKind::End)
+            throw std::runtime_error("movie " + path + " is corrupt");
+        movie.events.push_back({ cycle, kind, static_cast<uint8_t>(event & 0xF) });
+    }
+    throw std::runtime_error("movie " + path + " is truncated");
+}
+
+MovieRecorder::MovieRecorder(const std::string& movie_path, const MovieHeader& header)
+    : path(movie_path),
+      file(movie_path, std::ios_base::binary | std::ios_base::trunc) {
+    if (!file.is_open())
+        throw std::runtime_error("Could not create movie " + path);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+}
+
+MovieRecorder::~MovieRecorder() {
+    try {
+        if (!finished())
+            finish(last_cycle);
+    } catch (const std::exception&) {
+        // nothing to report to from a destructor, a movie cut short fails to load instead
+    }
+}
+
+void MovieRecorder::keys(uint64_t cycle, const std::array<bool, 16>& buttons) {
+    for (uint8_t key = 0; key < buttons.size(); ++key) {
+        if (buttons[key] != held[key])
+            write(cycle, buttons[key] ? MovieEventKind::Press : MovieEventKind::Release, key);
+    }
+    held = buttons;
+}
+
+void MovieRecorder::answered(uint64_t cycle, uint8_t key) {
+    write(cycle, MovieEventKind::Answer, key);
+}
+
+void MovieRecorder::finish(uint64_t cycle) {
+    write(cycle, MovieEventKind::End, 0);
+    file.close();
+    if (!file)
+        throw std::runtime_error("Could not write movie " + path);
+}
+
+void MovieRecorder::write(uint64_t cycle, MovieEventKind kind, uint8_t key) {
+    uint8_t bytes[11];
+    size_t length  = 0;
+    uint64_t delta = cycle - last_cycle;
+    while (delta >= 0x80) {
+        bytes[length++] = static_cast<uint8_t>(delta | 0x80);
+        delta >>= 7;
+    }
+    bytes[length++] = static_cast<uint8_t>(delta);
+    bytes[length++] = static_cast<uint8_t>(static_cast<uint8_t>(kind) << 4 | key);
+    file.write(reinterpret_cast<const char*>(bytes), static_cast<std::streamsize>(length));
+    last_cycle = cycle;
+}
+
+void MoviePlayer::check_rom(const uint8_t* rom, size_t size) const {
+    if (size != movie.header.rom_size || hash_rom(rom, size) != movie.header.rom_hash)
+        throw std::runtime_error("The movie was recorded with a different rom");
+}
+
+void MoviePlayer::press_due(Chip8Emulator& emulator) noexcept {
+    for (; !done() && movie.events[next].cycle == emulator.cycles(); ++next) {
+        const MovieEvent& event = movie.events[next];
+        if (event.kind == MovieEventKind::Answer)
+            return;
+        emulator.input_buttons()[event.key] = event.kind == MovieEventKind::Press;
+    }
+}
+
+bool MoviePlayer::answer(Chip8Emulator& emulator) noexcept {
+    press_due(emulator);
+    if (done() || movie.events[next].cycle != emulator.cycles())
+        return false;
+    emulator.key_pressed_upon_wait(movie.events[next++].key);
+    return true;
+}
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "Chip8Emulator.h"
+#include "Quirks.h"
+
+// A movie file is a MovieHeader followed by the events of a run, each a LEB128 number of instructions executed since
+// the event before it (or since power on) and a byte with the MovieEventKind in the high four bits and the key in the
+// low four. Most events take two bytes. The last event is always an End.
+struct MovieHeader {
+    static constexpr std::array<char, 8> expected_magic = { 'C', 'H', 'I', 'P', '8', 'M', 'O', 'V' };
+    static constexpr uint32_t current_version           = 1;
+
+    std::array<char, 8> magic;
+    uint32_t version;
+    uint32_t clock_hz;
+    uint64_t seed;
+    uint64_t rom_hash; // see movie_header(), replays check it against the rom they are given
+    uint32_t rom_size;
+    uint8_t profile;               // QuirkProfile
+    std::array<uint8_t, 3> unused; // always 0
+};
+static_assert(std::is_trivially_copyable_v<MovieHeader>, "movie headers are written as raw bytes");
+static_assert(std::has_unique_object_representations_v<MovieHeader>, "movie headers must not contain padding");
+
+enum class MovieEventKind : uint8_t {
+    Press,   // a key went down
+    Release, // a key went up
+    Answer,  // Fx0A got the key
+    End      // the recording stopped
+};
+
+struct MovieEvent {
+    uint64_t cycle; // Chip8Emulator::cycles() when it happened
+    MovieEventKind kind;
+    uint8_t key;
+};
+
+struct Movie {
+    MovieHeader header;
+    std::vector<MovieEvent> events; // by cycle, without the End
+    uint64_t length;                // the cycle of the End
+};
+
+// The header for a run of rom from power on with the given seed, clock speed and quirks
+MovieHeader movie_header(const uint8_t* rom, size_t size, uint64_t seed, uint32_t clock_hz, QuirkProfile quirks) noexcept;
+
+// Reads a movie written by MovieRecorder. Throws std::runtime_error if the file cannot be read, is not a movie of
+// this version or is cut off before its End.
+Movie load_movie(const std::string& path);
+
+// Writes the input of a run to a movie file as it happens. Call keys() whenever the frontend has set the emulator's
+// input_buttons() and answered() whenever it has called key_pressed_upon_wait(), both with the emulator's cycle count,
+// which must never go back.
+class MovieRecorder {
+public:
+    // Throws std::runtime_error if path cannot be created
+    MovieRecorder(const std::string& path, const MovieHeader& header);
+    MovieRecorder(const MovieRecorder&)            = delete;
+    MovieRecorder& operator=(const MovieRecorder&) = delete;
+    // finishes the movie at the last cycle recorded if finish() was not called
+    ~MovieRecorder();
+
+    // records a press or release for every key that changed since the last call, all keys start out released
+    void keys(uint64_t cycle, const std::array<bool, 16>& buttons);
+    void answered(uint64_t cycle, uint8_t key);
+    // Writes the End at cycle and closes the file. Throws std::runtime_error if the movie could not be written.
+    void finish(uint64_t cycle);
+    bool finished() const noexcept { return !file.is_open(); }
+
+private:
+    std::string path;
+    std::ofstream file;
+    uint64_t last_cycle = 0;
+    std::array<bool, 16> held{};
+
+    void write(uint64_t cycle, MovieEventKind kind, uint8_t key);
+};
+
+// Feeds the events of a movie to an emulator started from power on with the seed, clock speed and quirks of its
+// header, see check_rom(). Runs are split at every event so that each one happens at exactly the recorded cycle
+// whatever the engine, which makes a replay reproduce the recorded run instruction for instruction.
+class MoviePlayer {
+public:
+    explicit MoviePlayer(Movie played) noexcept
+        : movie(std::move(played)) {}
+
+    // Throws std::runtime_error if rom is not the one the movie was recorded with
+    void check_rom(const uint8_t* rom, size_t size) const;
+
+    // whether every event has been played, the run may still go on with the keys as they were left
+    bool done() const noexcept { return next == movie.events.size(); }
+    const MovieHeader& header() const noexcept { return movie.header; }
+    uint64_t length() const noexcept { return movie.length; }
+
+    // Runs emulator up to last_cycle with run_some(budget), which runs at most budget instructions with any engine
+    // and returns the action of the last one, pressing, releasing and answering Fx0A as the movie does. Returns
+    // Crash, WaitForInput for a wait that the movie does not answer, or DoNothing once last_cycle is reached. Throws
+    // std::runtime_error if the movie answers a wait that the run does not have, then it belongs to another run.
+    template <typename RunSome>
+    Chip8Emulator::Action run(Chip8Emulator& emulator, uint64_t last_cycle, RunSome&& run_some) {
+        while (emulator.cycles() < last_cycle) {
+            press_due(emulator);
+            const uint64_t next_cycle = done() ? std::numeric_limits<uint64_t>::max() : movie.events[next].cycle;
+            if (next_cycle <= emulator.cycles())
+                throw std::runtime_error("The movie answers a key wait at cycle " + std::to_string(next_cycle) + " that the run does not have");
+
+            const Chip8Emulator::Action action = run_some(std::min(last_cycle, next_cycle) - emulator.cycles());
+            if (action == Chip8Emulator::Action::Crash)
+                return action;
+            if (action == Chip8Emulator::Action::WaitForInput && !answer(emulator))
+                return action;
+        }
+        return Chip8Emulator::Action::DoNothing;
+    }
+
+private:
+    Movie movie;
+    size_t next = 0; // the event that is due next
+
+    // the presses and releases due at the emulator's cycle count, up to the next answer
+    void press_due(Chip8Emulator& emulator) noexcept;
+    // answers the wait the emulator just started if the movie does so now
+    bool answer(Chip8Emulator& emulator) noexcept;
+};
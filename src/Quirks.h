@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string_view>
+
+#include "Instruction.h"
+
+// The instructions that the original interpreters disagree on, and how a profile runs each of them
+enum class IndexAdvance : uint8_t {
+    None,      // Fx55 and Fx65 leave I alone
+    ByX,       // I ends up on the last register's byte, as on the HP48 CHIP-48
+    ByXPlusOne // I ends up past the last register's byte, as on the COSMAC VIP
+};
+
+struct Quirks {
+    bool shift_reads_vy;             // 8xy6 and 8xyE shift Vy into Vx instead of shifting Vx in place
+    bool logic_resets_vf;            // 8xy1, 8xy2 and 8xy3 clear VF
+    IndexAdvance load_store_advance; // what Fx55 and Fx65 do to I
+    bool clip_sprites;               // Dxyn cuts sprites off at the edges instead of wrapping them around
+    bool jump_reads_vx;              // Bxnn jumps to xnn + Vx instead of nnn + V0
+};
+
+// The profiles selected with --profile. Default is what this emulator has always done, and what roms written for
+// it (and the regression manifests) expect.
+enum class QuirkProfile {
+    Default,
+    CosmacVip,
+    Chip48,
+    Schip
+};
+
+constexpr Quirks quirks_of(QuirkProfile profile) noexcept {
+    switch (profile) {
+    case QuirkProfile::CosmacVip: return { true, true, IndexAdvance::ByXPlusOne, true, false };
+    case QuirkProfile::Chip48: return { false, false, IndexAdvance::ByX, true, true };
+    case QuirkProfile::Schip: return { false, false, IndexAdvance::None, true, true };
+    case QuirkProfile::Default: break;
+    }
+    return { false, false, IndexAdvance::None, false, false };
+}
+
+inline std::optional<QuirkProfile> parse_quirk_profile(std::string_view name) {
+    if (name == "default")
+        return QuirkProfile::Default;
+    if (name == "vip")
+        return QuirkProfile::CosmacVip;
+    if (name == "chip48")
+        return QuirkProfile::Chip48;
+    if (name == "schip")
+        return QuirkProfile::Schip;
+    return std::nullopt;
+}
+
+// Whether quirks make op behave differently from the default profile. Engines that implement instructions
+// themselves only do so for the default behaviour and leave these to the handlers.
+constexpr bool differs_from_default(const Quirks& quirks, Op op) noexcept {
+    switch (op) {
+    case Op::Shr:
+    case Op::Shl: return quirks.shift_reads_vy;
+    case Op::Or:
+    case Op::And:
+    case Op::Xor: return quirks.logic_resets_vf;
+    case Op::LdRegDump:
+    case Op::LdRegStore: return quirks.load_store_advance != IndexAdvance::None;
+    case Op::Drw: return quirks.clip_sprites;
+    case Op::JpOffset: return quirks.jump_reads_vx;
+    default: return false;
+    }
+}
+
+// The policy type the handlers are instantiated with, one per profile, so that every quirk is decided at compile time
+template <QuirkProfile Profile>
+struct QuirkPolicy {
+    static constexpr Quirks quirks = quirks_of(Profile);
+};
+
+// Calls function with the policy of profile. This is the one place a profile chosen at runtime turns into one of
+// the instantiations, callers do it once per run rather than once per instruction.
+template <typename Function>
+decltype(auto) with_quirk_policy(QuirkProfile profile, Function&& function) {
+    switch (profile) {
+    case QuirkProfile::CosmacVip: return function(QuirkPolicy<QuirkProfile::CosmacVip>{});
+    case QuirkProfile::Chip48: return function(QuirkPolicy<QuirkProfile::Chip48>{});
+    case QuirkProfile::Schip: return function(QuirkPolicy<QuirkProfile::Schip>{});
+    case QuirkProfile::Default: break;
+    }
+    return function(QuirkPolicy<QuirkProfile::Default>{});
+}
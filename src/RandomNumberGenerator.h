@@ -1,22 +1,52 @@
 #pragma once
 
-#include <random>
+#include <array>
+#include <cstdint>
 
+// xoshiro128** seeded through splitmix64. The whole state is 16 bytes and copies like any other value, the same seed
+// always produces the same sequence on every platform, and a byte costs a handful of shifts and xors.
 class RandomNumberGenerator {
 public:
-    RandomNumberGenerator()
-        : gen(rd()),
-          distrib(0, 255) {
+    using State = std::array<uint32_t, 4>;
+
+    explicit RandomNumberGenerator(uint64_t seed) noexcept {
+        reseed(seed);
+    }
+
+    void reseed(uint64_t seed) noexcept {
+        // splitmix64 spreads any seed, including 0, over a state that is never all zero
+        for (size_t i = 0; i < words.size(); i += 2) {
+            seed += 0x9E3779B97F4A7C15;
+            uint64_t z = seed;
+            z          = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9;
+            z          = (z ^ (z >> 27)) * 0x94D049BB133111EB;
+            z ^= z >> 31;
+            words[i]     = static_cast<uint32_t>(z);
+            words[i + 1] = static_cast<uint32_t>(z >> 32);
+        }
     }
 
-    uint8_t next() {
-        return static_cast<uint8_t>(distrib(gen));
+    uint8_t next() noexcept {
+        const uint32_t result = rotate_left(words[1] * 5, 7) * 9;
+        const uint32_t t      = words[1] << 9;
+        words[2] ^= words[0];
+        words[3] ^= words[1];
+        words[1] ^= words[2];
+        words[0] ^= words[3];
+        words[2] ^= t;
+        words[3] = rotate_left(words[3], 11);
+
+        // the high bits are the strongest
+        return static_cast<uint8_t>(result >> 24);
     }
 
+    const State& state() const noexcept { return words; }
+    void set_state(const State& new_state) noexcept { words = new_state; }
+
 private:
-    std::random_device rd;
-    std::mt19937 gen;
+    State words{};
 
-    // for some reason unsigned char is not a defined template parameter
-    std::uniform_int_distribution<uint16_t> distrib;
+    static constexpr uint32_t rotate_left(uint32_t value, int shift) noexcept {
+        return (value << shift) | (value >> (32 - shift));
+    }
 };
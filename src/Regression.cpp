@@ -0,0 +1,232 @@
+#include "Regression.h"
+
+#include "Chip8Emulator.h"
+#include "FrameHash.h"
+#include "Lockstep.h"
+#include "RomLoader.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+namespace
+{
+
+std::string format_hash(uint64_t hash) {
+    char text[17];
+    std::snprintf(text, sizeof(text), "%016llx", static_cast<unsigned long long>(hash));
+    return text;
+}
+
+// runs up to the end of the current frame like the frontend does, returns the action that stopped it early
+Chip8Emulator::Action run_frame(Chip8Emulator& emulator, Engine engine, bool lockstep) {
+    const uint64_t frame_length = emulator.cycles_per_frame();
+    const uint64_t frame_end    = (emulator.cycles() / frame_length + 1) * frame_length;
+    if (lockstep) {
+        // a group runs once, the keys and answers of the next frame need a new one
+        Chip8Emulator* const machine = &emulator;
+        LockstepGroup group(&machine, 1);
+        group.run(frame_end - emulator.cycles(), std::nullopt);
+        switch (group.status(0)) {
+        case LockstepGroup::LaneStatus::Crashed: return Chip8Emulator::Action::Crash;
+        case LockstepGroup::LaneStatus::WaitingForInput: return Chip8Emulator::Action::WaitForInput;
+        default: return Chip8Emulator::Action::DoNothing;
+        }
+    }
+    while (emulator.cycles() < frame_end) {
+        const Chip8Emulator::Action action = run_engine(emulator, engine, frame_end - emulator.cycles());
+        if (action == Chip8Emulator::Action::Crash || action == Chip8Emulator::Action::WaitForInput)
+            return action;
+    }
+    return Chip8Emulator::Action::DoNothing;
+}
+
+RegressionResult run_case(const RegressionCase& test, Engine engine, bool lockstep) {
+    RegressionResult result;
+    std::optional<Chip8Emulator> emulator;
+    try {
+        const RomFile rom(test.rom_path);
+        emulator.emplace(rom.begin(), rom.end(), test.seed);
+        if (test.clock_hz)
+            emulator->set_clock_speed(*test.clock_hz);
+        emulator->set_quirk_profile(test.profile);
+    } catch (const std::exception& e) {
+        result.error = e.what();
+        return result;
+    }
+
+    // the display only needs hashing again after a frame that drew something
+    uint64_t display_hash = frame_hash::display(emulator->display_rows(), emulator->hires());
+    uint64_t hash         = 0;
+    uint16_t held_keys    = 0;
+    bool waiting          = false;
+    uint64_t frame        = 1;
+    auto next_input       = test.inputs.begin();
+    result.hashes.reserve(test.checkpoints.size());
+    for (const RegressionCase::Checkpoint& checkpoint : test.checkpoints) {
+        for (; frame <= checkpoint.frame; ++frame) {
+            std::optional<uint8_t> pressed;
+            for (; next_input != test.inputs.end() && next_input->frame == frame; ++next_input) {
+                const auto bit = static_cast<uint16_t>(1u << next_input->key);
+                if (next_input->pressed) {
+                    held_keys |= bit;
+                    if (!pressed)
+                        pressed = next_input->key;
+                } else {
+                    held_keys &= static_cast<uint16_t>(~bit);
+                }
+            }
+
+            if (waiting && pressed) {
+                emulator->key_pressed_upon_wait(*pressed);
+                waiting = false;
+            }
+            if (!waiting && !result.crash_frame) {
+                for (size_t key = 0; key < emulator->input_buttons().size(); ++key)
+                    emulator->input_buttons()[key] = ((held_keys >> key) & 1) != 0;
+
+                const Chip8Emulator::Action action = run_frame(*emulator, engine, lockstep);
+                if (action == Chip8Emulator::Action::Crash)
+                    result.crash_frame = frame;
+                waiting = action == Chip8Emulator::Action::WaitForInput;
+            }
+
+            if (emulator->take_dirty_rows() != 0)
+                display_hash = frame_hash::display(emulator->display_rows(), emulator->hires());
+            hash = frame_hash::chain(hash, display_hash);
+        }
+        result.hashes.push_back(hash);
+    }
+    return result;
+}
+
+} // namespace
+
+RegressionManifest load_manifest(const std::string& path) {
+    std::ifstream file(path);
+    if (!file.is_open())
+        throw std::runtime_error("Could not find manifest " + path);
+
+    RegressionManifest manifest{ path, {}, {} };
+    const std::filesystem::path directory = std::filesystem::path(path).parent_path();
+    std::string line;
+    while (std::getline(file, line)) {
+        manifest.lines.push_back(line);
+        const size_t number = manifest.lines.size();
+        const auto error    = [&](const std::string& message) {
+            return std::runtime_error(path + ":" + std::to_string(number) + ": " + message);
+        };
+
+        std::istringstream words(line.substr(0, line.find('#')));
+        std::string directive;
+        if (!(words >> directive))
+            continue;
+
+        if (directive == "case") {
+            std::string name;
+            std::string rom;
+            if (!(words >> name >> rom))
+                throw error("expected 'case NAME ROM'");
+            RegressionCase& test = manifest.cases.emplace_back();
+            test.name            = name;
+            test.rom_path        = (directory / rom).string();
+        } else if (manifest.cases.empty()) {
+            throw error("'" + directive + "' before the first case");
+        } else if (directive == "seed") {
+            if (!(words >> manifest.cases.back().seed))
+                throw error("expected 'seed N'");
+        } else if (directive == "clock") {
+            uint32_t hz = 0;
+            if (!(words >> hz))
+                throw error("expected 'clock HZ'");
+            manifest.cases.back().clock_hz = hz;
+        } else if (directive == "profile") {
+            std::string name;
+            const std::optional<QuirkProfile> profile = words >> name ? parse_quirk_profile(name) : std::nullopt;
+            if (!profile)
+                throw error("expected 'profile NAME' with default, vip, chip48 or schip");
+            manifest.cases.back().profile = *profile;
+        } else if (directive == "press" || directive == "release") {
+            uint64_t frame   = 0;
+            unsigned int key = 0;
+            if (!(words >> frame >> std::hex >> key) || frame == 0 || key >= 16)
+                throw error("expected '" + directive + " FRAME KEY' with a frame from 1 and a key from 0 to F");
+            std::vector<RegressionCase::InputEvent>& inputs = manifest.cases.back().inputs;
+            if (!inputs.empty() && inputs.back().frame > frame)
+                throw error("input is out of frame order");
+            inputs.push_back({ frame, static_cast<uint8_t>(key), directive == "press" });
+        } else if (directive == "hash") {
+            uint64_t frame = 0;
+            if (!(words >> frame) || frame == 0)
+                throw error("expected 'hash FRAME [HASH]' with a frame from 1");
+            std::optional<uint64_t> expected;
+            if (uint64_t value = 0; words >> std::hex >> value)
+                expected = value;
+            std::vector<RegressionCase::Checkpoint>& checkpoints = manifest.cases.back().checkpoints;
+            if (!checkpoints.empty() && checkpoints.back().frame >= frame)
+                throw error("hashes are out of frame order");
+            checkpoints.push_back({ frame, expected, number - 1 });
+        } else {
+            throw error("unknown directive '" + directive + "'");
+        }
+
+        words.clear();
+        if (std::string rest; words >> rest)
+            throw error("unexpected '" + rest + "'");
+    }
+    return manifest;
+}
+
+std::vector<RegressionResult> run_regression(const RegressionManifest& manifest, Engine engine, bool lockstep, unsigned threads) {
+    std::vector<RegressionResult> results(manifest.cases.size());
+    if (results.empty())
+        return results;
+
+    // a case is long enough that handing them out one at a time costs nothing
+    std::atomic<size_t> next_case{ 0 };
+    const auto work = [&]() {
+        for (size_t i = next_case++; i < results.size(); i = next_case++)
+            results[i] = run_case(manifest.cases[i], engine, lockstep);
+    };
+
+    const unsigned hardware_threads = std::max(1u, std::thread::hardware_concurrency());
+    const size_t worker_count       = std::min<size_t>(threads != 0 ? threads : hardware_threads, results.size());
+    std::vector<std::thread> workers;
+    workers.reserve(worker_count - 1);
+    for (size_t i = 1; i < worker_count; ++i)
+        workers.emplace_back(work);
+    work();
+    for (std::thread& worker : workers)
+        worker.join();
+
+    return results;
+}
+
+void save_manifest(const RegressionManifest& manifest, const std::vector<RegressionResult>& results) {
+    std::vector<std::string> lines = manifest.lines;
+    for (size_t i = 0; i < manifest.cases.size(); ++i) {
+        const RegressionCase& test = manifest.cases[i];
+        for (size_t j = 0; j < results[i].hashes.size(); ++j) {
+            const RegressionCase::Checkpoint& checkpoint = test.checkpoints[j];
+            std::string& line                            = lines[checkpoint.line];
+            const size_t comment                         = line.find('#');
+            line = "hash " + std::to_string(checkpoint.frame) + " " + format_hash(results[i].hashes[j]) +
+                   (comment != std::string::npos ? " " + line.substr(comment) : "");
+        }
+    }
+
+    std::ofstream file(manifest.path, std::ios_base::trunc);
+    if (!file.is_open())
+        throw std::runtime_error("Could not create manifest " + manifest.path);
+    for (const std::string& line : lines)
+        file << line << '\n';
+    file.close();
+    if (!file)
+        throw std::runtime_error("Could not write manifest " + manifest.path);
+}
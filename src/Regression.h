@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "Engine.h"
+#include "Quirks.h"
+
+// One rom run with a fixed seed and scripted input, and the frames at which its display is checked
+struct RegressionCase {
+    struct InputEvent {
+        uint64_t frame; // applied before the frame runs
+        uint8_t key;
+        bool pressed;
+    };
+    struct Checkpoint {
+        uint64_t frame;                   // checked after the frame has run
+        std::optional<uint64_t> expected; // unset until it has been recorded
+        size_t line;                      // in the manifest, so that a recorded hash can be written back
+    };
+
+    std::string name;
+    std::string rom_path;
+    uint64_t seed = 0;
+    std::optional<uint32_t> clock_hz;
+    QuirkProfile profile = QuirkProfile::Default;
+    std::vector<InputEvent> inputs;      // in frame order
+    std::vector<Checkpoint> checkpoints; // in frame order
+};
+
+// A manifest is a text file with one directive per line, '#' starts a comment:
+//   case NAME ROM        starts a case, ROM is relative to the manifest
+//   seed N               seed for Cxkk (default 0)
+//   clock HZ             instructions per second (default Chip8Emulator::clock_speed_hz)
+//   profile NAME         quirk profile, default, vip, chip48 or schip (default default)
+//   press FRAME KEY      holds down key KEY (hex) from frame FRAME on, also answers an Fx0A waiting at that point
+//   release FRAME KEY    lets go of KEY from frame FRAME on
+//   hash FRAME [HASH]    the hash of all frames up to and including FRAME, see frame_hash::chain()
+// Frames count from 1 and pass at 60Hz whether the rom is running, waiting for a key or has crashed.
+struct RegressionManifest {
+    std::string path;
+    std::vector<std::string> lines; // as read, for writing recorded hashes back
+    std::vector<RegressionCase> cases;
+};
+
+// Throws std::runtime_error naming the line for a file that cannot be read or parsed.
+RegressionManifest load_manifest(const std::string& path);
+
+// The hash at every checkpoint of a case, in the same order. Cases that could not be started have an error instead.
+struct RegressionResult {
+    std::vector<uint64_t> hashes;
+    std::optional<uint64_t> crash_frame;
+    std::string error;
+};
+
+// Runs every case of the manifest on threads workers (0 for one per hardware thread), with engine or, if lockstep is
+// set, as a single lane of a LockstepGroup
+std::vector<RegressionResult> run_regression(const RegressionManifest& manifest, Engine engine, bool lockstep, unsigned threads);
+
+// Rewrites the manifest with the hashes of results in place of the expected ones. Throws std::runtime_error if the
+// file cannot be written.
+void save_manifest(const RegressionManifest& manifest, const std::vector<RegressionResult>& results);
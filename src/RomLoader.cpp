@@ -0,0 +1,184 @@
+#include "RomLoader.h"
+
+#include "Chip8Emulator.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <utility>
+
+#if defined(__unix__) || defined(__APPLE__)
+#    define CHIP8_MMAP_SUPPORTED 1
+#    include <fcntl.h>
+#    include <sys/mman.h>
+#    include <sys/stat.h>
+#    include <unistd.h>
+#else
+#    define CHIP8_MMAP_SUPPORTED 0
+#endif
+
+namespace
+{
+
+constexpr size_t tar_block_size = 512;
+constexpr size_t map_threshold  = 64 * 1024;
+
+// tar stores numbers as octal text, padded with spaces or nuls
+uint64_t parse_octal(const uint8_t* field, size_t length) {
+    uint64_t value = 0;
+    for (size_t i = 0; i < length && field[i] >= '0' && field[i] <= '7'; ++i)
+        value = value * 8 + static_cast<uint64_t>(field[i] - '0');
+    return value;
+}
+
+std::string parse_name(const uint8_t* field, size_t length) {
+    const auto* text = reinterpret_cast<const char*>(field);
+    return std::string(text, std::find(text, text + length, '\0'));
+}
+
+bool fits_in_memory(size_t size) {
+    return size != 0 && size <= Chip8Emulator::max_program_size;
+}
+
+} // namespace
+
+RomFile::RomFile(const std::string& path) {
+#if CHIP8_MMAP_SUPPORTED
+    const int file = open(path.c_str(), O_RDONLY);
+    if (file < 0)
+        throw std::runtime_error("Could not find rom " + path);
+    struct stat status {};
+    if (fstat(file, &status) != 0 || status.st_size == 0) {
+        close(file);
+        throw std::runtime_error("rom " + path + " is empty");
+    }
+    length = static_cast<size_t>(status.st_size);
+    if (length < map_threshold) {
+        // a mapping costs more than copying a few pages, which is all a single rom ever is
+        buffer.resize(length);
+        const bool complete = read(file, buffer.data(), length) == static_cast<ssize_t>(length);
+        close(file);
+        if (!complete)
+            throw std::runtime_error("Could not read rom " + path);
+        bytes = buffer.data();
+        return;
+    }
+    void* mapping = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, file, 0);
+    // the mapping stays valid without the descriptor
+    close(file);
+    if (mapping == MAP_FAILED)
+        throw std::runtime_error("Could not map rom " + path);
+    bytes  = static_cast<const uint8_t*>(mapping);
+    mapped = true;
+#else
+    std::ifstream file(path, std::ios_base::binary | std::ios_base::ate);
+    if (!file.is_open())
+        throw std::runtime_error("Could not find rom " + path);
+    buffer.resize(static_cast<size_t>(file.tellg()));
+    if (buffer.empty())
+        throw std::runtime_error("rom " + path + " is empty");
+    file.seekg(0);
+    if (!file.read(reinterpret_cast<char*>(buffer.data()), static_cast<std::streamsize>(buffer.size())))
+        throw std::runtime_error("Could not read rom " + path);
+    bytes  = buffer.data();
+    length = buffer.size();
+#endif
+}
+
+RomFile::RomFile(RomFile&& other) noexcept
+    : bytes(std::exchange(other.bytes, nullptr)),
+      length(std::exchange(other.length, 0)),
+      mapped(std::exchange(other.mapped, false)),
+      buffer(std::move(other.buffer)) {
+}
+
+RomFile& RomFile::operator=(RomFile&& other) noexcept {
+    if (this != &other) {
+        release();
+        bytes  = std::exchange(other.bytes, nullptr);
+        length = std::exchange(other.length, 0);
+        mapped = std::exchange(other.mapped, false);
+        buffer = std::move(other.buffer);
+    }
+    return *this;
+}
+
+RomFile::~RomFile() {
+    release();
+}
+
+void RomFile::release() noexcept {
+#if CHIP8_MMAP_SUPPORTED
+    if (mapped)
+        munmap(const_cast<uint8_t*>(bytes), length);
+#endif
+    mapped = false;
+}
+
+RomCorpus::RomCorpus(const std::string& path) {
+    if (std::filesystem::is_directory(path))
+        scan_directory(path);
+    else
+        scan_archive(path);
+    std::sort(entries.begin(), entries.end(), [](const Rom& a, const Rom& b) { return a.name < b.name; });
+}
+
+void RomCorpus::scan_directory(const std::string& path) {
+    for (const auto& entry : std::filesystem::recursive_directory_iterator(path)) {
+        if (!entry.is_regular_file())
+            continue;
+        if (!fits_in_memory(entry.file_size())) {
+            ++skipped_files;
+            continue;
+        }
+        const RomFile& file = files.emplace_back(entry.path().string());
+        entries.push_back({ entry.path().lexically_relative(path).generic_string(), file.begin(), file.size() });
+    }
+}
+
+void RomCorpus::scan_archive(const std::string& path) {
+    const RomFile& archive = files.emplace_back(path);
+    const uint8_t* data    = archive.begin();
+    const size_t size      = archive.size();
+    if (size < tar_block_size || std::memcmp(data + 257, "ustar", 5) != 0)
+        throw std::runtime_error(path + " is neither a directory nor a tar archive");
+
+    // a header block per file followed by its contents padded to whole blocks, up to an all zero block
+    std::string long_name;
+    for (size_t offset = 0; offset + tar_block_size <= size;) {
+        const uint8_t* header = data + offset;
+        if (header[0] == 0)
+            break;
+        const uint64_t file_size = parse_octal(header + 124, 12);
+        const uint8_t type       = header[156];
+        const size_t contents    = offset + tar_block_size;
+        if (file_size > size - contents)
+            throw std::runtime_error("tar archive " + path + " is truncated");
+
+        if (type == 'L') {
+            // GNU tar puts names longer than 100 characters in a pseudo file of their own, ahead of the real one
+            long_name = parse_name(data + contents, static_cast<size_t>(file_size));
+        } else {
+            if (type == '0' || type == 0) {
+                // POSIX ustar splits long names into a prefix and a name, old GNU archives keep timestamps there
+                std::string name = long_name;
+                if (name.empty() && std::memcmp(header + 257, "ustar\0", 6) != 0) {
+                    name = parse_name(header, 100);
+                } else if (name.empty()) {
+                    const std::string prefix = parse_name(header + 345, 155);
+                    name                     = (prefix.empty() ? "" : prefix + "/") + parse_name(header, 100);
+                }
+                if (name.rfind("./", 0) == 0)
+                    name.erase(0, 2);
+                if (fits_in_memory(static_cast<size_t>(file_size)))
+                    entries.push_back({ name, data + contents, static_cast<size_t>(file_size) });
+                else
+                    ++skipped_files;
+            }
+            long_name.clear();
+        }
+        offset = contents + (static_cast<size_t>(file_size) + tar_block_size - 1) / tar_block_size * tar_block_size;
+    }
+}
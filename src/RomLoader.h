@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// A whole file, mapped read only into memory so that an emulator copies it straight out of the page cache. Files
+// smaller than 64 KiB, and every file where mmap is not available, are read into a buffer in one go instead.
+class RomFile {
+public:
+    // Throws std::runtime_error if the file cannot be read or is empty
+    explicit RomFile(const std::string& path);
+    RomFile(RomFile&& other) noexcept;
+    RomFile& operator=(RomFile&& other) noexcept;
+    RomFile(const RomFile&)            = delete;
+    RomFile& operator=(const RomFile&) = delete;
+    ~RomFile();
+
+    const uint8_t* begin() const noexcept { return bytes; }
+    const uint8_t* end() const noexcept { return bytes + length; }
+    size_t size() const noexcept { return length; }
+
+private:
+    const uint8_t* bytes = nullptr;
+    size_t length        = 0;
+    bool mapped          = false; // bytes has to be unmapped, otherwise it points into buffer
+    std::vector<uint8_t> buffer;
+
+    void release() noexcept;
+};
+
+// Many roms from a single place: every file in a directory and its subdirectories, or every file in an uncompressed
+// tar archive. An archive is mapped once as a whole and its roms point straight into the mapping, so a corpus of
+// thousands of roms costs one open and one mmap. Files that are empty or do not fit in memory are skipped.
+class RomCorpus {
+public:
+    struct Rom {
+        std::string name; // path within the directory or archive
+        const uint8_t* bytes;
+        size_t size;
+
+        const uint8_t* begin() const noexcept { return bytes; }
+        const uint8_t* end() const noexcept { return bytes + size; }
+    };
+
+    // Throws std::runtime_error if path is neither a directory nor a tar archive, or cannot be read
+    explicit RomCorpus(const std::string& path);
+
+    // sorted by name, valid as long as the corpus is
+    const std::vector<Rom>& roms() const noexcept { return entries; }
+    size_t skipped() const noexcept { return skipped_files; }
+
+private:
+    std::vector<RomFile> files;
+    std::vector<Rom> entries;
+    size_t skipped_files = 0;
+
+    void scan_directory(const std::string& path);
+    void scan_archive(const std::string& path);
+};
@@ -0,0 +1,35 @@
+#include "Snapshot.h"
+
+#include <fstream>
+#include <stdexcept>
+
+void save_snapshot(const std::string& path, const Snapshot& snapshot) {
+    std::ofstream file(path, std::ios_base::binary | std::ios_base::trunc);
+    if (!file.is_open())
+        throw std::runtime_error("Could not create snapshot " + path);
+
+    file.write(reinterpret_cast<const char*>(&snapshot), sizeof(snapshot));
+    file.close();
+    if (!file)
+        throw std::runtime_error("Could not write snapshot " + path);
+}
+
+Snapshot load_snapshot(const std::string& path) {
+    std::ifstream file(path, std::ios_base::binary);
+    if (!file.is_open())
+        throw std::runtime_error("Could not find snapshot " + path);
+
+    Snapshot snapshot{};
+    file.read(reinterpret_cast<char*>(&snapshot), sizeof(snapshot));
+    if (file.gcount() < 16 || snapshot.magic != Snapshot::expected_magic)
+        throw std::runtime_error(path + " is not a snapshot");
+    if (snapshot.version != Snapshot::current_version || snapshot.size != sizeof(Snapshot))
+        throw std::runtime_error("snapshot " + path + " was written by an incompatible version");
+    if (static_cast<size_t>(file.gcount()) != sizeof(snapshot) || file.peek() != std::ifstream::traits_type::eof())
+        throw std::runtime_error("snapshot " + path + " is truncated or has trailing data");
+    // xoshiro128** never leaves the all zero state, every random byte would be 0
+    if (snapshot.rng == RandomNumberGenerator::State{})
+        throw std::runtime_error("snapshot " + path + " has an invalid random number generator state");
+
+    return snapshot;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <type_traits>
+
+#include "RandomNumberGenerator.h"
+
+// The complete state of a Chip8Emulator in a fixed binary layout: no pointers, no implicit padding, every field at
+// the same offset in every build. A snapshot file is exactly one Snapshot, so it is written with one write() and
+// can be read back into a Snapshot (or mapped and copied) in one go. Bump version whenever the layout changes.
+struct Snapshot {
+    static constexpr std::array<char, 8> expected_magic = { 'C', 'H', 'I', 'P', '8', 'S', 'N', 'P' };
+    static constexpr uint32_t current_version           = 3;
+
+    std::array<char, 8> magic;
+    uint32_t version;
+    uint32_t size; // sizeof(Snapshot), a second check against files from a different layout
+
+    std::array<uint8_t, 4096> memory;
+    std::array<std::array<uint64_t, 64>, 2> display; // Chip8Emulator::DisplayRows
+    std::array<uint16_t, 16> stack;
+    std::array<uint8_t, 16> registers;
+    std::array<uint8_t, 16> input; // 1 for every key that is held down
+    std::array<uint8_t, 16> flags; // written by Fx75
+    uint16_t index;
+    uint16_t pc;
+    uint8_t stack_depth;
+    uint8_t delay_timer;
+    uint8_t sound_timer;
+    uint8_t wait_register;         // the register Fx0A stores the key in
+    uint8_t hires;                 // 1 in the 128x64 mode
+    std::array<uint8_t, 7> unused; // always 0, keeps cycles aligned without padding
+    uint64_t cycles;
+    RandomNumberGenerator::State rng;
+};
+static_assert(std::is_trivially_copyable_v<Snapshot>, "snapshots are copied as raw bytes");
+static_assert(std::has_unique_object_representations_v<Snapshot>, "snapshots must not contain padding");
+
+// Writes snapshot to path. Throws std::runtime_error if the file cannot be written.
+void save_snapshot(const std::string& path, const Snapshot& snapshot);
+
+// Reads a snapshot written by save_snapshot(). Throws std::runtime_error if the file cannot be read, was written
+// with a different snapshot version or holds a random number generator state that could never occur.
+Snapshot load_snapshot(const std::string& path);
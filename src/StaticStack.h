@@ -35,6 +35,23 @@ public:
         return stack_ptr == stack.size();
     }
 
+    // raw contents for snapshots, only the first depth() entries are in use
+    const std::array<uint16_t, 16>& entries() const noexcept {
+        return stack;
+    }
+
+    uint8_t depth() const noexcept {
+        return stack_ptr;
+    }
+
+    void assign(const std::array<uint16_t, 16>& entries, uint8_t depth) {
+        if (depth > stack.size())
+            throw std::runtime_error("stack depth exceeds maximum size");
+
+        stack     = entries;
+        stack_ptr = depth;
+    }
+
 private:
     std::array<uint16_t, 16> stack{}; // stack size on chip8 is 16
     uint8_t stack_ptr = 0;
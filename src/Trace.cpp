@@ -0,0 +1,90 @@
+#include "Trace.h"
+
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+
+#if defined(__unix__) || defined(__APPLE__)
+#    define CHIP8_TRACE_SUPPORTED 1
+#    include <fcntl.h>
+#    include <sys/mman.h>
+#    include <unistd.h>
+#else
+#    define CHIP8_TRACE_SUPPORTED 0
+#endif
+
+#if CHIP8_TRACE_SUPPORTED
+
+TraceRecorder::TraceRecorder(const std::string& path, uint32_t capacity) {
+    if (capacity > max_capacity)
+        throw std::invalid_argument("A trace holds at most " + std::to_string(max_capacity) + " instructions");
+    uint64_t records_in_ring = 1;
+    while (records_in_ring < capacity)
+        records_in_ring *= 2;
+    mask        = records_in_ring - 1;
+    mapped_size = sizeof(TraceHeader) + records_in_ring * sizeof(TraceRecord);
+
+    const int file = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (file < 0)
+        throw std::runtime_error("Could not create trace " + path);
+    const bool sized = ftruncate(file, static_cast<off_t>(mapped_size)) == 0;
+    void* mapping    = sized ? mmap(nullptr, mapped_size, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0) : MAP_FAILED;
+    // the mapping stays valid without the descriptor
+    close(file);
+    if (mapping == MAP_FAILED)
+        throw std::runtime_error("Could not map trace " + path);
+
+    header  = static_cast<TraceHeader*>(mapping);
+    records = static_cast<TraceRecord*>(static_cast<void*>(header + 1));
+    *header = { TraceHeader::expected_magic, TraceHeader::current_version, static_cast<uint32_t>(records_in_ring), 0 };
+}
+
+TraceRecorder::~TraceRecorder() {
+    munmap(header, mapped_size);
+}
+
+bool TraceRecorder::supported() noexcept {
+    return true;
+}
+
+#else
+
+TraceRecorder::TraceRecorder(const std::string& path, [[maybe_unused]] uint32_t capacity) {
+    throw std::runtime_error("Could not create trace " + path + ", tracing needs POSIX mmap");
+}
+
+TraceRecorder::~TraceRecorder() = default;
+
+bool TraceRecorder::supported() noexcept {
+    return false;
+}
+
+#endif
+
+Trace load_trace(const std::string& path) {
+    std::ifstream file(path, std::ios_base::binary);
+    if (!file.is_open())
+        throw std::runtime_error("Could not find trace " + path);
+
+    TraceHeader header{};
+    file.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if (!file || header.magic != TraceHeader::expected_magic)
+        throw std::runtime_error(path + " is not a trace");
+    if (header.version != TraceHeader::current_version || header.capacity == 0 ||
+        (header.capacity & (header.capacity - 1)) != 0)
+        throw std::runtime_error("trace " + path + " was written by an incompatible version");
+
+    std::vector<TraceRecord> ring(header.capacity);
+    file.read(reinterpret_cast<char*>(ring.data()), static_cast<std::streamsize>(ring.size() * sizeof(TraceRecord)));
+    if (!file)
+        throw std::runtime_error("trace " + path + " is truncated");
+
+    // once the ring has wrapped the oldest record is the one that would have been overwritten next
+    const uint64_t count = std::min<uint64_t>(header.written, header.capacity);
+    const uint64_t first = header.written - count;
+    Trace trace{ first, {} };
+    trace.records.reserve(count);
+    for (uint64_t i = first; i < header.written; ++i)
+        trace.records.push_back(ring[i & (header.capacity - 1)]);
+    return trace;
+}
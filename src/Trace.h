@@ -0,0 +1,79 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "Chip8Emulator.h"
+#include "Instruction.h"
+
+// A trace file is a TraceHeader followed by a ring of capacity TraceRecords, all in host byte order. The recorder
+// keeps written up to date after every record, so the file is complete whenever the process stops, even if it
+// never gets to clean up.
+struct TraceHeader {
+    static constexpr std::array<char, 8> expected_magic = { 'C', 'H', 'I', 'P', '8', 'T', 'R', 'C' };
+    static constexpr uint32_t current_version           = 1;
+
+    std::array<char, 8> magic;
+    uint32_t version;
+    uint32_t capacity; // records in the ring, a power of two
+    uint64_t written;  // records ever written, the ring holds the last min(written, capacity) of them
+};
+
+// One executed instruction. Which of vx, vf and index it changed follows from the opcode.
+struct TraceRecord {
+    uint16_t pc;
+    uint16_t opcode;
+    uint8_t vx;     // Vx after the instruction
+    uint8_t vf;     // VF after the instruction
+    uint16_t index; // I after the instruction
+};
+static_assert(std::is_trivially_copyable_v<TraceHeader> && std::is_trivially_copyable_v<TraceRecord>,
+              "traces are written as raw bytes");
+static_assert(std::has_unique_object_representations_v<TraceHeader> &&
+                  std::has_unique_object_representations_v<TraceRecord>,
+              "traces must not contain padding");
+
+// Instrumentation policy for Chip8Emulator::run_cycles() that records every instruction into a trace file mapped
+// into memory. A record is two plain stores, so tracing can stay on for long runs. Only available where POSIX mmap
+// is, see supported().
+class TraceRecorder {
+public:
+    static constexpr uint32_t default_capacity = 1 << 16;
+    static constexpr uint32_t max_capacity     = uint32_t{ 1 } << 31; // the largest power of two a header can hold
+
+    // Creates or truncates path to hold capacity records, rounded up to a power of two. Throws std::invalid_argument
+    // for a capacity above max_capacity, std::runtime_error if the file cannot be created or mapped.
+    explicit TraceRecorder(const std::string& path, uint32_t capacity = default_capacity);
+    TraceRecorder(const TraceRecorder&)            = delete;
+    TraceRecorder& operator=(const TraceRecorder&) = delete;
+    ~TraceRecorder();
+
+    [[nodiscard]] static bool supported() noexcept;
+
+    void executed(const Chip8Emulator& emulator, uint16_t opcode, const Instruction& instruction, uint16_t pc_before,
+                  Chip8Emulator::Action) noexcept {
+        const std::array<uint8_t, 16>& registers = emulator.registers();
+        records[written & mask] = { pc_before, opcode, registers[instruction.x], registers[15], emulator.index() };
+        header->written         = ++written;
+    }
+
+private:
+    TraceHeader* header  = nullptr;
+    TraceRecord* records = nullptr;
+    size_t mapped_size   = 0;
+    uint64_t written     = 0;
+    uint64_t mask        = 0;
+};
+
+// The records of a trace file, oldest first, and the number of the first one since the recording started
+struct Trace {
+    uint64_t first_record;
+    std::vector<TraceRecord> records;
+};
+
+// Reads a trace written by TraceRecorder. Throws std::runtime_error if the file cannot be read or is not a trace of
+// this version.
+Trace load_trace(const std::string& path);
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+// Hands values from one writer thread to one reader thread without either of them ever waiting on the other. The
+// writer fills its back buffer and publishes it by swapping it into the middle slot, the reader swaps the middle slot
+// for its front buffer whenever something new was published there. Values the reader was too slow to pick up are
+// simply overwritten, the reader always gets the latest one.
+template <typename T>
+class TripleBuffer {
+public:
+    // writer side
+    T& back_buffer() noexcept { return buffers[back]; }
+    void publish() noexcept {
+        back = static_cast<uint8_t>(middle.exchange(static_cast<uint8_t>(back | fresh), std::memory_order_acq_rel) & index_mask);
+    }
+
+    // reader side, returns false if nothing was published since the last call
+    bool update() noexcept {
+        if ((middle.load(std::memory_order_relaxed) & fresh) == 0)
+            return false;
+        front = static_cast<uint8_t>(middle.exchange(front, std::memory_order_acq_rel) & index_mask);
+        return true;
+    }
+    const T& front_buffer() const noexcept { return buffers[front]; }
+
+private:
+    static constexpr uint8_t index_mask = 0x3;
+    static constexpr uint8_t fresh      = 0x4; // set in middle while it holds a buffer the reader has not taken yet
+
+    std::array<T, 3> buffers{};
+    // the writer's and the reader's index each on their own cache line, so that they do not slow each other down
+    alignas(64) uint8_t back = 0;
+    alignas(64) std::atomic<uint8_t> middle{ 1 };
+    alignas(64) uint8_t front = 2;
+};
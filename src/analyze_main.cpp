@@ -0,0 +1,317 @@
+#include "Analysis.h"
+#include "Instruction.h"
+#include "Quirks.h"
+#include "RomLoader.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <iostream>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+enum class Format {
+    Listing, // disassembly with the blocks marked, data as bytes
+    Summary, // one csv line per rom
+    Json,    // one object per rom and line
+    Dot      // one graphviz digraph per rom
+};
+
+struct Input {
+    std::string path;
+    bool corpus; // a directory or tar archive rather than a single rom
+};
+
+struct Options {
+    std::vector<Input> inputs;
+    Format format       = Format::Listing;
+    QuirkProfile quirks = QuirkProfile::Default;
+};
+
+void print_usage(const char* name) {
+    std::cerr << "Usage: " << name << " path_to_rom... [--corpus PATH...] [--format F] [--profile P]\n"
+              << "  --corpus PATH   analyze every rom in a directory (and its subdirectories) or tar archive, may be repeated\n"
+              << "  --format F      'listing' (default) disassembles the code and shows the rest as data, 'summary' is\n"
+              << "                  a csv line per rom, 'json' an object per rom and line, 'dot' a graphviz digraph per rom\n"
+              << "  --profile P     quirk profile, only decides where Fx55 and Fx65 leave I, 'default', 'vip', 'chip48' or 'schip'\n";
+}
+
+std::optional<Options> parse_args(int argc, char* argv[]) {
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        const bool has_value  = i + 1 < argc;
+        if (arg == "--corpus" && has_value) {
+            options.inputs.push_back({ argv[++i], true });
+        } else if (arg == "--format" && has_value) {
+            const std::string format = argv[++i];
+            if (format == "listing")
+                options.format = Format::Listing;
+            else if (format == "summary")
+                options.format = Format::Summary;
+            else if (format == "json")
+                options.format = Format::Json;
+            else if (format == "dot")
+                options.format = Format::Dot;
+            else
+                return std::nullopt;
+        } else if (arg == "--profile" && has_value) {
+            const std::optional<QuirkProfile> quirks = parse_quirk_profile(argv[++i]);
+            if (!quirks)
+                return std::nullopt;
+            options.quirks = *quirks;
+        } else if (arg.rfind("--", 0) != 0) {
+            options.inputs.push_back({ arg, false });
+        } else {
+            return std::nullopt;
+        }
+    }
+
+    if (options.inputs.empty())
+        return std::nullopt;
+    return options;
+}
+
+const char* edge_name(EdgeKind kind) {
+    switch (kind) {
+    case EdgeKind::Next: return "next";
+    case EdgeKind::Jump: return "jump";
+    case EdgeKind::Skip: return "skip";
+    case EdgeKind::Call: return "call";
+    case EdgeKind::Return: return "return";
+    }
+    return "unknown";
+}
+
+uint16_t opcode_at(const uint8_t* rom, size_t address) {
+    return static_cast<uint16_t>(rom[address - load_address] << 8 | rom[address - load_address + 1]);
+}
+
+// text with the characters that json and dot strings cannot hold as they are escaped
+std::string quoted(const std::string& text) {
+    std::string result = "\"";
+    for (const char c : text) {
+        if (c == '"' || c == '\\') {
+            result += '\\';
+            result += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            char escape[8];
+            std::snprintf(escape, sizeof(escape), "\\u%04X", unsigned{ static_cast<unsigned char>(c) });
+            result += escape;
+        } else {
+            result += c;
+        }
+    }
+    return result + '"';
+}
+
+std::string address_list(const std::vector<uint16_t>& addresses) {
+    std::string text;
+    for (const uint16_t address : addresses)
+        text += (text.empty() ? "" : ",") + std::to_string(address);
+    return "[" + text + "]";
+}
+
+size_t unresolved_writes(const RomAnalysis& analysis) {
+    size_t count = 0;
+    for (const CodeWrite& write : analysis.code_writes)
+        count += !write.target;
+    return count;
+}
+
+void print_summary_header() {
+    std::printf("rom,size,code,data,blocks,subroutines,loops,indirect_jumps,code_writes,unresolved_writes\n");
+}
+
+void print_summary(const std::string& name, const RomAnalysis& analysis) {
+    std::printf("%s,%zu,%zu,%zu,%zu,%zu,%zu,%zu,%zu,%zu\n", name.c_str(), analysis.rom_end - load_address,
+                analysis.code_bytes(), analysis.data_bytes(), analysis.blocks.size(), analysis.subroutines.size(),
+                analysis.loops.size(), analysis.indirect_jumps.size(), analysis.code_writes.size(), unresolved_writes(analysis));
+}
+
+void print_json(const std::string& name, const RomAnalysis& analysis) {
+    // addresses are plain numbers so that they can be compared and looked up without parsing hex
+    std::string text = "{\"rom\":" + quoted(name) + ",\"size\":" + std::to_string(analysis.rom_end - load_address) +
+                       ",\"code_bytes\":" + std::to_string(analysis.code_bytes()) + ",\"data_bytes\":" + std::to_string(analysis.data_bytes()) +
+                       ",\"blocks\":[";
+    for (size_t i = 0; i < analysis.blocks.size(); ++i) {
+        const CfgBlock& block = analysis.blocks[i];
+        text += (i == 0 ? "" : ",") + std::string("{\"start\":") + std::to_string(block.start) + ",\"end\":" + std::to_string(block.end) + ",\"successors\":[";
+        for (size_t j = 0; j < block.successors.size(); ++j) {
+            const CfgEdge& edge = block.successors[j];
+            text += (j == 0 ? "" : ",") + std::string("{\"target\":") + std::to_string(edge.target) + ",\"kind\":\"" + edge_name(edge.kind) + "\"}";
+        }
+        text += "]}";
+    }
+    text += "],\"subroutines\":" + address_list(analysis.subroutines) + ",\"loops\":[";
+    for (size_t i = 0; i < analysis.loops.size(); ++i) {
+        const CfgLoop& loop = analysis.loops[i];
+        text += (i == 0 ? "" : ",") + std::string("{\"header\":") + std::to_string(loop.header) + ",\"latch\":" + std::to_string(loop.latch) + "}";
+    }
+    text += "],\"indirect_jumps\":" + address_list(analysis.indirect_jumps) + ",\"code_writes\":[";
+    for (size_t i = 0; i < analysis.code_writes.size(); ++i) {
+        const CodeWrite& write = analysis.code_writes[i];
+        text += (i == 0 ? "" : ",") + std::string("{\"address\":") + std::to_string(write.address) +
+                ",\"target\":" + (write.target ? std::to_string(*write.target) : "null") + "}";
+    }
+    text += "],\"external_targets\":" + address_list(analysis.external_targets) + "}\n";
+    std::fputs(text.c_str(), stdout);
+}
+
+// the comment for an instruction that the analysis flagged, if any
+std::string remark(const RomAnalysis& analysis, size_t address) {
+    char text[48] = "";
+    for (const CodeWrite& write : analysis.code_writes) {
+        if (write.address != address)
+            continue;
+        if (write.target)
+            std::snprintf(text, sizeof(text), "writes code at %03X", unsigned{ *write.target });
+        else
+            std::snprintf(text, sizeof(text), "I unknown, may write code");
+    }
+    if (std::binary_search(analysis.indirect_jumps.begin(), analysis.indirect_jumps.end(), address))
+        std::snprintf(text, sizeof(text), "indirect jump");
+    return text;
+}
+
+// the comment above a block: whether it is called or loops, and where it goes
+std::string block_remark(const RomAnalysis& analysis, const CfgBlock& block) {
+    std::string text;
+    if (std::binary_search(analysis.subroutines.begin(), analysis.subroutines.end(), block.start))
+        text += " subroutine,";
+    char field[32];
+    for (const CfgLoop& loop : analysis.loops) {
+        if (loop.header == block.start) {
+            std::snprintf(field, sizeof(field), " loop from %03X,", unsigned{ loop.latch });
+            text += field;
+        }
+    }
+    for (const CfgEdge& edge : block.successors) {
+        std::snprintf(field, sizeof(field), " %s %03X,", edge_name(edge.kind), unsigned{ edge.target });
+        text += field;
+    }
+    if (!text.empty())
+        text.pop_back();
+    return text;
+}
+
+void print_listing(const std::string& name, const uint8_t* rom, const RomAnalysis& analysis) {
+    std::printf("; %s: %zu bytes, %zu code, %zu data, %zu blocks, %zu subroutines, %zu loops, %zu indirect jumps, %zu code writes\n",
+                name.c_str(), analysis.rom_end - load_address, analysis.code_bytes(), analysis.data_bytes(), analysis.blocks.size(),
+                analysis.subroutines.size(), analysis.loops.size(), analysis.indirect_jumps.size(), analysis.code_writes.size());
+    auto block = analysis.blocks.begin();
+    for (size_t address = load_address; address < analysis.rom_end;) {
+        if (block != analysis.blocks.end() && block->start == address) {
+            std::printf("\n;%s\n", block_remark(analysis, *block).c_str());
+            ++block;
+        }
+        if (analysis.instructions[address]) {
+            const uint16_t opcode     = opcode_at(rom, address);
+            const std::string comment = remark(analysis, address);
+            if (comment.empty())
+                std::printf("%03X  %04X  %s\n", unsigned(address), unsigned{ opcode }, disassemble(opcode).c_str());
+            else
+                std::printf("%03X  %04X  %-18s ; %s\n", unsigned(address), unsigned{ opcode }, disassemble(opcode).c_str(), comment.c_str());
+            // an instruction can overlap one that starts on the byte after it
+            address += analysis.instructions[address + 1] ? 1u : 2u;
+            continue;
+        }
+        // up to 8 bytes of data per line, up to where the next instruction starts
+        std::printf("%03X  data ", unsigned(address));
+        for (size_t i = 0; i < 8 && address < analysis.rom_end && !analysis.instructions[address]; ++i, ++address)
+            std::printf(" %02X", unsigned{ rom[address - load_address] });
+        std::printf("\n");
+    }
+}
+
+void print_dot(const std::string& name, const uint8_t* rom, const RomAnalysis& analysis) {
+    std::printf("digraph %s {\n  node [shape=box fontname=monospace];\n", quoted(name).c_str());
+    for (const CfgBlock& block : analysis.blocks) {
+        // one left aligned line per instruction, flagged blocks are red
+        std::string label;
+        bool flagged = false;
+        char line[64];
+        for (size_t address = block.start; address < block.end; address += 2) {
+            const uint16_t opcode     = opcode_at(rom, address);
+            const std::string comment = remark(analysis, address);
+            std::snprintf(line, sizeof(line), "%03X  %s%s%s", unsigned(address), disassemble(opcode).c_str(), comment.empty() ? "" : "  ; ", comment.c_str());
+            label += std::string(line) + "\\l";
+            flagged |= !comment.empty();
+        }
+        std::printf("  n%03X [label=\"%s\"%s];\n", unsigned{ block.start }, label.c_str(), flagged ? " color=red" : "");
+    }
+    for (const uint16_t target : analysis.external_targets)
+        std::printf("  n%03X [label=\"%03X\" shape=plaintext];\n", unsigned{ target }, unsigned{ target });
+    for (const CfgBlock& block : analysis.blocks) {
+        for (const CfgEdge& edge : block.successors) {
+            const bool back = std::any_of(analysis.loops.begin(), analysis.loops.end(), [&](const CfgLoop& loop) {
+                return loop.latch == block.start && loop.header == edge.target;
+            });
+            const char* style = "";
+            switch (edge.kind) {
+            case EdgeKind::Next:
+            case EdgeKind::Jump: break;
+            case EdgeKind::Skip: style = " style=dashed"; break;
+            case EdgeKind::Call: style = " color=blue"; break;
+            case EdgeKind::Return: style = " color=blue style=dotted"; break;
+            }
+            std::printf("  n%03X -> n%03X [label=%s%s%s];\n", unsigned{ block.start }, unsigned{ edge.target }, edge_name(edge.kind), style, back ? " penwidth=2" : "");
+        }
+    }
+    std::printf("}\n");
+}
+
+void print_analysis(Format format, const std::string& name, const uint8_t* rom, const RomAnalysis& analysis) {
+    switch (format) {
+    case Format::Listing: print_listing(name, rom, analysis); break;
+    case Format::Summary: print_summary(name, analysis); break;
+    case Format::Json: print_json(name, analysis); break;
+    case Format::Dot: print_dot(name, rom, analysis); break;
+    }
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    const std::optional<Options> options = [&]() -> std::optional<Options> {
+        try {
+            return parse_args(argc, argv);
+        } catch (const std::exception&) {
+            return std::nullopt;
+        }
+    }();
+    if (!options) {
+        print_usage(argv[0]);
+        return -1;
+    }
+
+    const Quirks quirks = quirks_of(options->quirks);
+    if (options->format == Format::Summary)
+        print_summary_header();
+    try {
+        for (const Input& input : options->inputs) {
+            if (!input.corpus) {
+                const RomFile rom(input.path);
+                print_analysis(options->format, input.path, rom.begin(), analyze_rom(rom.begin(), rom.size(), quirks));
+                continue;
+            }
+            const RomCorpus corpus(input.path);
+            for (const RomCorpus::Rom& rom : corpus.roms()) {
+                const std::string name = (std::filesystem::path(input.path) / rom.name).generic_string();
+                print_analysis(options->format, name, rom.begin(), analyze_rom(rom.begin(), rom.size, quirks));
+            }
+            if (corpus.skipped() != 0)
+                std::cerr << "skipped " << corpus.skipped() << " files in " << input.path << " that are empty or too large to be roms\n";
+        }
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << '\n';
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,253 @@
+#include "BatchRunner.h"
+#include "Chip8Emulator.h"
+#include "Engine.h"
+#include "Quirks.h"
+#include "RomLoader.h"
+#include "Snapshot.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <iostream>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace std::chrono;
+
+namespace
+{
+constexpr uint64_t cycles_per_frame = Chip8Emulator::clock_speed_hz / 60;
+
+enum class InputKind {
+    Rom,      // started from power on
+    Snapshot, // every instance is forked from it
+    Corpus    // a directory or tar archive, each rom in it is started from power on
+};
+
+struct Input {
+    std::string path;
+    InputKind kind;
+};
+
+struct Options {
+    std::vector<Input> inputs;
+    size_t instances = 1000; // per input
+    std::optional<std::string> results_path;
+    std::optional<uint64_t> seed; // instance i is seeded with seed + i, forks keep the snapshot's sequence without it
+    QuirkProfile quirks = QuirkProfile::Default;
+    BatchSettings settings;
+};
+
+void print_usage(const char* name) {
+    std::cerr << "Usage: " << name << " path_to_rom... [--load-snapshot FILE...] [--corpus PATH...] [--instances N] [--cycles N | --frames N]\n"
+              << "       [--threads N] [--engine E | --lockstep] [--profile P] [--wait-key K] [--seed N] [--results FILE] [--trace DIR [--trace-length N]]\n"
+              << "  --load-snapshot FILE  fork emulators from a snapshot instead of booting a rom, may be repeated\n"
+              << "  --corpus PATH   run every rom in a directory (and its subdirectories) or tar archive, may be repeated\n"
+              << "  --instances N   number of emulators to run for every rom or snapshot (default 1000)\n"
+              << "  --cycles N      number of instructions each emulator executes (default 10000000)\n"
+              << "  --frames N      number of 60Hz frames each emulator executes, " << cycles_per_frame << " instructions each\n"
+              << "  --threads N     worker threads, by default one per hardware thread\n"
+              << "  --engine E      'interpreter', 'blocks' (default) or 'jit'\n"
+              << "  --lockstep      run instances of the same rom 16 at a time with SIMD, while they stay at the same pc\n"
+              << "  --profile P     quirk profile of every instance, 'default', 'vip', 'chip48' or 'schip'\n"
+              << "  --wait-key K    key (0-15) to press whenever a rom waits for input\n"
+              << "  --seed N        seed instance i with N + i (default 0), forks are only reseeded when this is given\n"
+              << "  --results FILE  write the final state of every emulator to FILE as csv\n"
+              << "  --trace DIR     record the last instructions of emulator i to DIR/i.trace for chip8_trace, only with\n"
+              << "                  --engine interpreter\n"
+              << "  --trace-length N  number of instructions each trace keeps (default " << TraceRecorder::default_capacity
+              << ", at most " << TraceRecorder::max_capacity << ")\n";
+}
+
+std::optional<Options> parse_args(int argc, char* argv[]) {
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        const bool has_value  = i + 1 < argc;
+        if (arg == "--instances" && has_value) {
+            options.instances = std::stoull(argv[++i]);
+        } else if ((arg == "--cycles" || arg == "--frames") && has_value) {
+            const uint64_t count    = std::stoull(argv[++i]);
+            options.settings.cycles = arg == "--frames" ? count * cycles_per_frame : count;
+        } else if (arg == "--threads" && has_value) {
+            options.settings.threads = static_cast<unsigned>(std::stoul(argv[++i]));
+        } else if (arg == "--engine" && has_value) {
+            const std::optional<Engine> engine = parse_engine(argv[++i]);
+            if (!engine)
+                return std::nullopt;
+            options.settings.engine = *engine;
+        } else if (arg == "--profile" && has_value) {
+            const std::optional<QuirkProfile> quirks = parse_quirk_profile(argv[++i]);
+            if (!quirks)
+                return std::nullopt;
+            options.quirks = *quirks;
+        } else if (arg == "--lockstep") {
+            options.settings.lockstep = true;
+        } else if (arg == "--wait-key" && has_value) {
+            const unsigned long key = std::stoul(argv[++i]);
+            if (key >= 16)
+                return std::nullopt;
+            options.settings.wait_key = static_cast<uint8_t>(key);
+        } else if (arg == "--seed" && has_value) {
+            options.seed = std::stoull(argv[++i]);
+        } else if (arg == "--results" && has_value) {
+            options.results_path = argv[++i];
+        } else if (arg == "--trace" && has_value) {
+            options.settings.trace_directory = argv[++i];
+        } else if (arg == "--trace-length" && has_value) {
+            const uint64_t length = std::stoull(argv[++i]);
+            if (length > TraceRecorder::max_capacity)
+                return std::nullopt;
+            options.settings.trace_length = static_cast<uint32_t>(length);
+        } else if (arg == "--load-snapshot" && has_value) {
+            options.inputs.push_back({ argv[++i], InputKind::Snapshot });
+        } else if (arg == "--corpus" && has_value) {
+            options.inputs.push_back({ argv[++i], InputKind::Corpus });
+        } else if (arg.rfind("--", 0) != 0) {
+            options.inputs.push_back({ arg, InputKind::Rom });
+        } else {
+            return std::nullopt;
+        }
+    }
+
+    if (options.inputs.empty() || options.instances == 0)
+        return std::nullopt;
+    // traces are recorded by the instrumented interpreter loop
+    if (options.settings.trace_directory && (options.settings.engine != Engine::Interpreter || options.settings.lockstep))
+        return std::nullopt;
+    return options;
+}
+
+const char* status_name(InstanceStatus status) {
+    switch (status) {
+    case InstanceStatus::BudgetReached: return "budget_reached";
+    case InstanceStatus::WaitingForInput: return "waiting_for_input";
+    case InstanceStatus::Crashed: return "crashed";
+    }
+    return "unknown";
+}
+
+// one line per instance: its rom or snapshot, how it stopped, the machine state and the display as 32 rows of 16 hex
+// digits, or 64 rows of 32 in high resolution
+bool write_results(const std::string& path, const std::vector<std::string>& sources, size_t instances,
+                   const std::vector<InstanceResult>& results) {
+    FILE* file = std::fopen(path.c_str(), "w");
+    if (file == nullptr)
+        return false;
+
+    std::fprintf(file, "instance,rom,status,cycles,pc,index,registers,display\n");
+    for (size_t i = 0; i < results.size(); ++i) {
+        const InstanceResult& result = results[i];
+        std::fprintf(file, "%zu,%s,%s,%llu,%03X,%03X,", i, sources[i / instances].c_str(),
+                     status_name(result.status), static_cast<unsigned long long>(result.cycles), result.pc, result.index);
+        for (const uint8_t reg : result.registers)
+            std::fprintf(file, "%02X", reg);
+        std::fputc(',', file);
+        for (size_t y = 0; y < (result.hires ? Chip8Emulator::hires_height : Chip8Emulator::display_height); ++y) {
+            for (size_t half = 0; half < (result.hires ? 2 : 1); ++half)
+                std::fprintf(file, "%016llX", static_cast<unsigned long long>(result.display[half][y]));
+        }
+        std::fputc('\n', file);
+    }
+    return std::fclose(file) == 0;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    const std::optional<Options> options = [&]() -> std::optional<Options> {
+        try {
+            return parse_args(argc, argv);
+        } catch (const std::exception&) {
+            return std::nullopt;
+        }
+    }();
+    if (!options) {
+        print_usage(argv[0]);
+        return -1;
+    }
+
+    const auto setup_start = steady_clock::now();
+    std::vector<Chip8Emulator> instances;
+    std::vector<std::string> sources; // the rom or snapshot of every group of options->instances instances
+    const auto boot = [&](const std::string& source, const auto& rom) {
+        sources.push_back(source);
+        for (size_t i = 0; i < options->instances; ++i)
+            instances.emplace_back(rom.begin(), rom.end(), options->seed.value_or(0) + i);
+    };
+    try {
+        instances.reserve(options->inputs.size() * options->instances);
+        for (const Input& input : options->inputs) {
+            switch (input.kind) {
+            case InputKind::Rom: boot(input.path, RomFile(input.path)); break;
+            case InputKind::Snapshot: {
+                // every fork continues exactly where the snapshot was taken, without running the boot code again
+                const Snapshot snapshot = load_snapshot(input.path);
+                sources.push_back(input.path);
+                for (size_t i = 0; i < options->instances; ++i) {
+                    instances.emplace_back(snapshot);
+                    if (options->seed)
+                        instances.back().reseed_random(*options->seed + i);
+                }
+                break;
+            }
+            case InputKind::Corpus: {
+                // the emulators copy their roms straight out of the mapped files
+                const RomCorpus corpus(input.path);
+                instances.reserve(instances.size() + corpus.roms().size() * options->instances);
+                for (const RomCorpus::Rom& rom : corpus.roms())
+                    boot((std::filesystem::path(input.path) / rom.name).generic_string(), rom);
+                if (corpus.skipped() != 0)
+                    std::cerr << "skipped " << corpus.skipped() << " files in " << input.path << " that are empty or too large to be roms\n";
+                break;
+            }
+            }
+        }
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << '\n';
+        return -1;
+    }
+    for (Chip8Emulator& instance : instances)
+        instance.set_quirk_profile(options->quirks);
+    const duration<double> setup = steady_clock::now() - setup_start;
+
+    const auto start = steady_clock::now();
+    std::vector<InstanceResult> results;
+    try {
+        if (options->settings.trace_directory)
+            std::filesystem::create_directories(*options->settings.trace_directory);
+        results = run_batch(instances, options->settings);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << '\n';
+        return -1;
+    }
+    const duration<double> elapsed = steady_clock::now() - start;
+
+    uint64_t instructions = 0;
+    size_t finished       = 0;
+    size_t waiting        = 0;
+    size_t crashed        = 0;
+    for (const InstanceResult& result : results) {
+        instructions += result.cycles;
+        finished += result.status == InstanceStatus::BudgetReached;
+        waiting += result.status == InstanceStatus::WaitingForInput;
+        crashed += result.status == InstanceStatus::Crashed;
+    }
+
+    std::printf("instances: %zu (%zu roms or snapshots x %zu)\n", results.size(), sources.size(), options->instances);
+    std::printf("setup: %.6f s\n", setup.count());
+    std::printf("budget reached: %zu, waiting for input: %zu, crashed: %zu\n", finished, waiting, crashed);
+    std::printf("instructions: %llu\n", static_cast<unsigned long long>(instructions));
+    std::printf("elapsed: %.6f s\n", elapsed.count());
+    if (elapsed.count() > 0.0)
+        std::printf("instructions/sec: %.0f\n", static_cast<double>(instructions) / elapsed.count());
+
+    if (options->results_path && !write_results(*options->results_path, sources, options->instances, results)) {
+        std::cerr << "Could not write results to " << *options->results_path << '\n';
+        return -1;
+    }
+    return 0;
+}
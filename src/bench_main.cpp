@@ -0,0 +1,324 @@
+#include "Chip8Emulator.h"
+#include "Engine.h"
+#include "Movie.h"
+#include "Quirks.h"
+#include "RomLoader.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace std::chrono;
+
+namespace
+{
+
+// Every benchmark rom has the same layout so that call/ret has a fixed subroutine to target:
+//   0x200: jump over the subroutine
+//   0x202: 00EE (the subroutine)
+//   0x204: setup instructions, executed once
+//   then:  the body repeated until the program area is mostly full, followed by a jump back to the first body copy
+constexpr uint16_t subroutine_address = load_address + 2;
+constexpr uint16_t data_address       = 0xE00; // scratch memory for Fx33/Fx55/Fx65, well clear of the program
+constexpr size_t max_program_words    = (data_address - load_address) / 2 - 8;
+
+struct BenchCase {
+    std::string name;
+    std::vector<uint16_t> setup;
+    std::vector<uint16_t> body;
+};
+
+struct BenchResult {
+    std::string name;
+    uint64_t instructions;
+    double seconds;
+
+    double ns_per_instruction() const { return seconds * 1e9 / static_cast<double>(instructions); }
+    double instructions_per_sec() const { return static_cast<double>(instructions) / seconds; }
+};
+
+struct Options {
+    Engine engine         = Engine::Interpreter;
+    QuirkProfile quirks   = QuirkProfile::Default;
+    uint64_t instructions = 20'000'000;
+    int repetitions       = 3;
+    std::string filter;
+    std::optional<std::string> json_path;
+    std::vector<std::pair<std::string, std::string>> replays; // rom and movie
+};
+
+std::vector<uint8_t> build_rom(const BenchCase& bench) {
+    std::vector<uint16_t> words = { static_cast<uint16_t>(0x1000 | (subroutine_address + 2)), 0x00EE };
+    words.insert(words.end(), bench.setup.begin(), bench.setup.end());
+
+    const auto loop_start = static_cast<uint16_t>(load_address + words.size() * 2);
+    const size_t copies   = std::max<size_t>(1, (max_program_words - words.size()) / bench.body.size());
+    for (size_t i = 0; i < copies; ++i)
+        words.insert(words.end(), bench.body.begin(), bench.body.end());
+    words.push_back(static_cast<uint16_t>(0x1000 | loop_start));
+
+    std::vector<uint8_t> bytes;
+    bytes.reserve(words.size() * 2);
+    for (const uint16_t word : words) {
+        bytes.push_back(static_cast<uint8_t>(word >> 8));
+        bytes.push_back(static_cast<uint8_t>(word & 0xFF));
+    }
+    return bytes;
+}
+
+// Spreads an 8xyN operation over different register pairs so the results are not all dependent on one register
+std::vector<uint16_t> alu_body(uint16_t op) {
+    std::vector<uint16_t> body;
+    for (uint16_t x = 0; x < 15; ++x) {
+        const auto y = static_cast<uint16_t>((x + 5) % 15);
+        body.push_back(static_cast<uint16_t>(0x8000 | (x << 8) | (y << 4) | op));
+    }
+    return body;
+}
+
+std::vector<uint16_t> register_setup() {
+    std::vector<uint16_t> setup;
+    for (uint16_t x = 0; x < 15; ++x)
+        setup.push_back(static_cast<uint16_t>(0x6000 | (x << 8) | (x * 17 + 3)));
+    return setup;
+}
+
+std::vector<BenchCase> make_cases() {
+    std::vector<BenchCase> cases = {
+        { "ld_byte", {}, { 0x6012, 0x6134, 0x6256, 0x6378 } },
+        { "add_byte", {}, { 0x7001, 0x7103, 0x7205, 0x7307 } },
+        { "alu_ld", register_setup(), alu_body(0x0) },
+        { "alu_or", register_setup(), alu_body(0x1) },
+        { "alu_and", register_setup(), alu_body(0x2) },
+        { "alu_xor", register_setup(), alu_body(0x3) },
+        { "alu_add", register_setup(), alu_body(0x4) },
+        { "alu_sub", register_setup(), alu_body(0x5) },
+        { "alu_shr", register_setup(), alu_body(0x6) },
+        { "alu_subn", register_setup(), alu_body(0x7) },
+        { "alu_shl", register_setup(), alu_body(0xE) },
+        // V0 is 0 and V1 is 1 in all skip benchmarks, the skipped instruction is never executed when taken
+        { "skip_se_byte_taken", { 0x6000 }, { 0x3000, 0x6100 } },
+        { "skip_se_byte_not_taken", { 0x6000 }, { 0x3001, 0x6101 } },
+        { "skip_sne_byte_taken", { 0x6000 }, { 0x4001, 0x6100 } },
+        { "skip_sne_byte_not_taken", { 0x6000 }, { 0x4000, 0x6101 } },
+        { "skip_se_reg_taken", { 0x6000, 0x6200 }, { 0x5020, 0x6100 } },
+        { "skip_sne_reg_taken", { 0x6000, 0x6101 }, { 0x9010, 0x6101 } },
+        { "skip_skp_not_taken", { 0x6000 }, { 0xE09E, 0x6101 } },
+        { "skip_sknp_taken", { 0x6000 }, { 0xE0A1, 0x6101 } },
+        { "cls", {}, { 0x00E0 } },
+        { "call_ret", {}, { static_cast<uint16_t>(0x2000 | subroutine_address) } },
+        { "ld_addr", {}, { 0xA123, 0xA456 } },
+        { "add_idx_reg", { 0x6001 }, { 0xF01E } },
+        { "ld_font", { 0x6007 }, { 0xF029 } },
+        { "ld_dt", {}, { 0xF007 } },
+        { "ld_set_dt", { 0x6010 }, { 0xF015 } },
+        { "rnd", {}, { 0xC0FF, 0xC10F } },
+        { "ld_bcd", { 0xA000 | data_address, 0x60FE }, { 0xF033 } },
+        { "ld_reg_dump_1", { 0xA000 | data_address }, { 0xF055 } },
+        { "ld_reg_dump_16", { 0xA000 | data_address }, { 0xFF55 } },
+        { "ld_reg_store_1", { 0xA000 | data_address }, { 0xF065 } },
+        { "ld_reg_store_16", { 0xA000 | data_address }, { 0xFF65 } },
+        // a rough mix of what a game loop does: arithmetic, a compare and skip, index setup and a draw
+        { "mixed", { 0x6000, 0x6105, 0x6203, 0x6405 },
+          { 0x7001, 0x8014, 0x8125, 0x3000, 0x6200, 0xA000, 0xF429, 0xD125, 0x8306, 0x4300, 0x7301 } },
+    };
+
+    // a long body cycling through many opcode groups so every dispatch site sees an unpredictable sequence
+    BenchCase decode_mix{ "decode_mix", register_setup(), {} };
+    const std::array<uint16_t, 8> group_ops = { 0x6000, 0x7000, 0x8004, 0x8002, 0x3000, 0xA000, 0xF01E, 0x800E };
+    for (size_t i = 0; i < 64; ++i) {
+        const uint16_t op = group_ops[(i * 5 + i / 8) % group_ops.size()];
+        // keep the skip comparing against a value the register never has so it is never taken
+        const auto x            = static_cast<uint16_t>((i % 14) << 8);
+        const auto y            = static_cast<uint16_t>(((i + 3) % 14) << 4);
+        const uint16_t operands = op == 0x3000 ? 0x0EFF : op == 0xF01E ? x : static_cast<uint16_t>(x | y);
+        decode_mix.body.push_back(static_cast<uint16_t>(op | operands));
+    }
+    cases.push_back(decode_mix);
+
+    // draws read the sprite from the font data at address 0, every height reads within the first 16 bytes
+    for (uint16_t height = 1; height <= 15; ++height) {
+        cases.push_back({ "drw_h" + std::to_string(height), { 0xA000, 0x6003, 0x6107 }, { static_cast<uint16_t>(0xD010 | height) } });
+    }
+
+    return cases;
+}
+
+uint64_t run_instructions(Chip8Emulator& emulator, Engine engine, uint64_t instructions) {
+    const uint64_t start_cycles = emulator.cycles();
+    while (emulator.cycles() - start_cycles < instructions) {
+        const Chip8Emulator::Action action = run_engine(emulator, engine, instructions - (emulator.cycles() - start_cycles));
+        if (action == Chip8Emulator::Action::Crash || action == Chip8Emulator::Action::WaitForInput)
+            throw std::runtime_error("benchmark rom stopped unexpectedly");
+    }
+    return emulator.cycles() - start_cycles;
+}
+
+BenchResult run_case(const BenchCase& bench, const Options& options) {
+    const std::vector<uint8_t> rom = build_rom(bench);
+
+    BenchResult best{ bench.name, 0, std::numeric_limits<double>::max() };
+    for (int rep = 0; rep < options.repetitions; ++rep) {
+        Chip8Emulator emulator(rom.begin(), rom.end(), 0);
+        emulator.set_quirk_profile(options.quirks);
+        run_instructions(emulator, options.engine, 1000); // get past the setup code and warm the caches
+
+        const auto start               = steady_clock::now();
+        const uint64_t executed        = run_instructions(emulator, options.engine, options.instructions);
+        const duration<double> elapsed = steady_clock::now() - start;
+        if (elapsed.count() < best.seconds) {
+            best.instructions = executed;
+            best.seconds      = elapsed.count();
+        }
+    }
+    return best;
+}
+
+std::string replay_name(const std::string& movie_path) {
+    return "replay:" + std::filesystem::path(movie_path).filename().string();
+}
+
+// A whole recorded run from power on, with the seed, clock speed and quirks of the movie. Unlike the synthetic
+// benchmarks this includes filling the block cache and whatever the rom spends its time on.
+BenchResult run_replay(const std::string& rom_path, const std::string& movie_path, const Options& options) {
+    const RomFile rom(rom_path);
+    const Movie movie = load_movie(movie_path);
+    MoviePlayer(movie).check_rom(rom.begin(), rom.size());
+
+    BenchResult best{ replay_name(movie_path), 0, std::numeric_limits<double>::max() };
+    for (int rep = 0; rep < options.repetitions; ++rep) {
+        Chip8Emulator emulator(rom.begin(), rom.end(), movie.header.seed);
+        emulator.set_quirk_profile(static_cast<QuirkProfile>(movie.header.profile));
+        emulator.set_clock_speed(movie.header.clock_hz);
+        MoviePlayer player(movie);
+
+        const auto start = steady_clock::now();
+        player.run(emulator, movie.length, [&](uint64_t budget) { return run_engine(emulator, options.engine, budget); });
+        const duration<double> elapsed = steady_clock::now() - start;
+        if (emulator.cycles() < movie.length)
+            throw std::runtime_error("rom stopped before the end of " + movie_path);
+        if (elapsed.count() < best.seconds) {
+            best.instructions = emulator.cycles();
+            best.seconds      = elapsed.count();
+        }
+    }
+    return best;
+}
+
+void write_json(const std::string& path, const std::vector<BenchResult>& results) {
+    std::ofstream out(path);
+    if (!out.is_open())
+        throw std::runtime_error("Could not open " + path + " for writing");
+
+    out << "{\n  \"benchmarks\": [\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const BenchResult& r = results[i];
+        out << "    { \"name\": \"" << r.name << "\", \"instructions\": " << r.instructions
+            << ", \"seconds\": " << r.seconds << ", \"ns_per_instruction\": " << r.ns_per_instruction()
+            << ", \"instructions_per_sec\": " << r.instructions_per_sec() << " }"
+            << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    out << "  ]\n}\n";
+}
+
+void print_usage(const char* name) {
+    std::cerr << "Usage: " << name << " [--engine E] [--profile P] [--instructions N] [--repetitions N] [--filter TEXT] [--json FILE]\n"
+              << "       [--replay ROM MOVIE...]\n"
+              << "  --engine E        'interpreter' (default), 'blocks' or 'jit', the execution engine to measure\n"
+              << "  --profile P       quirk profile, 'default', 'vip', 'chip48' or 'schip'\n"
+              << "  --instructions N  instructions executed per measurement (default 20000000)\n"
+              << "  --repetitions N   measurements per benchmark, the fastest is reported (default 3)\n"
+              << "  --filter TEXT     only run benchmarks whose name contains TEXT\n"
+              << "  --json FILE       also write the results as json to FILE\n"
+              << "  --replay ROM MOVIE  also time a whole replay of a movie recorded with --record, with its own\n"
+              << "                    seed, clock and profile, may be repeated\n";
+}
+
+std::optional<Options> parse_args(int argc, char* argv[]) {
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (i + 1 >= argc)
+            return std::nullopt;
+
+        if (arg == "--engine") {
+            const std::optional<Engine> engine = parse_engine(argv[++i]);
+            if (!engine)
+                return std::nullopt;
+            options.engine = *engine;
+        } else if (arg == "--profile") {
+            const std::optional<QuirkProfile> quirks = parse_quirk_profile(argv[++i]);
+            if (!quirks)
+                return std::nullopt;
+            options.quirks = *quirks;
+        } else if (arg == "--instructions") {
+            options.instructions = std::stoull(argv[++i]);
+        } else if (arg == "--repetitions") {
+            options.repetitions = std::max(1, std::stoi(argv[++i]));
+        } else if (arg == "--filter") {
+            options.filter = argv[++i];
+        } else if (arg == "--json") {
+            options.json_path = argv[++i];
+        } else if (arg == "--replay" && i + 2 < argc) {
+            options.replays.emplace_back(argv[i + 1], argv[i + 2]);
+            i += 2;
+        } else {
+            return std::nullopt;
+        }
+    }
+    return options;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    const std::optional<Options> options = [&]() -> std::optional<Options> {
+        try {
+            return parse_args(argc, argv);
+        } catch (const std::exception&) {
+            return std::nullopt;
+        }
+    }();
+    if (!options) {
+        print_usage(argv[0]);
+        return -1;
+    }
+
+    std::vector<BenchResult> results;
+    std::printf("%-26s %14s %16s\n", "benchmark", "ns/instruction", "instructions/sec");
+    try {
+        for (const BenchCase& bench : make_cases()) {
+            if (bench.name.find(options->filter) == std::string::npos)
+                continue;
+            const BenchResult result = run_case(bench, *options);
+            std::printf("%-26s %14.3f %16.0f\n", result.name.c_str(), result.ns_per_instruction(), result.instructions_per_sec());
+            results.push_back(result);
+        }
+        for (const auto& [rom, movie] : options->replays) {
+            if (replay_name(movie).find(options->filter) == std::string::npos)
+                continue;
+            const BenchResult result = run_replay(rom, movie, *options);
+            std::printf("%-26s %14.3f %16.0f\n", result.name.c_str(), result.ns_per_instruction(), result.instructions_per_sec());
+            results.push_back(result);
+        }
+
+        if (options->json_path)
+            write_json(*options->json_path, results);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << '\n';
+        return -1;
+    }
+
+    return 0;
+}
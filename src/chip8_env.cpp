@@ -0,0 +1,104 @@
+#include "chip8_env.h"
+
+#include "Environment.h"
+
+#include <exception>
+#include <optional>
+#include <stdexcept>
+#include <string>
+
+struct chip8_env {
+    VectorEnvironment environment;
+};
+
+namespace
+{
+
+thread_local std::string last_error;
+
+// runs call and turns any exception into -1 and a message for chip8_env_last_error()
+template <typename Call>
+int guarded(Call&& call) noexcept {
+    try {
+        call();
+        return 0;
+    } catch (const std::exception& e) {
+        last_error = e.what();
+    } catch (...) {
+        last_error = "unknown error";
+    }
+    return -1;
+}
+
+EnvironmentSettings settings_of(const chip8_env_config& config) {
+    EnvironmentSettings settings;
+    if (config.engine) {
+        const std::optional<Engine> engine = parse_engine(config.engine);
+        if (!engine)
+            throw std::invalid_argument(std::string("Unknown engine ") + config.engine);
+        settings.engine = *engine;
+    }
+    if (config.profile) {
+        const std::optional<QuirkProfile> quirks = parse_quirk_profile(config.profile);
+        if (!quirks)
+            throw std::invalid_argument(std::string("Unknown quirk profile ") + config.profile);
+        settings.quirks = *quirks;
+    }
+    if (config.clock_hz != 0)
+        settings.clock_hz = config.clock_hz;
+    settings.threads = config.threads;
+    settings.hires   = config.hires != 0;
+    return settings;
+}
+
+} // namespace
+
+chip8_env* chip8_env_create(const uint8_t* rom, size_t size, const chip8_env_config* config) {
+    chip8_env* env = nullptr;
+    guarded([&] {
+        if (!rom || !config)
+            throw std::invalid_argument("No rom or no config");
+        env = new chip8_env{ VectorEnvironment(rom, size, config->instances, settings_of(*config)) };
+    });
+    return env;
+}
+
+void chip8_env_destroy(chip8_env* env) {
+    delete env;
+}
+
+size_t chip8_env_instances(const chip8_env* env) {
+    return env->environment.size();
+}
+
+size_t chip8_env_observation_size(const chip8_env* env) {
+    return env->environment.observation_size();
+}
+
+int chip8_env_add_reward(chip8_env* env, uint16_t address, int kind, float scale) {
+    return guarded([&] {
+        if (kind != CHIP8_REWARD_VALUE && kind != CHIP8_REWARD_DELTA)
+            throw std::invalid_argument("Unknown reward kind");
+        env->environment.add_reward(address, kind == CHIP8_REWARD_VALUE ? RewardKind::Value : RewardKind::Delta, scale);
+    });
+}
+
+int chip8_env_reset(chip8_env* env, const uint64_t* seeds, uint8_t* observations) {
+    return guarded([&] { env->environment.reset(seeds, observations); });
+}
+
+int chip8_env_reset_instance(chip8_env* env, size_t instance, uint64_t seed, uint8_t* observation) {
+    return guarded([&] {
+        if (instance >= env->environment.size())
+            throw std::out_of_range("No such instance");
+        env->environment.reset(instance, seed, observation);
+    });
+}
+
+int chip8_env_step(chip8_env* env, const uint16_t* actions, uint8_t* observations, float* rewards, uint8_t* done) {
+    return guarded([&] { env->environment.step(actions, observations, rewards, done); });
+}
+
+const char* chip8_env_last_error(void) {
+    return last_error.c_str();
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+/* A plain C interface to VectorEnvironment (see Environment.h), for loading the chip8_env shared library from C,
+ * Python's ctypes or anything else with a C foreign function interface. No exception leaves these functions: those
+ * that can fail return NULL or -1 and leave a message for chip8_env_last_error(). */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(_WIN32)
+#if defined(CHIP8_ENV_EXPORTS)
+#define CHIP8_ENV_API __declspec(dllexport)
+#else
+#define CHIP8_ENV_API __declspec(dllimport)
+#endif
+#else
+#define CHIP8_ENV_API __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct chip8_env chip8_env;
+
+typedef struct chip8_env_config {
+    size_t instances;
+    unsigned threads;    /* 0 for one per hardware thread */
+    const char* engine;  /* "interpreter", "blocks" or "jit", NULL for blocks */
+    const char* profile; /* "default", "vip", "chip48" or "schip", NULL for default */
+    uint32_t clock_hz;   /* instructions per second, 0 for 540 */
+    int hires;           /* nonzero for 128x64 observations instead of 64x32 */
+} chip8_env_config;
+
+enum chip8_reward_kind {
+    CHIP8_REWARD_VALUE = 0, /* scale times the byte at the address */
+    CHIP8_REWARD_DELTA = 1  /* scale times how much the byte changed during the step */
+};
+
+/* Loads instances copies of the size bytes of rom, or returns NULL */
+CHIP8_ENV_API chip8_env* chip8_env_create(const uint8_t* rom, size_t size, const chip8_env_config* config);
+CHIP8_ENV_API void chip8_env_destroy(chip8_env* env);
+
+CHIP8_ENV_API size_t chip8_env_instances(const chip8_env* env);
+/* bytes per instance of the packed observations, 256 or 1024 with hires */
+CHIP8_ENV_API size_t chip8_env_observation_size(const chip8_env* env);
+
+/* Adds a hook to the reward of every step, kind is a chip8_reward_kind. Returns 0, or -1 for an address outside of
+ * memory. */
+CHIP8_ENV_API int chip8_env_add_reward(chip8_env* env, uint16_t address, int kind, float scale);
+
+/* Starts every instance over with seeds[i] and writes their observations, which may be NULL. Returns 0, or -1 if
+ * seeds is NULL. */
+CHIP8_ENV_API int chip8_env_reset(chip8_env* env, const uint64_t* seeds, uint8_t* observations);
+/* Starts one instance over and writes its observation, which may be NULL. Returns 0 or -1. */
+CHIP8_ENV_API int chip8_env_reset_instance(chip8_env* env, size_t instance, uint64_t seed, uint8_t* observation);
+
+/* Holds the keys of actions[i] on instance i for one frame, then writes every instance's observation, reward and
+ * done flag one after the other. Any of the three outputs may be NULL, actions may not. Returns 0 or -1. */
+CHIP8_ENV_API int chip8_env_step(chip8_env* env, const uint16_t* actions, uint8_t* observations, float* rewards, uint8_t* done);
+
+/* What went wrong in the last call on this thread that failed */
+CHIP8_ENV_API const char* chip8_env_last_error(void);
+
+#ifdef __cplusplus
+}
+#endif
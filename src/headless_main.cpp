@@ -0,0 +1,269 @@
+#include "Chip8Emulator.h"
+#include "Engine.h"
+#include "Instrumentation.h"
+#include "Movie.h"
+#include "Quirks.h"
+#include "RomLoader.h"
+#include "Snapshot.h"
+#include "Trace.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace std::chrono;
+
+namespace
+{
+constexpr uint64_t cycles_per_frame = Chip8Emulator::clock_speed_hz / 60; // at the default clock speed
+constexpr uint64_t default_cycles   = 10'000'000;
+
+struct Options {
+    std::string rom_path;
+    std::optional<std::string> load_snapshot_path; // start from this snapshot instead of the rom
+    std::optional<std::string> save_snapshot_path;
+    std::optional<std::string> stats_path; // run the instrumented interpreter and write its counts here
+    std::optional<std::string> trace_path; // run the interpreter and record every instruction here
+    std::optional<std::string> replay_path; // press the keys of this movie, with its seed, clock speed and quirks
+    std::optional<std::string> record_path; // write the answers of --wait-key to this movie
+    uint32_t trace_length = TraceRecorder::default_capacity;
+    Engine engine       = Engine::Interpreter;
+    QuirkProfile quirks = QuirkProfile::Default;
+    std::optional<uint64_t> cycles; // 10000000 by default, or the length of the replayed movie
+    bool frames = false;            // cycles counts 60Hz frames rather than instructions
+    std::optional<uint8_t> wait_key; // key to answer Fx0A with, if not set the run stops on a wait
+    uint64_t seed = 0;
+    bool show_screen = false;
+};
+
+void print_usage(const char* name) {
+    std::cerr << "Usage: " << name << " (path_to_rom | --load-snapshot FILE) [--cycles N | --frames N] [--engine E] [--profile P] [--wait-key K]\n"
+              << "       [--seed N] [--show-screen] [--save-snapshot FILE] [--stats FILE | --trace FILE [--trace-length N]]\n"
+              << "       [--replay FILE | --record FILE]\n"
+              << "  --load-snapshot FILE  continue from a snapshot instead of starting a rom\n"
+              << "  --cycles N      number of instructions to execute (default 10000000, or all of a replayed movie)\n"
+              << "  --frames N      number of 60Hz frames to execute, " << cycles_per_frame << " instructions each at the default\n"
+              << "                  clock speed, or as many as a replayed movie's clock speed runs in a frame\n"
+              << "  --engine E      'interpreter' to run one instruction at a time (default), 'blocks' to use the block\n"
+              << "                  cache or 'jit' to run blocks compiled to native code\n"
+              << "  --profile P     how the instructions the original interpreters disagree on behave: 'default', 'vip'\n"
+              << "                  (COSMAC VIP), 'chip48' or 'schip' (SUPER-CHIP 1.1)\n"
+              << "  --wait-key K    key (0-15) to press whenever the rom waits for input\n"
+              << "  --seed N        seed for the random numbers of Cxkk (default 0), ignored for snapshots\n"
+              << "  --show-screen   print the final contents of the display\n"
+              << "  --save-snapshot FILE  save the machine state to FILE when the run stops\n"
+              << "  --stats FILE    count executions per opcode, skips, draw heights, stack depth and key waits and write\n"
+              << "                  them to FILE as json, only with the interpreter engine\n"
+              << "  --trace FILE    record the last instructions executed to FILE for chip8_trace, only with the\n"
+              << "                  interpreter engine\n"
+              << "  --trace-length N  number of instructions the trace keeps (default " << TraceRecorder::default_capacity
+              << ", at most " << TraceRecorder::max_capacity << ")\n"
+              << "  --replay FILE   press the keys recorded in a movie, with the seed, clock speed and profile it was\n"
+              << "                  recorded with, --wait-key only answers waits after the end of the movie\n"
+              << "  --record FILE   record the run to a movie, which only has the answers of --wait-key\n";
+}
+
+std::optional<Options> parse_args(int argc, char* argv[]) {
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        const bool has_value  = i + 1 < argc;
+        if ((arg == "--cycles" || arg == "--frames") && has_value) {
+            options.cycles = std::stoull(argv[++i]);
+            options.frames = arg == "--frames";
+        } else if (arg == "--engine" && has_value) {
+            const std::optional<Engine> engine = parse_engine(argv[++i]);
+            if (!engine)
+                return std::nullopt;
+            options.engine = *engine;
+        } else if (arg == "--profile" && has_value) {
+            const std::optional<QuirkProfile> quirks = parse_quirk_profile(argv[++i]);
+            if (!quirks)
+                return std::nullopt;
+            options.quirks = *quirks;
+        } else if (arg == "--wait-key" && has_value) {
+            const unsigned long key = std::stoul(argv[++i]);
+            if (key >= 16)
+                return std::nullopt;
+            options.wait_key = static_cast<uint8_t>(key);
+        } else if (arg == "--seed" && has_value) {
+            options.seed = std::stoull(argv[++i]);
+        } else if (arg == "--show-screen") {
+            options.show_screen = true;
+        } else if (arg == "--load-snapshot" && has_value) {
+            options.load_snapshot_path = argv[++i];
+        } else if (arg == "--save-snapshot" && has_value) {
+            options.save_snapshot_path = argv[++i];
+        } else if (arg == "--stats" && has_value) {
+            options.stats_path = argv[++i];
+        } else if (arg == "--trace" && has_value) {
+            options.trace_path = argv[++i];
+        } else if (arg == "--replay" && has_value) {
+            options.replay_path = argv[++i];
+        } else if (arg == "--record" && has_value) {
+            options.record_path = argv[++i];
+        } else if (arg == "--trace-length" && has_value) {
+            const uint64_t length = std::stoull(argv[++i]);
+            if (length > TraceRecorder::max_capacity)
+                return std::nullopt;
+            options.trace_length = static_cast<uint32_t>(length);
+        } else if (options.rom_path.empty() && arg.rfind("--", 0) != 0) {
+            options.rom_path = arg;
+        } else {
+            return std::nullopt;
+        }
+    }
+
+    if (options.rom_path.empty() == !options.load_snapshot_path)
+        return std::nullopt;
+    // only the interpreter loop has instrumented builds, one at a time
+    if ((options.stats_path || options.trace_path) && options.engine != Engine::Interpreter)
+        return std::nullopt;
+    if (options.stats_path && options.trace_path)
+        return std::nullopt;
+    // movies start at power on
+    if ((options.replay_path || options.record_path) && (options.load_snapshot_path || (options.replay_path && options.record_path)))
+        return std::nullopt;
+    return options;
+}
+
+void print_state(const Chip8Emulator& emulator) {
+    const auto& regs = emulator.registers();
+    for (size_t i = 0; i < regs.size(); ++i) {
+        std::printf("V%zX=%02X%c", i, regs[i], i % 8 == 7 ? '\n' : ' ');
+    }
+    std::printf("I=%03X PC=%03X DT=%02X ST=%02X\n", emulator.index(), emulator.pc(),
+                emulator.delay_timer_value(), emulator.sound_timer_value());
+}
+
+void print_screen(const Chip8Emulator& emulator) {
+    for (size_t y = 0; y < emulator.screen_height(); ++y) {
+        for (size_t x = 0; x < emulator.screen_width(); ++x) {
+            std::putchar(Chip8Emulator::pixel_set(emulator.display_rows(), x, y) ? '#' : '.');
+        }
+        std::putchar('\n');
+    }
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    const std::optional<Options> options = [&]() -> std::optional<Options> {
+        try {
+            return parse_args(argc, argv);
+        } catch (const std::exception&) {
+            return std::nullopt;
+        }
+    }();
+    if (!options) {
+        print_usage(argv[0]);
+        return -1;
+    }
+
+    std::optional<Chip8Emulator> emulator;
+    std::optional<TraceRecorder> trace;
+    std::optional<MoviePlayer> player;
+    std::optional<MovieRecorder> recorder;
+    try {
+        if (options->load_snapshot_path) {
+            emulator.emplace(load_snapshot(*options->load_snapshot_path));
+            emulator->set_quirk_profile(options->quirks);
+        } else if (options->replay_path) {
+            const RomFile rom(options->rom_path);
+            player.emplace(load_movie(*options->replay_path));
+            player->check_rom(rom.begin(), rom.size());
+            const MovieHeader& header = player->header();
+            emulator.emplace(rom.begin(), rom.end(), header.seed);
+            emulator->set_quirk_profile(static_cast<QuirkProfile>(header.profile));
+            emulator->set_clock_speed(header.clock_hz);
+        } else {
+            const RomFile rom(options->rom_path);
+            emulator.emplace(rom.begin(), rom.end(), options->seed);
+            emulator->set_quirk_profile(options->quirks);
+            if (options->record_path)
+                recorder.emplace(*options->record_path, movie_header(rom.begin(), rom.size(), options->seed, Chip8Emulator::clock_speed_hz, options->quirks));
+        }
+        if (options->trace_path)
+            trace.emplace(*options->trace_path, options->trace_length);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << '\n';
+        return -1;
+    }
+
+    // a run that continues from a snapshot gets the full budget on top of what the snapshot already executed
+    const uint64_t first_cycle = emulator->cycles();
+    const uint64_t count       = options->cycles.value_or(player ? player->length() : default_cycles);
+    const uint64_t last_cycle  = first_cycle + (options->frames ? count * emulator->cycles_per_frame() : count);
+    const char* stop_reason    = "cycle budget reached";
+    int exit_code              = 0;
+    ExecutionProfile profile;
+    const auto run_some = [&](uint64_t budget) {
+        return trace                 ? emulator->run_cycles(budget, *trace)
+               : options->stats_path ? emulator->run_cycles(budget, profile)
+                                     : run_engine(*emulator, options->engine, budget);
+    };
+    const auto start = steady_clock::now();
+    try {
+        while (emulator->cycles() < last_cycle) {
+            const Chip8Emulator::Action action = player ? player->run(*emulator, last_cycle, run_some) : run_some(last_cycle - emulator->cycles());
+            if (action == Chip8Emulator::Action::Crash) {
+                stop_reason = "emulated program has crashed";
+                exit_code   = -1;
+                break;
+            } else if (action == Chip8Emulator::Action::WaitForInput) {
+                if (!options->wait_key) {
+                    stop_reason = "emulated program is waiting for input";
+                    break;
+                }
+                emulator->key_pressed_upon_wait(*options->wait_key);
+                if (recorder)
+                    recorder->answered(emulator->cycles(), *options->wait_key);
+            }
+        }
+        if (recorder)
+            recorder->finish(emulator->cycles());
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << '\n';
+        return -1;
+    }
+    const duration<double> elapsed = steady_clock::now() - start;
+
+    const auto executed = static_cast<double>(emulator->cycles() - first_cycle);
+    std::printf("stopped: %s\n", stop_reason);
+    if (trace)
+        std::printf("trace: %s\n", options->trace_path->c_str());
+    std::printf("instructions: %llu (%.1f frames)\n", static_cast<unsigned long long>(emulator->cycles() - first_cycle),
+                executed / static_cast<double>(emulator->cycles_per_frame()));
+    std::printf("elapsed: %.6f s\n", elapsed.count());
+    if (elapsed.count() > 0.0)
+        std::printf("instructions/sec: %.0f\n", executed / elapsed.count());
+    print_state(*emulator);
+    if (options->show_screen)
+        print_screen(*emulator);
+
+    if (options->stats_path) {
+        std::ofstream stats(*options->stats_path);
+        profile.write_json(stats, elapsed.count());
+        if (!stats) {
+            std::cerr << "Could not write stats to " << *options->stats_path << '\n';
+            return -1;
+        }
+    }
+
+    if (options->save_snapshot_path) {
+        try {
+            save_snapshot(*options->save_snapshot_path, emulator->snapshot());
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << '\n';
+            return -1;
+        }
+    }
+
+    return exit_code;
+}
@@ -1,28 +1,41 @@
 #include "Chip8Emulator.h"
+#include "Movie.h"
+#include "Quirks.h"
+#include "RomLoader.h"
+#include "Snapshot.h"
+#include "Trace.h"
+#include "TripleBuffer.h"
 
 #define SDL_MAIN_HANDLED
 #include "SDL.h"
-#include "SDL_mixer.h"
 #include <algorithm>
 #include <array>
+#include <atomic>
 #include <cassert>
 #include <chrono>
-#include <fstream>
+#include <cstring>
 #include <iostream>
 #include <iterator>
 #include <memory>
+#include <optional>
+#include <random>
 #include <stdexcept>
+#include <string>
 #include <thread> // this_thread
-#include <vector>
+#include <utility>
 
 using namespace std::chrono;
 
 namespace
 {
-constexpr uint32_t sprite_scale    = 10;
-constexpr auto time_between_cycles = system_clock::duration(seconds(1)) / Chip8Emulator::clock_speed_hz;
-constexpr auto frames_per_second   = 60;
-constexpr auto time_between_draws  = system_clock::duration(seconds(1)) / frames_per_second;
+constexpr uint32_t sprite_scale  = 10;
+constexpr auto frame_duration    = steady_clock::duration(seconds(1)) / 60;
+constexpr SDL_Scancode turbo_key = SDL_SCANCODE_TAB; // runs uncapped while held
+
+constexpr int audio_sample_rate       = 44100;
+constexpr Uint16 audio_buffer_samples = 512;                      // about 12ms of sound per callback
+constexpr uint32_t beep_period        = audio_sample_rate / 440; // samples per period of a 440Hz tone
+constexpr int16_t beep_amplitude      = 4000;
 
 constexpr std::array<SDL_Scancode, 16> key_map = {
     SDL_SCANCODE_KP_0, // 0
@@ -43,6 +56,38 @@ constexpr std::array<SDL_Scancode, 16> key_map = {
     SDL_SCANCODE_F,    // F
 };
 
+constexpr uint32_t pixel_on  = 0xFFFFFFFF;
+constexpr uint32_t pixel_off = 0xFF000000;
+constexpr uint64_t all_rows  = ~uint64_t{ 0 };
+
+// the 8 ARGB pixels that each byte of a display row expands to
+using PixelRun = std::array<uint32_t, 8>;
+std::array<PixelRun, 256> make_pixel_expansion() {
+    std::array<PixelRun, 256> table{};
+    for (size_t byte = 0; byte < table.size(); ++byte) {
+        for (size_t bit = 0; bit < 8; ++bit)
+            table[byte][bit] = (byte >> (7 - bit)) & 1 ? pixel_on : pixel_off;
+    }
+    return table;
+}
+const std::array<PixelRun, 256> pixel_expansion = make_pixel_expansion();
+
+struct Options {
+    std::string rom_path;
+    uint64_t seed       = 0;
+    uint32_t clock_hz   = Chip8Emulator::clock_speed_hz;
+    QuirkProfile quirks = QuirkProfile::Default;
+    std::optional<std::string> trace_path;
+    std::optional<std::string> record_path; // write the keys of the run to this movie
+    std::optional<std::string> replay_path; // play the keys of this movie instead of the keyboard's until it ends
+};
+
+// what the emulation thread publishes for the SDL thread to present
+struct Frame {
+    Chip8Emulator::DisplayRows rows;
+    bool hires;
+};
+
 struct SdlWindowDeleter {
     void operator()(SDL_Window* wnd) { SDL_DestroyWindow(wnd); }
 };
@@ -52,25 +97,41 @@ struct SdlRendererDeleter {
 struct SdlTextureDeleter {
     void operator()(SDL_Texture* txt) { SDL_DestroyTexture(txt); }
 };
-struct SdlMixChunkDeleter {
-    void operator()(Mix_Chunk* chunk) { Mix_FreeChunk(chunk); }
-};
 
 class SdlChip8Emulator {
 public:
+    // options has the seed, clock speed and profile of the movie if there is one to replay
     template <typename InputIt>
-    SdlChip8Emulator(InputIt start, InputIt end)
-        : emulator(start, end) {
+    SdlChip8Emulator(InputIt start, InputIt end, const Options& options, std::optional<MoviePlayer> movie)
+        : snapshot_path(options.rom_path + ".state"),
+          emulator(start, end, options.seed),
+          replay(std::move(movie)) {
+        emulator.set_clock_speed(options.clock_hz);
+        emulator.set_quirk_profile(options.quirks);
+        if (options.record_path) {
+            const MovieHeader header = movie_header(&*start, static_cast<size_t>(std::distance(start, end)), options.seed, options.clock_hz, options.quirks);
+            try {
+                recording.emplace(*options.record_path, header);
+            } catch (const std::exception& e) {
+                std::cerr << e.what() << "\n";
+                throw;
+            }
+        }
+        if (options.trace_path) {
+            try {
+                trace.emplace(*options.trace_path);
+            } catch (const std::exception& e) {
+                std::cerr << e.what() << "\n";
+                throw;
+            }
+            trace_path = *options.trace_path;
+        }
+
         if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_EVENTS | SDL_INIT_AUDIO) != 0) {
             std::cerr << "SDL_Init failed. Error: " << SDL_GetError() << "\n";
             throw std::runtime_error("SDL_Init failed");
         };
 
-        if (Mix_OpenAudio(44100, MIX_DEFAULT_FORMAT, 2, 2048) == -1) {
-            std::cerr << "Mix_OpenAudio: " << Mix_GetError() << "\n";
-            throw std::runtime_error("Mix_OpenAudio failed");
-        }
-
         window = std::unique_ptr<SDL_Window, SdlWindowDeleter>(
             SDL_CreateWindow("Chip8 Emulator", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, 64 * sprite_scale, 32 * sprite_scale, SDL_WINDOW_OPENGL));
         if (!window) {
@@ -89,72 +150,49 @@ public:
             throw std::runtime_error("SDL_RenderSetLogicalSize failed");
         }
 
-        texture = std::unique_ptr<SDL_Texture, SdlTextureDeleter>(SDL_CreateTexture(renderer.get(), SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, 64, 32));
+        // big enough for high resolution, low resolution only uses its top left quarter and is stretched when presented
+        texture = std::unique_ptr<SDL_Texture, SdlTextureDeleter>(SDL_CreateTexture(renderer.get(), SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, 128, 64));
         if (!texture) {
             std::cerr << "Could not create texture for framebuffer: " << SDL_GetError() << "\n";
             throw std::runtime_error("SDL_CreateTexture failed");
         }
 
-        sound_effect = std::unique_ptr<Mix_Chunk, SdlMixChunkDeleter>(Mix_LoadWAV("assets/tone.wav"));
-        if (!sound_effect) {
-            std::cerr << "Failed to load sound effect. SDL_Mixer Error:" << Mix_GetError() << "\n";
-            throw std::runtime_error("Mix_LoadWAV failed");
+        // the beep is generated on the fly, a small buffer keeps the delay between the sound timer and the speaker short
+        SDL_AudioSpec wanted{};
+        wanted.freq     = audio_sample_rate;
+        wanted.format   = AUDIO_S16SYS;
+        wanted.channels = 1;
+        wanted.samples  = audio_buffer_samples;
+        wanted.callback = &SdlChip8Emulator::synthesize_beep;
+        wanted.userdata = this;
+        audio_device    = SDL_OpenAudioDevice(nullptr, 0, &wanted, nullptr, 0);
+        if (audio_device == 0) {
+            std::cerr << "Could not open audio device: " << SDL_GetError() << "\n";
+            throw std::runtime_error("SDL_OpenAudioDevice failed");
+        }
+        SDL_PauseAudioDevice(audio_device, 0);
+
+        wake_event = SDL_RegisterEvents(1);
+        if (wake_event == static_cast<Uint32>(-1)) {
+            std::cerr << "Could not register event: " << SDL_GetError() << "\n";
+            throw std::runtime_error("SDL_RegisterEvents failed");
         }
-        Mix_Volume(-1, MIX_MAX_VOLUME / 8);
     }
 
     SdlChip8Emulator(const SdlChip8Emulator&) = delete;
     SdlChip8Emulator& operator=(const SdlChip8Emulator&) = delete;
     ~SdlChip8Emulator() {
-        Mix_Quit();
+        stop_emulation();
+        SDL_CloseAudioDevice(audio_device);
         SDL_Quit();
     }
 
+    // The emulator runs on its own thread, this one only handles events and presents the frames it publishes.
     int run() {
-        steady_clock::time_point last_cycle_time = steady_clock::now();
-        steady_clock::time_point last_draw_time  = steady_clock::now();
-        bool need_redraw                         = false;
-        while (true) {
-            const auto time_passed = steady_clock::now() - last_cycle_time;
-            if (time_between_cycles > time_passed)
-                std::this_thread::sleep_for(time_between_cycles - time_passed);
-
-            const Chip8Emulator::Action action = emulator.process_next_instruction();
-            last_cycle_time                    = steady_clock::now();
-
-            if (!consume_input())
-                return 0;
-
-            if (action == Chip8Emulator::Action::Crash) {
-                std::cerr << "Emulated program has crashed\n";
-                return -1;
-            } else if (action == Chip8Emulator::Action::WaitForInput) {
-                const int8_t wait_res = wait_for_input();
-                if (wait_res == -1)
-                    return -1;
-                last_cycle_time = steady_clock::now();
-            } else if (action == Chip8Emulator::Action::ReDraw) {
-                need_redraw = true;
-            }
-
-            if (need_redraw && ((steady_clock::now() - last_draw_time) > time_between_draws)) {
-                draw();
-                last_draw_time = steady_clock::now();
-                need_redraw    = false;
-            }
-
-            if (!playing_sound && emulator.should_play_sound()) {
-                if (Mix_PlayChannelTimed(-1, sound_effect.get(), -1, -1) == -1) {
-                    std::cerr << "Error playing sound. Error: " << Mix_GetError() << "\n";
-                }
-                playing_sound = true;
-            } else if (playing_sound && !emulator.should_play_sound()) {
-                Mix_HaltChannel(-1);
-                playing_sound = false;
-            }
-        }
-
-        return 0;
+        emulation_thread = std::thread(&SdlChip8Emulator::emulate, this);
+        const int exit_code = handle_events();
+        stop_emulation();
+        return exit_code;
     }
 
 private:
@@ -163,136 +201,398 @@ private:
 
     // This texture will act as our framebuffer
     std::unique_ptr<SDL_Texture, SdlTextureDeleter> texture;
-    std::unique_ptr<Mix_Chunk, SdlMixChunkDeleter> sound_effect;
 
-    bool playing_sound = false;
+    // only used on the SDL thread
+    bool redraw_everything = true; // the texture starts out undefined and the window may need repainting
+    Frame shown{};                 // what the texture holds
+    Uint32 wake_event = 0;         // pushed by the emulation thread whenever there is something to present
+
+    // only used on the emulation thread once it runs
+    std::string snapshot_path; // F5 saves the machine state here, F9 loads it back
     Chip8Emulator emulator;
+    std::optional<TraceRecorder> trace; // runs the interpreter instead of the block cache, recording every instruction
+    std::string trace_path;
+    std::optional<MoviePlayer> replay;      // presses the keys until it is done, the keyboard takes over from there
+    std::optional<MovieRecorder> recording; // until a snapshot is loaded, which a movie cannot follow
+
+    // shared between the two threads
+    TripleBuffer<Frame> frames;
+    std::atomic<uint16_t> held_keys{ 0 };   // bit i is set while key i is down
+    std::atomic<uint32_t> key_presses{ 0 }; // number of presses so far << 4 | the key of the latest one
+    std::atomic<bool> turbo{ false };
+    std::atomic<bool> paused{ false };
+    std::atomic<bool> save_requested{ false };
+    std::atomic<bool> load_requested{ false };
+    std::atomic<bool> sound_on{ false }; // read by the audio callback, which beeps while it is set
+    std::atomic<bool> quit{ false };     // set by the SDL thread to stop the emulation thread
+    std::atomic<bool> finished{ false }; // set by the emulation thread when the program stops by itself
+    std::atomic<int> emulation_result{ 0 };
+    std::thread emulation_thread;
+
+    SDL_AudioDeviceID audio_device = 0;
+    uint32_t wave_position         = 0; // samples into the current period of the beep, only used by the audio callback
+
+    void stop_emulation() {
+        quit = true;
+        if (emulation_thread.joinable())
+            emulation_thread.join();
+    }
 
-    bool consume_input() {
+    int handle_events() {
         SDL_Event e;
-        while (SDL_PollEvent(&e) != 0) {
-            if (e.type == SDL_QUIT) {
-                return false;
+        while (SDL_WaitEvent(&e) != 0) {
+            if (e.type == wake_event) {
+                present();
+                if (finished)
+                    return emulation_result;
+            } else if (e.type == SDL_QUIT) {
+                return 0;
+            } else if (e.type == SDL_WINDOWEVENT && e.window.event == SDL_WINDOWEVENT_EXPOSED) {
+                redraw_everything = true;
+                present();
             } else if (e.type == SDL_KEYDOWN) {
-                if (e.key.keysym.scancode == SDL_SCANCODE_ESCAPE)
-                    return false;
-                else if (e.key.keysym.scancode == SDL_SCANCODE_F1) {
-                    if (!pause_game())
-                        return false;
+                const SDL_Scancode scancode = e.key.keysym.scancode;
+                if (scancode == SDL_SCANCODE_ESCAPE) {
+                    return 0;
+                } else if (scancode == SDL_SCANCODE_F1) {
+                    paused = !paused;
+                } else if (scancode == SDL_SCANCODE_F5) {
+                    save_requested = true;
+                } else if (scancode == SDL_SCANCODE_F9) {
+                    load_requested = true;
+                } else if (scancode == turbo_key) {
+                    turbo = true;
                 }
 
-                const auto keyIt = std::find(key_map.begin(), key_map.end(), e.key.keysym.scancode);
-                if (keyIt != key_map.end()) {
-                    const auto idx                = static_cast<uint8_t>(std::distance(key_map.begin(), keyIt));
-                    emulator.input_buttons()[idx] = true;
+                if (const std::optional<uint8_t> key = chip8_key(scancode)) {
+                    held_keys.fetch_or(static_cast<uint16_t>(1u << *key));
+                    key_presses = ((key_presses >> 4) + 1) << 4 | *key;
                 }
             } else if (e.type == SDL_KEYUP) {
-                const auto keyIt = std::find(key_map.begin(), key_map.end(), e.key.keysym.scancode);
-                if (keyIt != key_map.end()) {
-                    const auto idx                = static_cast<uint8_t>(std::distance(key_map.begin(), keyIt));
-                    emulator.input_buttons()[idx] = false;
-                }
+                if (e.key.keysym.scancode == turbo_key)
+                    turbo = false;
+                if (const std::optional<uint8_t> key = chip8_key(e.key.keysym.scancode))
+                    held_keys.fetch_and(static_cast<uint16_t>(~(1u << *key)));
             }
         }
 
-        return true;
+        std::cerr << "Wait event error\n";
+        return -1;
     }
 
-    int8_t wait_for_input() {
-        SDL_Event e;
-        while (true) {
-            const int res = SDL_WaitEvent(&e);
-            if (res == 0) {
-                std::cerr << "Wait event error\n";
-                return -1;
-            }
-            if (e.type == SDL_KEYDOWN) {
-                const auto key_it = std::find(key_map.begin(), key_map.end(), e.key.keysym.scancode);
-                if (key_it != key_map.end()) {
-                    const auto idx = std::distance(key_map.begin(), key_it);
-                    emulator.key_pressed_upon_wait(static_cast<uint8_t>(idx));
-                    return 0;
-                }
+    static std::optional<uint8_t> chip8_key(SDL_Scancode scancode) {
+        const auto key_it = std::find(key_map.begin(), key_map.end(), scancode);
+        if (key_it == key_map.end())
+            return std::nullopt;
+        return static_cast<uint8_t>(std::distance(key_map.begin(), key_it));
+    }
+
+    // uploads whatever changed in the latest published frame
+    void present() {
+        uint64_t dirty_rows = redraw_everything ? all_rows : 0;
+        if (frames.update()) {
+            const Frame& frame = frames.front_buffer();
+            for (size_t y = 0; y < Chip8Emulator::hires_height; ++y) {
+                if (frame.rows[0][y] != shown.rows[0][y] || frame.rows[1][y] != shown.rows[1][y])
+                    dirty_rows |= uint64_t{ 1 } << y;
             }
+            if (frame.hires != shown.hires)
+                dirty_rows = all_rows;
+            shown = frame;
+        }
+        if (dirty_rows != 0) {
+            draw(dirty_rows);
+            redraw_everything = false;
         }
     }
 
-    void draw() {
-        std::array<uint32_t, 64 * 32> sdl_pixel_data; // NOLINT - no need to initialise
-        size_t index = 0;
-        for (const auto& row : emulator.video_memory()) {
-            for (const auto& pixel : row) {
-                if (pixel) {
-                    sdl_pixel_data[index] = 0xFFFFFFFF;
-                } else {
-                    sdl_pixel_data[index] = 0xFF000000;
-                }
-                index++;
+    // SDL audio callback, fills stream with a square wave while the sound timer runs and with silence otherwise
+    static void synthesize_beep(void* userdata, Uint8* stream, int length) {
+        auto& self           = *static_cast<SdlChip8Emulator*>(userdata);
+        const bool beeping   = self.sound_on && !self.paused;
+        const size_t samples = static_cast<size_t>(length) / sizeof(int16_t);
+        for (size_t i = 0; i < samples; ++i) {
+            int16_t sample = 0;
+            if (beeping)
+                sample = self.wave_position < beep_period / 2 ? beep_amplitude : -beep_amplitude;
+            self.wave_position = (self.wave_position + 1) % beep_period;
+            std::memcpy(stream + i * sizeof(int16_t), &sample, sizeof(sample));
+        }
+    }
+
+    // uploads the rows set in dirty_rows and presents, the texture still holds every other row from earlier frames
+    void draw(uint64_t dirty_rows) {
+        const size_t height = shown.hires ? Chip8Emulator::hires_height : Chip8Emulator::display_height;
+        size_t y            = 0;
+        while (y < height) {
+            if (((dirty_rows >> y) & 1) == 0) {
+                ++y;
+                continue;
             }
+            // each run of consecutive dirty rows is locked once, every pixel inside a locked rect has to be written
+            size_t end = y;
+            while (end < height && ((dirty_rows >> end) & 1) != 0)
+                ++end;
+            upload_rows(y, end);
+            y = end;
         }
 
-        SDL_UpdateTexture(texture.get(), nullptr, sdl_pixel_data.data(), 64 * 4);
+        const SDL_Rect screen{ 0, 0, static_cast<int>(shown.hires ? Chip8Emulator::hires_width : Chip8Emulator::display_width), static_cast<int>(height) };
         SDL_RenderClear(renderer.get());
-        SDL_RenderCopy(renderer.get(), texture.get(), nullptr, nullptr);
+        SDL_RenderCopy(renderer.get(), texture.get(), &screen, nullptr);
         SDL_RenderPresent(renderer.get());
     }
 
-    bool pause_game() {
-        if (playing_sound)
-            Mix_HaltChannel(-1);
+    void upload_rows(size_t first, size_t last) {
+        const size_t width = shown.hires ? Chip8Emulator::hires_width : Chip8Emulator::display_width;
+        const SDL_Rect rect{ 0, static_cast<int>(first), static_cast<int>(width), static_cast<int>(last - first) };
+        void* pixels = nullptr;
+        int pitch    = 0;
+        if (SDL_LockTexture(texture.get(), &rect, &pixels, &pitch) != 0) {
+            std::cerr << "Could not lock framebuffer texture: " << SDL_GetError() << "\n";
+            return;
+        }
 
-        bool ret_val = false;
-        SDL_Event e;
-        while (true) {
-            const int res = SDL_WaitEvent(&e);
-            if (res == 0) {
-                std::cerr << "Wait event error\n";
-                ret_val = false;
-                break;
+        for (size_t y = first; y < last; ++y) {
+            uint8_t* line = static_cast<uint8_t*>(pixels) + (y - first) * static_cast<size_t>(pitch);
+            for (size_t byte = 0; byte < width / 8; ++byte) {
+                const PixelRun& run = pixel_expansion[(shown.rows[byte / 8][y] >> (56 - 8 * (byte % 8))) & 0xFF];
+                std::memcpy(line + byte * sizeof(PixelRun), run.data(), sizeof(PixelRun));
             }
-            if (e.type == SDL_KEYDOWN) {
-                if (e.key.keysym.scancode == SDL_SCANCODE_F1) {
-                    ret_val = true;
-                    break;
-                } else if (e.key.keysym.scancode == SDL_SCANCODE_ESCAPE) {
-                    ret_val = false;
-                    break;
+        }
+        SDL_UnlockTexture(texture.get());
+    }
+
+    // Emulation thread. Every pass runs one 60Hz frame of instructions in a burst, publishes it and then waits once
+    // for the next frame to be due. While the turbo key is held frames run back to back for a whole frame of real
+    // time, and only the last of them is published.
+    void emulate() {
+        steady_clock::time_point next_frame = steady_clock::now();
+        while (!quit) {
+            if (paused) {
+                std::this_thread::sleep_for(frame_duration);
+                next_frame = steady_clock::now();
+                continue;
+            }
+            if (save_requested.exchange(false))
+                save_state();
+            if (load_requested.exchange(false))
+                load_state();
+
+            if (!replaying()) {
+                const uint16_t keys = held_keys;
+                for (size_t key = 0; key < emulator.input_buttons().size(); ++key)
+                    emulator.input_buttons()[key] = ((keys >> key) & 1) != 0;
+                if (recording)
+                    recording->keys(emulator.cycles(), emulator.input_buttons());
+            }
+
+            const steady_clock::time_point burst_start = steady_clock::now();
+            do {
+                if (const std::optional<int> exit_code = run_frame()) {
+                    stop_recording();
+                    emulation_result = *exit_code;
+                    finished         = true;
+                    wake();
+                    return;
+                }
+            } while (turbo && !quit && steady_clock::now() - burst_start < frame_duration);
+
+            publish();
+
+            // after a stall (pause, a wait for a key) carry on from now instead of racing to catch up
+            next_frame += frame_duration;
+            const steady_clock::time_point now = steady_clock::now();
+            if (turbo || next_frame + frame_duration < now)
+                next_frame = now;
+            else
+                std::this_thread::sleep_until(next_frame);
+        }
+        stop_recording();
+    }
+
+    // runs the instructions up to the end of the current frame, returns an exit code if the program has to stop
+    std::optional<int> run_frame() {
+        const uint64_t frame_length = emulator.cycles_per_frame();
+        const uint64_t frame_end    = (emulator.cycles() / frame_length + 1) * frame_length;
+        const auto run_some         = [&](uint64_t budget) {
+            return trace ? emulator.run_cycles(budget, *trace) : emulator.run_blocks(budget);
+        };
+        while (emulator.cycles() < frame_end) {
+            Chip8Emulator::Action action = Chip8Emulator::Action::DoNothing;
+            try {
+                action = replaying() ? replay->run(emulator, frame_end, run_some) : run_some(frame_end - emulator.cycles());
+            } catch (const std::exception& e) {
+                std::cerr << e.what() << "\n";
+                return -1;
+            }
+            if (replay && replay->done()) {
+                std::cerr << "The movie has ended, the keyboard takes over\n";
+                replay.reset();
+            }
+            if (action == Chip8Emulator::Action::Crash) {
+                std::cerr << "Emulated program has crashed\n";
+                if (trace)
+                    std::cerr << "The instructions leading up to it are in " << trace_path << ", see chip8_trace\n";
+                return -1;
+            } else if (action == Chip8Emulator::Action::WaitForInput) {
+                if (replaying()) {
+                    std::cerr << "The movie does not answer the key wait at cycle " << emulator.cycles() << ", it belongs to another run\n";
+                    return -1;
                 }
+                // show what the program drew before it asks for input
+                publish();
+                if (!wait_for_key())
+                    return 0;
             }
         }
+        return std::nullopt;
+    }
+
+    // hands the display to the SDL thread if it changed and the sound state to the audio callback
+    void publish() {
+        sound_on = emulator.should_play_sound();
+        if (emulator.take_dirty_rows() != 0) {
+            frames.back_buffer() = { emulator.display_rows(), emulator.hires() };
+            frames.publish();
+            wake();
+        }
+    }
 
-        if (playing_sound) {
-            if (Mix_PlayChannelTimed(-1, sound_effect.get(), -1, -1) == -1) {
-                std::cerr << "Error playing sound. Error: " << Mix_GetError() << "\n";
+    void wake() {
+        SDL_Event event{};
+        event.type = wake_event;
+        if (SDL_PushEvent(&event) < 0)
+            std::cerr << "Could not push event: " << SDL_GetError() << "\n";
+    }
+
+    // waits for a key to be pressed and hands it to the emulator, returns false if the program is to quit instead
+    bool wait_for_key() {
+        const uint32_t presses_before = key_presses;
+        while (!quit) {
+            const uint32_t presses = key_presses;
+            if (presses != presses_before) {
+                emulator.key_pressed_upon_wait(static_cast<uint8_t>(presses & 0xF));
+                if (recording)
+                    recording->answered(emulator.cycles(), static_cast<uint8_t>(presses & 0xF));
+                return true;
             }
+            std::this_thread::sleep_for(milliseconds(1));
         }
+        return false;
+    }
+
+    bool replaying() const { return replay && !replay->done(); }
+
+    // ends the movie at the current cycle, if one is being recorded
+    void stop_recording() {
+        if (!recording)
+            return;
+        try {
+            recording->finish(emulator.cycles());
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << "\n";
+        }
+        recording.reset();
+    }
+
+    void save_state() {
+        try {
+            save_snapshot(snapshot_path, emulator.snapshot());
+            std::cerr << "Saved state to " << snapshot_path << "\n";
+        } catch (const std::exception& e) {
+            std::cerr << "Could not save state: " << e.what() << "\n";
+        }
+    }
 
-        return ret_val;
+    void load_state() {
+        if (replaying()) {
+            std::cerr << "Snapshots cannot be loaded while a movie plays\n";
+            return;
+        }
+        if (recording) {
+            stop_recording();
+            std::cerr << "Stopped recording, a movie cannot continue from a loaded snapshot\n";
+        }
+        try {
+            emulator.restore(load_snapshot(snapshot_path));
+            std::cerr << "Loaded state from " << snapshot_path << "\n";
+        } catch (const std::exception& e) {
+            std::cerr << "Could not load state: " << e.what() << "\n";
+        }
     }
 }; // namespace
 
 } // namespace
 
 int main(int argc, char* argv[]) {
-    if (argc != 2) {
-        std::cerr << "Usage: " << argv[0] << " path_to_rom\n";
-        return -1;
+    Options options;
+    bool has_seed = false;
+    try {
+        for (int i = 1; i < argc; ++i) {
+            const std::string arg = argv[i];
+            const bool has_value  = i + 1 < argc;
+            if (arg == "--seed" && has_value) {
+                options.seed = std::stoull(argv[++i]);
+                has_seed     = true;
+            } else if (arg == "--clock" && has_value) {
+                options.clock_hz = static_cast<uint32_t>(std::stoul(argv[++i]));
+            } else if (arg == "--profile" && has_value) {
+                const std::optional<QuirkProfile> quirks = parse_quirk_profile(argv[++i]);
+                if (!quirks) {
+                    options.rom_path.clear();
+                    break;
+                }
+                options.quirks = *quirks;
+            } else if (arg == "--trace" && has_value) {
+                options.trace_path = argv[++i];
+            } else if (arg == "--record" && has_value) {
+                options.record_path = argv[++i];
+            } else if (arg == "--replay" && has_value) {
+                options.replay_path = argv[++i];
+            } else if (options.rom_path.empty() && arg.rfind("--", 0) != 0) {
+                options.rom_path = arg;
+            } else {
+                options.rom_path.clear();
+                break;
+            }
+        }
+    } catch (const std::exception&) {
+        options.rom_path.clear();
     }
-
-    std::ifstream file(argv[1], std::ios_base::binary);
-    if (!file.is_open()) {
-        std::cerr << "Could not find rom " << argv[1] << '\n';
+    if (options.rom_path.empty() || options.clock_hz < 60 || (options.record_path && options.replay_path)) {
+        std::cerr << "Usage: " << argv[0] << " path_to_rom [--seed N] [--clock HZ] [--profile P] [--trace FILE] [--record FILE | --replay FILE]\n"
+                  << "  --seed N    seed for the random numbers of Cxkk, by default every run is different\n"
+                  << "  --clock HZ  instructions per second, at least 60 (default " << Chip8Emulator::clock_speed_hz << ")\n"
+                  << "  --profile P  quirks of 'default', 'vip' (COSMAC VIP), 'chip48' or 'schip' (SUPER-CHIP 1.1)\n"
+                  << "  --trace FILE  record the last instructions executed to FILE, to see what led up to a crash\n"
+                  << "  --record FILE  record every key press and release to a movie that replays the run exactly\n"
+                  << "  --replay FILE  play a movie with the seed, clock and profile it was recorded with, then hand over\n"
+                  << "                 to the keyboard\n"
+                  << "Hold Tab to run as fast as possible.\n";
         return -1;
     }
+    if (!has_seed)
+        options.seed = std::random_device{}();
 
-    const std::vector<uint8_t> program_bytes{ std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>() };
-    if (program_bytes.empty()) {
-        std::cerr << "rom is empty\n";
+    std::optional<RomFile> rom;
+    std::optional<MoviePlayer> movie;
+    try {
+        rom.emplace(options.rom_path);
+        if (options.replay_path) {
+            movie.emplace(load_movie(*options.replay_path));
+            movie->check_rom(rom->begin(), rom->size());
+            options.seed     = movie->header().seed;
+            options.clock_hz = movie->header().clock_hz;
+            options.quirks   = static_cast<QuirkProfile>(movie->header().profile);
+        }
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << '\n';
         return -1;
     }
 
     try {
-        SdlChip8Emulator app(program_bytes.begin(), program_bytes.end());
+        SdlChip8Emulator app(rom->begin(), rom->end(), options, std::move(movie));
         return app.run();
     } catch (...) {
         return -1;
@@ -0,0 +1,132 @@
+#include "Engine.h"
+#include "Regression.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace std::chrono;
+
+namespace
+{
+
+struct Options {
+    std::string manifest_path;
+    Engine engine    = Engine::Blocks;
+    bool lockstep    = false;
+    unsigned threads = 0;
+    bool update      = false;
+};
+
+void print_usage(const char* name) {
+    std::cerr << "Usage: " << name << " manifest [--engine E | --lockstep] [--threads N] [--update]\n"
+              << "  --engine E      'interpreter', 'blocks' (default) or 'jit'\n"
+              << "  --lockstep      run every case through the SIMD lockstep runner of chip8_batch\n"
+              << "  --threads N     worker threads, by default one per hardware thread\n"
+              << "  --update        record the hashes of this run in the manifest instead of checking them\n";
+}
+
+std::optional<Options> parse_args(int argc, char* argv[]) {
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        const bool has_value  = i + 1 < argc;
+        if (arg == "--engine" && has_value) {
+            const std::optional<Engine> engine = parse_engine(argv[++i]);
+            if (!engine)
+                return std::nullopt;
+            options.engine = *engine;
+        } else if (arg == "--lockstep") {
+            options.lockstep = true;
+        } else if (arg == "--threads" && has_value) {
+            options.threads = static_cast<unsigned>(std::stoul(argv[++i]));
+        } else if (arg == "--update") {
+            options.update = true;
+        } else if (options.manifest_path.empty() && arg.rfind("--", 0) != 0) {
+            options.manifest_path = arg;
+        } else {
+            return std::nullopt;
+        }
+    }
+
+    if (options.manifest_path.empty())
+        return std::nullopt;
+    return options;
+}
+
+// prints why a case failed and returns true, returns false if it passed
+bool report_failure(const RegressionCase& test, const RegressionResult& result) {
+    if (!result.error.empty()) {
+        std::printf("FAIL %s: %s\n", test.name.c_str(), result.error.c_str());
+        return true;
+    }
+    for (size_t i = 0; i < test.checkpoints.size(); ++i) {
+        const RegressionCase::Checkpoint& checkpoint = test.checkpoints[i];
+        if (!checkpoint.expected) {
+            std::printf("FAIL %s: no hash recorded for frame %llu, run with --update\n", test.name.c_str(),
+                        static_cast<unsigned long long>(checkpoint.frame));
+            return true;
+        }
+        if (*checkpoint.expected != result.hashes[i]) {
+            std::printf("FAIL %s: frames up to %llu hash to %016llx instead of %016llx", test.name.c_str(),
+                        static_cast<unsigned long long>(checkpoint.frame), static_cast<unsigned long long>(result.hashes[i]),
+                        static_cast<unsigned long long>(*checkpoint.expected));
+            if (result.crash_frame)
+                std::printf(", crashed in frame %llu", static_cast<unsigned long long>(*result.crash_frame));
+            std::printf("\n");
+            return true;
+        }
+    }
+    return false;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    const std::optional<Options> options = [&]() -> std::optional<Options> {
+        try {
+            return parse_args(argc, argv);
+        } catch (const std::exception&) {
+            return std::nullopt;
+        }
+    }();
+    if (!options) {
+        print_usage(argv[0]);
+        return -1;
+    }
+
+    RegressionManifest manifest;
+    try {
+        manifest = load_manifest(options->manifest_path);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << '\n';
+        return -1;
+    }
+
+    const auto start                            = steady_clock::now();
+    const std::vector<RegressionResult> results = run_regression(manifest, options->engine, options->lockstep, options->threads);
+    const duration<double> elapsed              = steady_clock::now() - start;
+
+    size_t failed = 0;
+    for (size_t i = 0; i < results.size(); ++i) {
+        // an update records whatever the roms do now, only cases that could not run at all fail it
+        if ((!options->update || !results[i].error.empty()) && report_failure(manifest.cases[i], results[i]))
+            ++failed;
+    }
+    std::printf("%zu cases, %zu failed, %.3f s\n", results.size(), failed, elapsed.count());
+
+    if (options->update) {
+        try {
+            save_manifest(manifest, results);
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << '\n';
+            return -1;
+        }
+    }
+    return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,149 @@
+#include "Instruction.h"
+#include "Trace.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <optional>
+#include <stdexcept>
+#include <string>
+
+namespace
+{
+
+struct Options {
+    std::string trace_path;
+    std::optional<uint64_t> last; // only the last N records
+    uint16_t pc_from = 0;
+    uint16_t pc_to   = 0xFFFF;
+    std::string op_filter; // only records whose disassembly contains this
+};
+
+void print_usage(const char* name) {
+    std::cerr << "Usage: " << name << " trace_file [--last N] [--pc ADDR | --pc FROM-TO] [--op TEXT]\n"
+              << "  --last N          only show the last N instructions recorded\n"
+              << "  --pc ADDR         only show instructions at ADDR (hex), or at FROM-TO inclusive\n"
+              << "  --op TEXT         only show instructions whose disassembly contains TEXT, e.g. DRW or V3\n";
+}
+
+std::optional<Options> parse_args(int argc, char* argv[]) {
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        const bool has_value  = i + 1 < argc;
+        if (arg == "--last" && has_value) {
+            options.last = std::stoull(argv[++i]);
+        } else if (arg == "--pc" && has_value) {
+            const std::string range = argv[++i];
+            const size_t dash       = range.find('-');
+            options.pc_from         = static_cast<uint16_t>(std::stoul(range.substr(0, dash), nullptr, 16));
+            options.pc_to           = dash == std::string::npos ? options.pc_from
+                                                                : static_cast<uint16_t>(std::stoul(range.substr(dash + 1), nullptr, 16));
+        } else if (arg == "--op" && has_value) {
+            options.op_filter = argv[++i];
+        } else if (options.trace_path.empty() && arg.rfind("--", 0) != 0) {
+            options.trace_path = arg;
+        } else {
+            return std::nullopt;
+        }
+    }
+
+    if (options.trace_path.empty())
+        return std::nullopt;
+    return options;
+}
+
+// the registers the instruction wrote, with the values it left in them
+std::string effects(const TraceRecord& record) {
+    const Instruction& instruction = decoded(record.opcode);
+    bool writes_vx                 = false;
+    bool writes_vf                 = false;
+    bool writes_index              = false;
+    switch (instruction.op) {
+    case Op::AddReg:
+    case Op::Sub:
+    case Op::Shr:
+    case Op::Subn:
+    case Op::Shl: writes_vx = writes_vf = true; break;
+    case Op::LdByte:
+    case Op::Add:
+    case Op::LdReg:
+    case Op::Or:
+    case Op::And:
+    case Op::Xor:
+    case Op::Rnd:
+    case Op::LdDt:
+    case Op::LdRegStore:
+    case Op::LdFlagsStore: writes_vx = true; break;
+    case Op::Drw: writes_vf = true; break;
+    case Op::LdAddr:
+    case Op::AddIdxReg:
+    case Op::LdFont:
+    case Op::LdHiresFont: writes_index = true; break;
+    default: break;
+    }
+
+    std::string text;
+    char field[16];
+    // for 8xyN with x = F the flag overwrites the result
+    if (writes_vx && instruction.x != 15) {
+        std::snprintf(field, sizeof(field), "V%X=%02X ", unsigned{ instruction.x }, unsigned{ record.vx });
+        text += field;
+    }
+    if (writes_vf || (writes_vx && instruction.x == 15)) {
+        std::snprintf(field, sizeof(field), "VF=%02X ", unsigned{ record.vf });
+        text += field;
+    }
+    if (writes_index) {
+        std::snprintf(field, sizeof(field), "I=%03X ", unsigned{ record.index });
+        text += field;
+    }
+    if (!text.empty())
+        text.pop_back();
+    return text;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    const std::optional<Options> options = [&]() -> std::optional<Options> {
+        try {
+            return parse_args(argc, argv);
+        } catch (const std::exception&) {
+            return std::nullopt;
+        }
+    }();
+    if (!options) {
+        print_usage(argv[0]);
+        return -1;
+    }
+
+    Trace trace;
+    try {
+        trace = load_trace(options->trace_path);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << '\n';
+        return -1;
+    }
+
+    const size_t count = trace.records.size();
+    const size_t skip  = options->last && *options->last < count ? count - static_cast<size_t>(*options->last) : 0;
+    std::printf("executed: %llu instructions, the last %zu recorded\n",
+                static_cast<unsigned long long>(trace.first_record + count), count);
+    for (size_t i = skip; i < count; ++i) {
+        const TraceRecord& record = trace.records[i];
+        if (record.pc < options->pc_from || record.pc > options->pc_to)
+            continue;
+        const std::string text = disassemble(record.opcode);
+        if (text.find(options->op_filter) == std::string::npos)
+            continue;
+        std::printf("%12llu  %03X  %04X  ", static_cast<unsigned long long>(trace.first_record + i), unsigned{ record.pc },
+                    unsigned{ record.opcode });
+        const std::string changes = effects(record);
+        if (changes.empty())
+            std::printf("%s\n", text.c_str());
+        else
+            std::printf("%-18s %s\n", text.c_str(), changes.c_str());
+    }
+    return 0;
+}
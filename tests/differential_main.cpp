@@ -0,0 +1,447 @@
+#include "BatchRunner.h"
+#include "Chip8Emulator.h"
+#include "Engine.h"
+#include "Quirks.h"
+#include "RandomNumberGenerator.h"
+#include "Snapshot.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <iterator>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#if defined(__x86_64__) && defined(__unix__)
+#    include <sys/mman.h>
+#    include <sys/syscall.h>
+#    include <unistd.h>
+#    define CHIP8_TEST_MPROTECT 1
+#else
+#    define CHIP8_TEST_MPROTECT 0
+#endif
+
+// Runs generated roms with every engine and checks that each ends up in exactly the state of the plain interpreter,
+// process_next_instruction() one instruction at a time, byte for byte in their snapshots.
+
+#if CHIP8_TEST_MPROTECT
+namespace
+{
+int mprotect_calls        = 0;
+int failing_mprotect_call = 0; // counts down to the call that fails, 0 for none
+} // namespace
+
+// Stands in for the libc mprotect() the compiler links against, to act like a kernel that forbids making the code
+// buffer writable or executable again
+extern "C" int mprotect(void* address, size_t length, int protection) noexcept {
+    ++mprotect_calls;
+    if (failing_mprotect_call != 0 && --failing_mprotect_call == 0) {
+        errno = EACCES;
+        return -1;
+    }
+    return static_cast<int>(syscall(SYS_mprotect, address, length, protection));
+}
+#endif
+
+namespace
+{
+
+constexpr uint8_t answer_key        = 5;  // answers every Fx0A
+constexpr size_t lockstep_instances = 17; // a whole lockstep group and part of another
+
+struct Options {
+    size_t roms     = 128;
+    uint64_t cycles = 10000;
+    uint64_t seed   = 1;
+};
+
+constexpr std::pair<const char*, QuirkProfile> profiles[] = {
+    { "default", QuirkProfile::Default },
+    { "vip", QuirkProfile::CosmacVip },
+    { "chip48", QuirkProfile::Chip48 },
+    { "schip", QuirkProfile::Schip },
+};
+
+constexpr std::pair<const char*, Engine> engines[] = {
+    { "interpreter", Engine::Interpreter },
+    { "blocks", Engine::Blocks },
+    { "jit", Engine::Jit },
+};
+
+// Random programs that mostly stay runnable. The rom starts with a jump over a few short subroutines to a main loop,
+// jumps and Bnnn land on instructions of the main loop and calls on the subroutines, I mostly points into the program
+// or the fonts, and only a few opcodes are invalid or return without a call. Fx55 into the program rewrites code as it
+// runs, and the main loop has idle loops in it for the engines to skip.
+class RomGenerator {
+public:
+    static constexpr size_t program_words    = 192;
+    static constexpr size_t subroutine_words = 40;
+
+    explicit RomGenerator(uint64_t seed) noexcept
+        : random(seed) {}
+
+    std::vector<uint8_t> next_rom() {
+        std::vector<uint16_t> words = { 0 };
+        subroutines.clear();
+        while (words.size() < subroutine_words) {
+            subroutines.push_back(address_of(words.size()));
+            for (uint16_t length = below(4); length != 0; --length)
+                add_instruction(words, true);
+            words.push_back(0x00EE);
+        }
+
+        main_loop = words.size();
+        words[0]  = static_cast<uint16_t>(0x1000 | address_of(main_loop));
+        while (words.size() < program_words - 1)
+            add_instruction(words, false);
+        words.push_back(static_cast<uint16_t>(0x1000 | address_of(main_loop)));
+
+        std::vector<uint8_t> bytes;
+        for (const uint16_t word : words) {
+            bytes.push_back(static_cast<uint8_t>(word >> 8));
+            bytes.push_back(static_cast<uint8_t>(word & 0xFF));
+        }
+        return bytes;
+    }
+
+private:
+    RandomNumberGenerator random;
+    std::vector<uint16_t> subroutines;
+    size_t main_loop = 0; // in words
+
+    static uint16_t address_of(size_t word) noexcept { return static_cast<uint16_t>(load_address + 2 * word); }
+
+    uint16_t byte() noexcept { return random.next(); }
+    uint16_t word() noexcept {
+        const uint16_t high = byte();
+        return static_cast<uint16_t>(high << 8 | byte());
+    }
+    uint16_t below(size_t limit) noexcept { return static_cast<uint16_t>(word() % limit); }
+    uint16_t reg() noexcept { return below(16); }
+    uint16_t main_loop_address(size_t spare_words) noexcept {
+        return address_of(main_loop + below(program_words - main_loop - spare_words));
+    }
+    uint16_t data_address() noexcept {
+        // the fonts, the program itself, anywhere up to the end of memory or data well clear of the program
+        switch (below(4)) {
+        case 0: return below(0x100);
+        case 1: return static_cast<uint16_t>(load_address + below(2 * program_words));
+        case 2: return below(0x1000);
+        default: return static_cast<uint16_t>(0x600 + below(0x100));
+        }
+    }
+
+    // a loop that Chip8Emulator::skip_idle_loop() skips over, waiting for the delay timer, a key or forever
+    void add_idle_loop(std::vector<uint16_t>& words, uint16_t x) noexcept {
+        const auto jump_back = [&](size_t start) { words.push_back(static_cast<uint16_t>(0x1000 | address_of(start))); };
+        switch (below(5)) {
+        case 0: {
+            // LD Vx, DT / SE Vx, 0 / JP back after setting the timer, sometimes with a constant load in between
+            words.push_back(static_cast<uint16_t>(0x6000 | x << 8 | below(8)));
+            words.push_back(static_cast<uint16_t>(0xF015 | x << 8));
+            const size_t start = words.size();
+            if (below(2) == 0)
+                words.push_back(static_cast<uint16_t>(0xA000 | data_address()));
+            words.push_back(static_cast<uint16_t>(0xF007 | x << 8));
+            words.push_back(static_cast<uint16_t>(0x3000 | x << 8));
+            jump_back(start);
+            break;
+        }
+        case 1: {
+            // the skip jumps over the way out onto the jump back, SNE Vx, 0 / JP out / JP back
+            words.push_back(static_cast<uint16_t>(0x6000 | x << 8 | below(8)));
+            words.push_back(static_cast<uint16_t>(0xF015 | x << 8));
+            const size_t start = words.size();
+            words.push_back(static_cast<uint16_t>(0xF007 | x << 8));
+            words.push_back(static_cast<uint16_t>(0x4000 | x << 8));
+            words.push_back(static_cast<uint16_t>(0x1000 | address_of(start + 4)));
+            jump_back(start);
+            break;
+        }
+        case 2:
+        case 3: {
+            // SKP or SKNP Vx / JP back, for a key that may or may not be held
+            words.push_back(static_cast<uint16_t>(0x6000 | x << 8 | (below(2) == 0 ? answer_key : below(16))));
+            const size_t start = words.size();
+            words.push_back(static_cast<uint16_t>((below(2) == 0 ? 0xE09E : 0xE0A1) | x << 8));
+            jump_back(start);
+            break;
+        }
+        default:
+            // rarely JP self, which spins until the budget runs out
+            if (below(4) == 0)
+                jump_back(words.size());
+            break;
+        }
+    }
+
+    // adds one instruction, or two for those that need a register set up first
+    void add_instruction(std::vector<uint16_t>& words, bool straight_line) noexcept {
+        const uint16_t x = reg();
+        const uint16_t y = reg();
+        // the first four change the pc for good, subroutines do without them
+        switch (straight_line ? 4 + below(28) : below(32)) {
+        case 0: words.push_back(static_cast<uint16_t>(0x1000 | main_loop_address(0))); break;
+        case 1: words.push_back(static_cast<uint16_t>(0x2000 | subroutines[below(subroutines.size())])); break;
+        case 2: words.push_back(below(16) == 0 ? 0x00EE : 0x00E0); break;
+        case 3:
+            // V0 stays small enough to land inside the main loop
+            words.push_back(static_cast<uint16_t>(0x6000 | below(16)));
+            words.push_back(static_cast<uint16_t>(0xB000 | main_loop_address(8)));
+            break;
+        case 4: words.push_back(static_cast<uint16_t>(0x3000 | x << 8 | byte() % 4)); break;
+        case 5: words.push_back(static_cast<uint16_t>(0x4000 | x << 8 | byte() % 4)); break;
+        case 6: words.push_back(static_cast<uint16_t>(0x5000 | x << 8 | y << 4)); break;
+        case 7: words.push_back(static_cast<uint16_t>(0x9000 | x << 8 | y << 4)); break;
+        case 8:
+        case 9: words.push_back(static_cast<uint16_t>(0x6000 | x << 8 | byte())); break;
+        case 10:
+        case 11: words.push_back(static_cast<uint16_t>(0x7000 | x << 8 | byte())); break;
+        case 12:
+        case 13:
+        case 14: {
+            constexpr uint16_t alu[] = { 0x0, 0x1, 0x2, 0x3, 0x4, 0x5, 0x6, 0x7, 0xE };
+            words.push_back(static_cast<uint16_t>(0x8000 | x << 8 | y << 4 | alu[below(9)]));
+            break;
+        }
+        case 15:
+        case 16: words.push_back(static_cast<uint16_t>(0xA000 | data_address())); break;
+        case 17: words.push_back(static_cast<uint16_t>(0xC000 | x << 8 | byte())); break;
+        case 18:
+        case 19: words.push_back(static_cast<uint16_t>(0xD000 | x << 8 | y << 4 | below(16))); break;
+        case 20:
+            // keys past F crash
+            words.push_back(static_cast<uint16_t>(0x6000 | x << 8 | below(16)));
+            words.push_back(static_cast<uint16_t>((byte() & 1 ? 0xE09E : 0xE0A1) | x << 8));
+            break;
+        case 21: {
+            constexpr uint16_t timers[] = { 0x07, 0x15, 0x18, 0x1E, 0x29, 0x30 };
+            words.push_back(static_cast<uint16_t>(0xF000 | x << 8 | timers[below(6)]));
+            break;
+        }
+        case 22: {
+            constexpr uint16_t memory_ops[] = { 0x33, 0x55, 0x65, 0x75, 0x85 };
+            words.push_back(static_cast<uint16_t>(0xF000 | x << 8 | memory_ops[below(5)]));
+            break;
+        }
+        case 23: words.push_back(below(8) == 0 ? static_cast<uint16_t>(0xF00A | x << 8) : 0x00E0); break;
+        case 24: {
+            constexpr uint16_t screen_ops[] = { 0x00FB, 0x00FC, 0x00FE, 0x00FF, 0x00C1, 0x00C4 };
+            words.push_back(screen_ops[below(6)]);
+            break;
+        }
+        case 25: words.push_back(below(8) == 0 ? word() : 0x0123); break;
+        case 26:
+            if (!straight_line)
+                add_idle_loop(words, x);
+            break;
+        case 27:
+            // writes V0 and maybe V1 over code of the main loop, which may already be cached or compiled
+            words.push_back(static_cast<uint16_t>(0xA000 | main_loop_address(0)));
+            words.push_back(static_cast<uint16_t>(0xF055 | below(2) << 8));
+            break;
+        default: words.push_back(static_cast<uint16_t>(0x7000 | x << 8 | 1)); break;
+        }
+    }
+};
+
+// Runs emulator up to last_cycle with run_some(budget), answering every Fx0A, until it crashes
+template <typename RunSome>
+void run_until(Chip8Emulator& emulator, uint64_t last_cycle, RunSome&& run_some) {
+    while (emulator.cycles() < last_cycle) {
+        const Chip8Emulator::Action action = run_some(last_cycle - emulator.cycles());
+        if (action == Chip8Emulator::Action::Crash)
+            return;
+        if (action == Chip8Emulator::Action::WaitForInput)
+            emulator.key_pressed_upon_wait(answer_key);
+    }
+}
+
+// the state after power on with held_keys down, which every engine starts from
+Snapshot power_on(const std::vector<uint8_t>& rom, uint64_t seed, uint16_t held_keys) {
+    Chip8Emulator emulator(rom.begin(), rom.end(), seed);
+    for (size_t key = 0; key < 16; ++key)
+        emulator.input_buttons()[key] = (held_keys >> key & 1) != 0;
+    return emulator.snapshot();
+}
+
+Chip8Emulator machine(const Snapshot& start, QuirkProfile quirks) {
+    Chip8Emulator emulator(start);
+    emulator.set_quirk_profile(quirks);
+    return emulator;
+}
+
+Snapshot reference_run(const Snapshot& start, QuirkProfile quirks, uint64_t cycles) {
+    Chip8Emulator emulator = machine(start, quirks);
+    run_until(emulator, cycles, [&](uint64_t) { return emulator.process_next_instruction(); });
+    return emulator.snapshot();
+}
+
+// prints where two snapshots part and returns true if they do
+bool differs(const Snapshot& expected, const Snapshot& actual, const std::string& what) {
+    if (std::memcmp(&expected, &actual, sizeof(Snapshot)) == 0)
+        return false;
+    std::printf("FAIL %s: pc %03X after %llu instructions instead of pc %03X after %llu", what.c_str(), actual.pc,
+                static_cast<unsigned long long>(actual.cycles), expected.pc, static_cast<unsigned long long>(expected.cycles));
+    if (actual.memory != expected.memory)
+        std::printf(", memory differs");
+    if (actual.display != expected.display || actual.hires != expected.hires)
+        std::printf(", display differs");
+    if (actual.registers != expected.registers || actual.index != expected.index)
+        std::printf(", registers differ");
+    std::printf("\n");
+    return true;
+}
+
+// the number of engines that did not end up where the reference did
+size_t check_rom(const std::vector<uint8_t>& rom, const std::string& name, QuirkProfile quirks, uint64_t cycles) {
+    const Snapshot start    = power_on(rom, 0, uint16_t{ 1 } << answer_key);
+    const Snapshot expected = reference_run(start, quirks, cycles);
+
+    size_t failed = 0;
+    for (const auto& [engine_name, engine] : engines) {
+        // in one go, and in uneven slices that end in the middle of blocks and compiled code
+        Chip8Emulator whole = machine(start, quirks);
+        run_until(whole, cycles, [&](uint64_t budget) { return run_engine(whole, engine, budget); });
+        if (differs(expected, whole.snapshot(), name + " " + engine_name))
+            ++failed;
+
+        // again after going back to the start, with whatever the run left in the caches that is still valid
+        whole.restore(start);
+        run_until(whole, cycles, [&](uint64_t budget) { return run_engine(whole, engine, budget); });
+        if (differs(expected, whole.snapshot(), name + " " + engine_name + " after a restore"))
+            ++failed;
+
+        Chip8Emulator sliced = machine(start, quirks);
+        run_until(sliced, cycles, [&](uint64_t budget) { return run_engine(sliced, engine, std::min<uint64_t>(budget, 37)); });
+        if (differs(expected, sliced.snapshot(), name + " " + engine_name + " in slices"))
+            ++failed;
+    }
+    return failed;
+}
+
+// Runs instances with different seeds and keys through run_batch() in lockstep, where they share blocks for as long as
+// they stay at the same pc and go their own ways once random numbers or keys send them elsewhere
+size_t check_lockstep(const std::vector<uint8_t>& rom, const std::string& name, QuirkProfile quirks, uint64_t cycles) {
+    std::vector<Snapshot> expected;
+    std::vector<Chip8Emulator> instances;
+    instances.reserve(lockstep_instances);
+    for (size_t i = 0; i < lockstep_instances; ++i) {
+        const Snapshot start = power_on(rom, i, i % 2 == 0 ? uint16_t{ 1 } << answer_key : 0);
+        expected.push_back(reference_run(start, quirks, cycles));
+        instances.push_back(machine(start, quirks));
+    }
+
+    BatchSettings settings;
+    settings.cycles   = cycles;
+    settings.wait_key = answer_key;
+    settings.threads  = 1;
+    settings.lockstep = true;
+    run_batch(instances, settings);
+
+    size_t failed = 0;
+    for (size_t i = 0; i < lockstep_instances; ++i) {
+        if (differs(expected[i], instances[i].snapshot(), name + " lockstep lane " + std::to_string(i)))
+            ++failed;
+    }
+    return failed;
+}
+
+// The compiler has to hand everything over to the block cache when it cannot switch its code buffer between writable
+// and executable, whichever of the two switches around a compilation fails
+size_t check_mprotect_failures(const std::vector<uint8_t>& rom, uint64_t cycles) {
+#if CHIP8_TEST_MPROTECT
+    const Snapshot start    = power_on(rom, 0, uint16_t{ 1 } << answer_key);
+    const Snapshot expected = reference_run(start, QuirkProfile::Default, cycles);
+
+    size_t failed = 0;
+    for (const int failing_call : { 1, 2 }) {
+        Chip8Emulator emulator = machine(start, QuirkProfile::Default);
+        mprotect_calls         = 0;
+        failing_mprotect_call  = failing_call;
+        run_until(emulator, cycles, [&](uint64_t budget) { return emulator.run_compiled(budget); });
+        const int calls        = mprotect_calls;
+        failing_mprotect_call  = 0;
+        const std::string name = "jit with mprotect call " + std::to_string(failing_call) + " failing";
+        if (calls != failing_call) {
+            std::printf("FAIL %s: the compiler called mprotect %d times\n", name.c_str(), calls);
+            ++failed;
+        }
+        if (differs(expected, emulator.snapshot(), name))
+            ++failed;
+    }
+    return failed;
+#else
+    (void)rom;
+    (void)cycles;
+    return 0;
+#endif
+}
+
+void print_usage(const char* name) {
+    std::cerr << "Usage: " << name << " [--roms N] [--cycles N] [--seed N]\n"
+              << "  --roms N        generated roms to check with every quirk profile (default 128)\n"
+              << "  --cycles N      instructions each of them runs for (default 10000)\n"
+              << "  --seed N        seed of the rom generator (default 1), the failures name the rom seeds\n";
+}
+
+std::optional<Options> parse_args(int argc, char* argv[]) {
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (i + 1 >= argc)
+            return std::nullopt;
+
+        if (arg == "--roms") {
+            options.roms = std::stoull(argv[++i]);
+        } else if (arg == "--cycles") {
+            options.cycles = std::stoull(argv[++i]);
+        } else if (arg == "--seed") {
+            options.seed = std::stoull(argv[++i]);
+        } else {
+            return std::nullopt;
+        }
+    }
+    return options;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    const std::optional<Options> options = [&]() -> std::optional<Options> {
+        try {
+            return parse_args(argc, argv);
+        } catch (const std::exception&) {
+            return std::nullopt;
+        }
+    }();
+    if (!options) {
+        print_usage(argv[0]);
+        return -1;
+    }
+
+    size_t failed = 0;
+    size_t checks = 0;
+    for (size_t i = 0; i < options->roms; ++i) {
+        // every rom has its own seed so that a failure can be run again alone with --roms 1
+        const uint64_t rom_seed        = options->seed + i;
+        const std::vector<uint8_t> rom = RomGenerator(rom_seed).next_rom();
+        for (size_t j = 0; j < std::size(profiles); ++j) {
+            const auto& [profile_name, quirks] = profiles[j];
+            const std::string name             = "rom " + std::to_string(rom_seed) + " " + profile_name;
+            failed += check_rom(rom, name, quirks, options->cycles);
+            // a batch costs as much as all the other checks together, each rom gets one under a profile in turn
+            if (j == i % std::size(profiles))
+                failed += check_lockstep(rom, name, quirks, options->cycles);
+            ++checks;
+        }
+    }
+    failed += check_mprotect_failures(RomGenerator(options->seed).next_rom(), options->cycles);
+    std::printf("%zu roms and profiles, %zu failed\n", checks, failed);
+    return failed == 0 ? 0 : 1;
+}